@@ -0,0 +1,235 @@
+#define _GNU_SOURCE
+#include "affinity.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "util/arena.h"
+#include "util/config.h"
+
+#define FAIL            -1
+#define SUCCESS         0
+#define NUMBASE         10
+#define AUTO_MODE       "auto"
+#ifndef CPU_SYSFS
+#define CPU_SYSFS       "/sys/devices/system/cpu"
+#endif
+// Attribute files of the caches are short
+#define SYSFS_VALUE_LEN 256
+#define INSTRUCTION_CACHE   "Instruction"
+
+struct cpu_list {
+    cpu_set_t set;
+};
+
+#define VEC_SOURCE
+#define vec_name    cpu_list
+#define vec_elem_t  struct cpu_list
+#include "util/vector.h"
+#undef VEC_SOURCE
+
+// Groups of CPUs that share the last level cache. NULL if the automatic mode
+// is disabled.
+static struct vec_cpu_list_t* cache_groups;
+// Group for the next pipeline
+static size_t next_group;
+// Affinity saved by push_cpu_affinity()
+static cpu_set_t saved_affinity;
+
+// Parses list of CPUs to set
+static int parse_cpu_set(const char* list, cpu_set_t* set);
+
+// Reads the file of the cpu's cache to buf without the trailing '\n'
+static int read_cache_file(int cpu, int index, const char* name, char* buf);
+
+// Reads CPUs that share the last level cache with the cpu
+static int read_cache_group(int cpu, cpu_set_t* group);
+
+// Adds group unless it's already added
+static int add_cache_group(const cpu_set_t* group);
+
+int init_affinity(const char* name)
+{
+    _shell_assert(name);
+
+    const char* mode = getenv(name);
+    if (!mode || !*mode)
+        return SUCCESS;
+    if (strcmp(mode, AUTO_MODE) != 0) {
+        _shell_flush_fprintf("%s: invalid mode '%s'\n", name, mode);
+        return FAIL;
+    }
+
+    // CPUs the shell may not use are not in any group
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == FAIL
+        || !(cache_groups = vec_cpu_list_new())) {
+        _shell_pperror(name);
+        return FAIL;
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        cpu_set_t group;
+        if (!CPU_ISSET(cpu, &allowed) || read_cache_group(cpu, &group) == FAIL)
+            continue;
+        CPU_AND(&group, &group, &allowed);
+        if (add_cache_group(&group) == FAIL) {
+            _shell_pperror(name);
+            release_affinity();
+            return FAIL;
+        }
+    }
+
+    // Everything shares the cache, so there is nothing to choose
+    if (vec_size(cache_groups) < 2)
+        release_affinity();
+    return SUCCESS;
+}
+
+void release_affinity()
+{
+    vec_cpu_list_delete(cache_groups);
+    cache_groups = NULL;
+}
+
+struct cpu_list* parse_cpu_list(const char* list, struct arena* arena)
+{
+    _shell_assert(list);
+
+    struct cpu_list* cpus = (struct cpu_list*)arena_alloc(arena, sizeof(*cpus));
+    if (!cpus)
+        return NULL;
+    if (parse_cpu_set(list, &cpus->set) == FAIL) {
+        errno = EINVAL;
+        return NULL;
+    }
+    return cpus;
+}
+
+const struct cpu_list* get_pipeline_cpus()
+{
+    if (!cache_groups)
+        return NULL;
+    const struct cpu_list* cpus = vec_at_ptr(cache_groups, next_group);
+    next_group = (next_group + 1) % vec_size(cache_groups);
+    return cpus;
+}
+
+int set_cpu_affinity(const struct cpu_list* cpus)
+{
+    _shell_assert(cpus);
+
+    return sched_setaffinity(0, sizeof(cpus->set), &cpus->set);
+}
+
+int push_cpu_affinity(const struct cpu_list* cpus)
+{
+    _shell_assert(cpus);
+
+    if (sched_getaffinity(0, sizeof(saved_affinity), &saved_affinity) == FAIL)
+        return FAIL;
+    return set_cpu_affinity(cpus);
+}
+
+void pop_cpu_affinity()
+{
+    sched_setaffinity(0, sizeof(saved_affinity), &saved_affinity);
+}
+
+static int parse_cpu_set(const char* list, cpu_set_t* set)
+{
+    _shell_assert(list);
+    _shell_assert(set);
+
+    CPU_ZERO(set);
+    // Every item is either a CPU or a range of them
+    while (true) {
+        if (!isdigit(*list))
+            return FAIL;
+        char* end;
+        unsigned long first = strtoul(list, &end, NUMBASE);
+        unsigned long last = first;
+        if (*end == '-') {
+            list = end + 1;
+            if (!isdigit(*list))
+                return FAIL;
+            last = strtoul(list, &end, NUMBASE);
+        }
+        if (first > last || last >= CPU_SETSIZE)
+            return FAIL;
+        for (unsigned long cpu = first; cpu <= last; ++cpu)
+            CPU_SET(cpu, set);
+
+        if (!*end)
+            return SUCCESS;
+        if (*end != ',')
+            return FAIL;
+        list = end + 1;
+    }
+}
+
+static int read_cache_file(int cpu, int index, const char* name, char* buf)
+{
+    _shell_assert(name);
+    _shell_assert(buf);
+
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/cache/index%d/%s", cpu, index, name);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == FAIL)
+        return FAIL;
+    ssize_t count = read(fd, buf, SYSFS_VALUE_LEN - 1);
+    close(fd);
+    if (count <= 0)
+        return FAIL;
+    if (buf[count - 1] == '\n')
+        --count;
+    buf[count] = '\0';
+    return SUCCESS;
+}
+
+static int read_cache_group(int cpu, cpu_set_t* group)
+{
+    _shell_assert(group);
+
+    // Caches of the CPU are index0, index1, ... The last level one is the
+    // biggest data or unified cache.
+    long max_level = 0;
+    char buf[SYSFS_VALUE_LEN];
+    cpu_set_t shared;
+    for (int index = 0; read_cache_file(cpu, index, "level", buf) == SUCCESS; ++index) {
+        long level = strtol(buf, NULL, NUMBASE);
+        if (level <= max_level || read_cache_file(cpu, index, "type", buf) == FAIL
+            || strcmp(buf, INSTRUCTION_CACHE) == 0) {
+            continue;
+        }
+        if (read_cache_file(cpu, index, "shared_cpu_list", buf) == FAIL
+            || parse_cpu_set(buf, &shared) == FAIL) {
+            continue;
+        }
+        max_level = level;
+        *group = shared;
+    }
+    return max_level ? SUCCESS : FAIL;
+}
+
+static int add_cache_group(const cpu_set_t* group)
+{
+    _shell_assert(group);
+
+    if (!CPU_COUNT(group))
+        return SUCCESS;
+    for (size_t i = 0; i < vec_size(cache_groups); ++i) {
+        if (CPU_EQUAL(&vec_at_ptr(cache_groups, i)->set, group))
+            return SUCCESS;
+    }
+    struct cpu_list cpus = {.set = *group};
+    return vec_cpu_list_push_back(cache_groups, cpus);
+}
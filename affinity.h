@@ -0,0 +1,39 @@
+#ifndef OS_LABS_RSHELL_AFFINITY_H_
+#define OS_LABS_RSHELL_AFFINITY_H_
+
+// CPU affinity of commands. Lists of CPUs are written like taskset(1) -c
+// does: "0,2,4-7". In the automatic mode every pipeline is placed on CPUs
+// that share the last level cache, so data passed through its pipes stays
+// in the cache. The next pipelines take the next groups of such CPUs.
+
+struct arena;
+// Set of CPUs
+struct cpu_list;
+
+// Enables the automatic mode if the environment variable name is "auto".
+// Groups of CPUs are read from /sys/devices/system/cpu.
+// Returns 0 if the mode is set or disabled, -1 on error.
+int init_affinity(const char* name);
+
+// Releases groups of CPUs
+void release_affinity();
+
+// Parses list of CPUs and allocates the set in the arena.
+// Returns NULL with errno EINVAL if the list is invalid or on error.
+struct cpu_list* parse_cpu_list(const char* list, struct arena* arena);
+
+// Returns CPUs for the next pipeline in the automatic mode or NULL if the
+// pipeline stays where the scheduler puts it.
+const struct cpu_list* get_pipeline_cpus();
+
+// Binds the calling process to cpus
+int set_cpu_affinity(const struct cpu_list* cpus);
+
+// Binds the calling thread to cpus and saves the previous affinity, so
+// children started by posix_spawn(3) inherit cpus.
+int push_cpu_affinity(const struct cpu_list* cpus);
+
+// Restores affinity saved by push_cpu_affinity()
+void pop_cpu_affinity();
+
+#endif // OS_LABS_RSHELL_AFFINITY_H_
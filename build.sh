@@ -9,3 +9,24 @@ gcc -O2 -std=gnu11 tests/print1sec.c -o build/print1sec
 gcc -O2 -std=gnu11 tests/catch_tstp.c -o build/catch_tstp
 g++ -O2 -std=c++11 tests/returns.cc -o build/returns
 g++ -O2 -std=c++11 tests/returns1sec.cc -o build/returns1sec
+gcc -O2 -std=gnu11 -Iutil tests/binsearch_test.c util/binsearch.c -o build/binsearch_test
+gcc -O2 -std=gnu11 tests/pty_bench.c -o build/pty_bench
+
+gcc -O2 -std=gnu11 tests/launch_bench.c -o build/launch_bench
+gcc -O2 -std=gnu11 tests/pipe_bench.c -o build/pipe_bench
+gcc -O2 -std=gnu11 tests/builtin_bench.c -o build/builtin_bench
+gcc -O2 -std=gnu11 tests/parallel_stress.c -o build/parallel_stress
+gcc -O2 -std=gnu11 tests/script_exec_test.c -o build/script_exec_test
+gcc -O2 -std=gnu11 tests/stdin_test.c -o build/stdin_test
+gcc -O2 -std=gnu11 tests/reap_stress.c events.c sig.c jobs.c command.c redirection.c \
+    util/config.c util/pperror.c util/vec_string.c util/utils.c util/binsearch.c \
+    util/arena.c util/line.c util/trace.c -o build/reap_stress
+gcc -O2 -std=gnu11 tests/alloc_bench.c -o build/alloc_bench
+gcc -O2 -std=gnu11 -shared -fPIC tests/malloc_count.c -o build/libmalloc_count.so
+gcc -O2 -std=gnu11 tests/flatmap_bench.c util/utils.c util/binsearch.c util/arena.c \
+    -o build/flatmap_bench
+gcc -O2 -std=gnu11 tests/micro_bench.c parseline.c affinity.c pipes.c events.c sig.c jobs.c \
+    command.c redirection.c util/config.c util/pperror.c util/vec_string.c util/utils.c \
+    util/binsearch.c util/arena.c util/line.c util/trace.c -o build/micro_bench
+gcc -O2 -std=gnu11 tests/history_bench.c history.c util/config.c util/pperror.c \
+    util/vec_string.c util/binsearch.c util/arena.c -o build/history_bench
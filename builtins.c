@@ -0,0 +1,781 @@
+#include "builtins.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdio_ext.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util/config.h"
+
+#define FAIL            -1
+#define SUCCESS         0
+#define NUMBASE         10
+#define OCTAL_BASE      8
+#define HEX_BASE        16
+#define DISABLED_MODE   "off"
+#define DIGITS          "0123456789"
+#define OCTAL_DIGITS    "01234567"
+#define HEX_DIGITS      "0123456789abcdefABCDEF"
+// Flags of a conversion specification of printf, they are passed to
+// printf(3) as they are
+#define PRINTF_FLAGS    "-+ #0"
+#define PRINTF_CONVERSIONS  "diouxXcsbeEfFgGaA"
+// Conversion specification with the length modifier must fit
+#define SPEC_LEN        32
+// Options of test that get one argument
+#define TEST_UNARY_OPS  "bcdefghkLnprsStuwxzOG"
+#define NS_IN_SEC       1000000000L
+// Longer sleeps are the same as infinite ones
+#define MAX_SLEEP_SEC   INT_MAX
+
+// Fast builtins are used instead of programs
+static bool enabled = true;
+
+// Arguments of test and position of the one being evaluated
+struct test_args {
+    // Name of the command, test or [
+    const char* name;
+    char* const* args;
+    size_t count;
+    size_t pos;
+    // The expression is invalid, the error was printed
+    bool error;
+};
+
+// Binary operators of test
+static const char* const test_binary_ops[] = {
+    "=", "==", "!=", "-eq", "-ne", "-lt", "-le", "-gt", "-ge", "-nt", "-ot", "-ef", NULL
+};
+
+// Flushes the standard output. On error prints it and drops the rest of the
+// output, so it's not printed by the next command.
+static int flush_output(const char* name);
+
+// Prints the character of the escape sequence at *s, that is the character
+// after the backslash, and moves *s after the sequence. Octal numbers are
+// \0NNN in echo and \NNN in printf. Returns false if it's \c, nothing must
+// be printed after it.
+static bool print_escape(const char** s, bool echo_octal);
+
+// Prints the string interpreting escape sequences. Returns false if the
+// output was stopped by \c.
+static bool print_escaped(const char* s, bool echo_octal);
+
+// Returns true iff the argument of echo consists of its options
+static bool is_echo_options(const char* arg);
+
+// Prints the format once with arguments from *arg and moves *arg after the
+// used ones. stop is set if nothing must be printed after it.
+static int print_format(const char* format, char* const** arg, bool* stop);
+
+// Prints the value with the conversion specification spec of length len
+// without the conversion character conv. value may be NULL if there are no
+// arguments left.
+static int print_conversion(char* spec, size_t len, char conv, const char* value);
+
+// Parses the number for printf. Quoted character is its code. Prints errors,
+// the parsed part is still used.
+static int parse_printf_integer(const char* value, long long* number);
+
+// Parses the floating-point number for printf
+static int parse_printf_float(const char* value, long double* number);
+
+// Expression of test: operands of -o
+static bool test_or(struct test_args* t);
+
+// Operands of -a
+static bool test_and(struct test_args* t);
+
+// Negation with !
+static bool test_not(struct test_args* t);
+
+// Parenthesized expression, unary or binary operator or a string
+static bool test_primary(struct test_args* t);
+
+// Evaluates unary operator op, like f for -f
+static bool test_unary(struct test_args* t, char op, const char* arg);
+
+// Evaluates binary operator
+static bool test_binary(struct test_args* t, const char* lhs, const char* op, const char* rhs);
+
+// Returns true iff arg is a binary operator of test
+static bool is_test_binary(const char* arg);
+
+// Returns true iff arg is a unary operator of test
+static bool is_test_unary(const char* arg);
+
+// Parses the integer operand of test. Prints errors.
+static int parse_test_integer(struct test_args* t, const char* str, long long* number);
+
+// Returns true iff lhs is later than rhs
+static bool is_later(const struct timespec* lhs, const struct timespec* rhs);
+
+// Parses the interval of sleep in seconds
+static int parse_interval(const char* str, double* seconds);
+
+// Does nothing, SIGINT only interrupts sleep
+static void wake_up(int signo);
+
+void init_builtins(const char* name)
+{
+    _shell_assert(name);
+
+    const char* value = getenv(name);
+    enabled = !value || strcmp(value, DISABLED_MODE) != 0;
+}
+
+bool has_fast_builtins()
+{
+    return enabled;
+}
+
+int run_echo(char* const* args)
+{
+    _shell_assert(args && *args);
+
+    bool newline = true;
+    bool escapes = false;
+    // Options are only the first arguments that look like options
+    for (++args; *args && is_echo_options(*args); ++args) {
+        for (const char* option = *args + 1; *option; ++option) {
+            if (*option == 'n')
+                newline = false;
+            else
+                escapes = *option == 'e';
+        }
+    }
+
+    bool stopped = false;
+    for (bool first = true; *args && !stopped; ++args, first = false) {
+        if (!first)
+            putchar(' ');
+        if (escapes)
+            stopped = !print_escaped(*args, true);
+        else
+            fputs(*args, stdout);
+    }
+    if (newline && !stopped)
+        putchar('\n');
+
+    return flush_output("echo");
+}
+
+int run_printf(char* const* args)
+{
+    _shell_assert(args && *args);
+
+    const char* format = args[1];
+    if (!format) {
+        _shell_flush_fputs("printf: usage: printf format [arguments]\n");
+        return FAIL;
+    }
+
+    int retval = SUCCESS;
+    char* const* arg = args + 2;
+    // The format is printed once and then again while it uses arguments
+    bool stop = false;
+    do {
+        char* const* begin = arg;
+        if (print_format(format, &arg, &stop) == FAIL)
+            retval = FAIL;
+        if (arg == begin)
+            break;
+    } while (*arg && !stop);
+
+    if (flush_output("printf") == FAIL)
+        retval = FAIL;
+    return retval;
+}
+
+int run_test(char* const* args)
+{
+    _shell_assert(args && *args);
+
+    struct test_args t = {.name = args[0], .args = args, .count = 0, .pos = 1, .error = false};
+    while (args[t.count])
+        ++t.count;
+    if (strcmp(t.name, "[") == 0) {
+        if (strcmp(args[t.count - 1], "]") != 0) {
+            _shell_flush_fputs("[: missing ]\n");
+            return FAIL;
+        }
+        --t.count;
+    }
+    // Empty expression is false
+    if (t.pos == t.count)
+        return FAIL;
+
+    bool result = test_or(&t);
+    if (!t.error && t.pos != t.count) {
+        _shell_flush_fprintf("%s: %s: unexpected argument\n", t.name, args[t.pos]);
+        t.error = true;
+    }
+    return !t.error && result ? SUCCESS : FAIL;
+}
+
+int run_pwd(char* const* args)
+{
+    (void) args;
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        _shell_pperror("pwd");
+        return FAIL;
+    }
+    puts(cwd);
+    return flush_output("pwd");
+}
+
+int run_sleep(char* const* args)
+{
+    _shell_assert(args && *args);
+
+    if (!args[1]) {
+        _shell_flush_fputs("sleep: missing operand\n");
+        return FAIL;
+    }
+    double seconds = 0;
+    for (char* const* arg = args + 1; *arg; ++arg) {
+        double interval;
+        if (parse_interval(*arg, &interval) == FAIL) {
+            _shell_flush_fprintf("sleep: invalid time interval '%s'\n", *arg);
+            return FAIL;
+        }
+        seconds += interval;
+    }
+    struct timespec left = {.tv_sec = MAX_SLEEP_SEC, .tv_nsec = 0};
+    if (seconds < MAX_SLEEP_SEC) {
+        left.tv_sec = (time_t)seconds;
+        left.tv_nsec = (long)((seconds - left.tv_sec) * NS_IN_SEC);
+    }
+
+    // The interactive shell ignores SIGINT, so it's caught to interrupt the
+    // sleep. Forked children are interrupted like programs.
+    bool catch_sigint = shell_interactive && !internal_executing;
+    struct sigaction nact = {.sa_handler = wake_up, .sa_flags = 0};
+    struct sigaction oact;
+    sigemptyset(&nact.sa_mask);
+    if (catch_sigint && sigaction(SIGINT, &nact, &oact) == FAIL) {
+        _shell_pperror("sleep");
+        return FAIL;
+    }
+
+    int retval = SUCCESS;
+    if (nanosleep(&left, &left) == FAIL) {
+        // The next prompt starts from the new line like after killed jobs
+        if (errno == EINTR && catch_sigint)
+            fputc('\n', shell_outstream);
+        else
+            _shell_pperror("sleep");
+        retval = FAIL;
+    }
+
+    if (catch_sigint && sigaction(SIGINT, &oact, NULL) == FAIL)
+        _shell_pperror("sleep");
+    return retval;
+}
+
+static int flush_output(const char* name)
+{
+    _shell_assert(name);
+
+    if (fflush(stdout) == EOF || ferror(stdout)) {
+        _shell_pperror(name);
+        __fpurge(stdout);
+        clearerr(stdout);
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+static bool print_escape(const char** s, bool echo_octal)
+{
+    _shell_assert(s && *s);
+
+    const char* p = *s;
+    int c = *p++;
+    switch (c) {
+    case 'a': c = '\a'; break;
+    case 'b': c = '\b'; break;
+    case 'e': c = '\033'; break;
+    case 'f': c = '\f'; break;
+    case 'n': c = '\n'; break;
+    case 'r': c = '\r'; break;
+    case 't': c = '\t'; break;
+    case 'v': c = '\v'; break;
+    case '\\': break;
+    case 'c':
+        *s = p;
+        return false;
+    case 'x':
+        // \x without digits is printed as it is
+        if (!*p || !strchr(HEX_DIGITS, *p)) {
+            putchar('\\');
+            break;
+        }
+        c = 0;
+        for (int i = 0; i < 2 && *p && strchr(HEX_DIGITS, *p); ++i, ++p)
+            c = c * HEX_BASE + (*p <= '9' ? *p - '0' : (*p | ' ') - 'a' + 10);
+        break;
+    default:
+        if (c && (echo_octal ? c == '0' : strchr(OCTAL_DIGITS, c) != NULL)) {
+            if (!echo_octal)
+                --p;
+            c = 0;
+            for (int i = 0; i < 3 && *p && strchr(OCTAL_DIGITS, *p); ++i, ++p)
+                c = c * OCTAL_BASE + *p - '0';
+            break;
+        }
+        // Unknown escapes and the backslash at the end are printed as they are
+        putchar('\\');
+        if (!c) {
+            *s = p - 1;
+            return true;
+        }
+        break;
+    }
+    putchar(c);
+    *s = p;
+    return true;
+}
+
+static bool print_escaped(const char* s, bool echo_octal)
+{
+    _shell_assert(s);
+
+    while (*s) {
+        size_t len = strcspn(s, "\\");
+        fwrite(s, 1, len, stdout);
+        s += len;
+        if (!*s)
+            break;
+        ++s;
+        if (!print_escape(&s, echo_octal))
+            return false;
+    }
+    return true;
+}
+
+static bool is_echo_options(const char* arg)
+{
+    _shell_assert(arg);
+
+    return arg[0] == '-' && arg[1] && strspn(arg + 1, "neE") == strlen(arg + 1);
+}
+
+static int print_format(const char* format, char* const** arg, bool* stop)
+{
+    _shell_assert(format);
+    _shell_assert(arg && *arg);
+    _shell_assert(stop);
+
+    int retval = SUCCESS;
+    const char* s = format;
+    while (*s) {
+        size_t len = strcspn(s, "\\%");
+        fwrite(s, 1, len, stdout);
+        s += len;
+        if (!*s)
+            break;
+
+        if (*s++ == '\\') {
+            if (!print_escape(&s, false)) {
+                *stop = true;
+                return retval;
+            }
+            continue;
+        }
+        if (*s == '%') {
+            putchar('%');
+            ++s;
+            continue;
+        }
+
+        // Conversion specification: flags, width, precision and conversion
+        len = strspn(s, PRINTF_FLAGS);
+        len += strspn(s + len, DIGITS);
+        if (s[len] == '.') {
+            ++len;
+            len += strspn(s + len, DIGITS);
+        }
+        char conv = s[len];
+        // One more byte for %, the length modifier, conversion and '\0'
+        if (!conv || !strchr(PRINTF_CONVERSIONS, conv) || len + 5 > SPEC_LEN) {
+            _shell_flush_fprintf("printf: %%%.*s: invalid conversion\n", (int)len + (conv != 0), s);
+            *stop = true;
+            return FAIL;
+        }
+        const char* value = **arg ? *(*arg)++ : NULL;
+        if (conv == 'b') {
+            if (value && !print_escaped(value, true)) {
+                *stop = true;
+                return retval;
+            }
+        }
+        else {
+            char spec[SPEC_LEN] = "%";
+            memcpy(spec + 1, s, len);
+            if (print_conversion(spec, len + 1, conv, value) == FAIL)
+                retval = FAIL;
+        }
+        s += len + 1;
+    }
+    return retval;
+}
+
+static int print_conversion(char* spec, size_t len, char conv, const char* value)
+{
+    _shell_assert(spec);
+
+    int retval = SUCCESS;
+    switch (conv) {
+    case 's':
+    case 'c':
+        // Missing or empty character is an empty string
+        if (conv == 'c' && value && *value) {
+            strcpy(spec + len, "c");
+            printf(spec, *value);
+            break;
+        }
+        strcpy(spec + len, "s");
+        printf(spec, value ? value : "");
+        break;
+    case 'd':
+    case 'i':
+    case 'o':
+    case 'u':
+    case 'x':
+    case 'X':;
+        long long number;
+        retval = parse_printf_integer(value, &number);
+        spec[len] = 'l';
+        spec[len + 1] = 'l';
+        spec[len + 2] = conv;
+        spec[len + 3] = '\0';
+        if (conv == 'd' || conv == 'i')
+            printf(spec, number);
+        else
+            printf(spec, (unsigned long long)number);
+        break;
+    default:;
+        long double real;
+        retval = parse_printf_float(value, &real);
+        spec[len] = 'L';
+        spec[len + 1] = conv;
+        spec[len + 2] = '\0';
+        printf(spec, real);
+        break;
+    }
+    return retval;
+}
+
+static int parse_printf_integer(const char* value, long long* number)
+{
+    _shell_assert(number);
+
+    *number = 0;
+    if (!value || !*value)
+        return SUCCESS;
+    if (*value == '\'' || *value == '"') {
+        *number = (unsigned char)value[1];
+        return SUCCESS;
+    }
+
+    char* end;
+    errno = 0;
+    // Unsigned values may be greater than LLONG_MAX
+    if (*value == '-')
+        *number = strtoll(value, &end, 0);
+    else
+        *number = (long long)strtoull(value, &end, 0);
+    if (end == value || *end || errno) {
+        _shell_flush_fprintf("printf: %s: invalid number\n", value);
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+static int parse_printf_float(const char* value, long double* number)
+{
+    _shell_assert(number);
+
+    *number = 0;
+    if (!value || !*value)
+        return SUCCESS;
+    if (*value == '\'' || *value == '"') {
+        *number = (unsigned char)value[1];
+        return SUCCESS;
+    }
+
+    char* end;
+    errno = 0;
+    *number = strtold(value, &end);
+    if (end == value || *end || errno) {
+        _shell_flush_fprintf("printf: %s: invalid number\n", value);
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+static bool test_or(struct test_args* t)
+{
+    _shell_assert(t);
+
+    bool result = test_and(t);
+    while (!t->error && t->pos < t->count && strcmp(t->args[t->pos], "-o") == 0) {
+        ++t->pos;
+        bool rhs = test_and(t);
+        result = result || rhs;
+    }
+    return result;
+}
+
+static bool test_and(struct test_args* t)
+{
+    _shell_assert(t);
+
+    bool result = test_not(t);
+    while (!t->error && t->pos < t->count && strcmp(t->args[t->pos], "-a") == 0) {
+        ++t->pos;
+        bool rhs = test_not(t);
+        result = result && rhs;
+    }
+    return result;
+}
+
+static bool test_not(struct test_args* t)
+{
+    _shell_assert(t);
+
+    // ! = x compares ! with x
+    size_t left = t->count - t->pos;
+    if (left >= 2 && strcmp(t->args[t->pos], "!") == 0
+        && !(left >= 3 && is_test_binary(t->args[t->pos + 1]))) {
+        ++t->pos;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static bool test_primary(struct test_args* t)
+{
+    _shell_assert(t);
+
+    size_t left = t->count - t->pos;
+    if (!left) {
+        _shell_flush_fprintf("%s: argument expected\n", t->name);
+        t->error = true;
+        return false;
+    }
+
+    char* const* args = t->args + t->pos;
+    // Binary operators are checked first, so -f = -f compares strings
+    if (left >= 3 && is_test_binary(args[1])) {
+        t->pos += 3;
+        return test_binary(t, args[0], args[1], args[2]);
+    }
+    if (left >= 2 && strcmp(args[0], "(") == 0) {
+        ++t->pos;
+        bool result = test_or(t);
+        if (!t->error && (t->pos == t->count || strcmp(t->args[t->pos], ")") != 0)) {
+            _shell_flush_fprintf("%s: ')' expected\n", t->name);
+            t->error = true;
+        }
+        ++t->pos;
+        return result;
+    }
+    if (left >= 2 && is_test_unary(args[0])) {
+        t->pos += 2;
+        return test_unary(t, args[0][1], args[1]);
+    }
+    // Single string is true iff it's not empty
+    ++t->pos;
+    return *args[0];
+}
+
+static bool test_unary(struct test_args* t, char op, const char* arg)
+{
+    _shell_assert(t);
+    _shell_assert(arg);
+
+    long long fd;
+    switch (op) {
+    case 'n':
+        return *arg;
+    case 'z':
+        return !*arg;
+    case 't':
+        return parse_test_integer(t, arg, &fd) == SUCCESS && fd >= 0 && fd <= INT_MAX
+               && isatty((int)fd);
+    case 'r':
+        return faccessat(AT_FDCWD, arg, R_OK, AT_EACCESS) == SUCCESS;
+    case 'w':
+        return faccessat(AT_FDCWD, arg, W_OK, AT_EACCESS) == SUCCESS;
+    case 'x':
+        return faccessat(AT_FDCWD, arg, X_OK, AT_EACCESS) == SUCCESS;
+    default:
+        break;
+    }
+
+    struct stat st;
+    if ((op == 'h' || op == 'L' ? lstat(arg, &st) : stat(arg, &st)) == FAIL)
+        return false;
+    switch (op) {
+    case 'b':
+        return S_ISBLK(st.st_mode);
+    case 'c':
+        return S_ISCHR(st.st_mode);
+    case 'd':
+        return S_ISDIR(st.st_mode);
+    case 'f':
+        return S_ISREG(st.st_mode);
+    case 'g':
+        return st.st_mode & S_ISGID;
+    case 'h':
+    case 'L':
+        return S_ISLNK(st.st_mode);
+    case 'k':
+        return st.st_mode & S_ISVTX;
+    case 'p':
+        return S_ISFIFO(st.st_mode);
+    case 's':
+        return st.st_size > 0;
+    case 'S':
+        return S_ISSOCK(st.st_mode);
+    case 'u':
+        return st.st_mode & S_ISUID;
+    case 'O':
+        return st.st_uid == geteuid();
+    case 'G':
+        return st.st_gid == getegid();
+    default:
+        // -e
+        return true;
+    }
+}
+
+static bool test_binary(struct test_args* t, const char* lhs, const char* op, const char* rhs)
+{
+    _shell_assert(t);
+    _shell_assert(lhs);
+    _shell_assert(op);
+    _shell_assert(rhs);
+
+    if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+        return strcmp(lhs, rhs) == 0;
+    if (strcmp(op, "!=") == 0)
+        return strcmp(lhs, rhs) != 0;
+
+    // Files are compared by modification times and identity
+    if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0) {
+        struct stat lst, rst;
+        bool lexists = stat(lhs, &lst) == SUCCESS;
+        bool rexists = stat(rhs, &rst) == SUCCESS;
+        if (op[1] == 'n')
+            return lexists && (!rexists || is_later(&lst.st_mtim, &rst.st_mtim));
+        if (op[1] == 'o')
+            return rexists && (!lexists || is_later(&rst.st_mtim, &lst.st_mtim));
+        return lexists && rexists && lst.st_dev == rst.st_dev && lst.st_ino == rst.st_ino;
+    }
+
+    long long lnum, rnum;
+    if (parse_test_integer(t, lhs, &lnum) == FAIL || parse_test_integer(t, rhs, &rnum) == FAIL)
+        return false;
+    if (strcmp(op, "-eq") == 0)
+        return lnum == rnum;
+    if (strcmp(op, "-ne") == 0)
+        return lnum != rnum;
+    if (strcmp(op, "-lt") == 0)
+        return lnum < rnum;
+    if (strcmp(op, "-le") == 0)
+        return lnum <= rnum;
+    if (strcmp(op, "-gt") == 0)
+        return lnum > rnum;
+    return lnum >= rnum;
+}
+
+static bool is_test_binary(const char* arg)
+{
+    _shell_assert(arg);
+
+    for (const char* const* op = test_binary_ops; *op; ++op) {
+        if (strcmp(arg, *op) == 0)
+            return true;
+    }
+    return false;
+}
+
+static bool is_test_unary(const char* arg)
+{
+    _shell_assert(arg);
+
+    return arg[0] == '-' && arg[1] && !arg[2] && strchr(TEST_UNARY_OPS, arg[1]);
+}
+
+static int parse_test_integer(struct test_args* t, const char* str, long long* number)
+{
+    _shell_assert(t);
+    _shell_assert(str);
+    _shell_assert(number);
+
+    char* end;
+    errno = 0;
+    *number = strtoll(str, &end, NUMBASE);
+    // Spaces around the number are allowed
+    while (*end == ' ' || *end == '\t')
+        ++end;
+    if (end == str || *end || errno) {
+        _shell_flush_fprintf("%s: %s: integer expression expected\n", t->name, str);
+        t->error = true;
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+static bool is_later(const struct timespec* lhs, const struct timespec* rhs)
+{
+    _shell_assert(lhs);
+    _shell_assert(rhs);
+
+    return lhs->tv_sec > rhs->tv_sec
+           || (lhs->tv_sec == rhs->tv_sec && lhs->tv_nsec > rhs->tv_nsec);
+}
+
+static int parse_interval(const char* str, double* seconds)
+{
+    _shell_assert(str);
+    _shell_assert(seconds);
+
+    char* end;
+    errno = 0;
+    double value = strtod(str, &end);
+    // NaN is not compared
+    if (end == str || errno || !(value >= 0))
+        return FAIL;
+    double unit = 1;
+    switch (*end) {
+    case 'd': unit *= 24; // fall through
+    case 'h': unit *= 60; // fall through
+    case 'm': unit *= 60; // fall through
+    case 's': ++end; break;
+    default: break;
+    }
+    if (*end)
+        return FAIL;
+    *seconds = value * unit;
+    return SUCCESS;
+}
+
+static void wake_up(int signo)
+{
+    (void) signo;
+}
@@ -0,0 +1,39 @@
+#ifndef OS_LABS_RSHELL_BUILTINS_H_
+#define OS_LABS_RSHELL_BUILTINS_H_
+
+#include <stdbool.h>
+
+// Fast builtins replace trivial utilities: echo, printf, test and [, pwd and
+// sleep. Like other internal commands they are executed by the shell itself
+// unless they are a part of a pipeline or a background job, so no process is
+// started for them. They write to the standard output and flush it before
+// return. args are NULL-terminated, args[0] is the command's name.
+// Every builtin returns 0 on success and -1 on fail, that is the exit
+// status 1.
+
+// Disables fast builtins if the variable with the name is "off", so the
+// programs are executed instead
+void init_builtins(const char* name);
+
+// Returns true iff fast builtins are enabled
+bool has_fast_builtins();
+
+// Prints arguments separated by spaces. -n omits the newline, -e interprets
+// backslash escapes and -E does not.
+int run_echo(char* const* args);
+
+// Prints arguments according to the format. The format is reused while there
+// are arguments left.
+int run_printf(char* const* args);
+
+// Evaluates the expression of test(1). [ must get ] as its last argument.
+int run_test(char* const* args);
+
+// Prints the current working directory
+int run_pwd(char* const* args);
+
+// Sleeps for the sum of the intervals, they may be fractional and have s, m,
+// h or d suffix. The interactive shell is woken up by SIGINT.
+int run_sleep(char* const* args);
+
+#endif // OS_LABS_RSHELL_BUILTINS_H_
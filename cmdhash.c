@@ -0,0 +1,279 @@
+#include "cmdhash.h"
+
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "util/config.h"
+
+// Cached path of the program
+struct cmd_path {
+    char* path;
+    // Index of the PATH directory where the program was found
+    size_t dir;
+    // Number of times the cached path was used
+    size_t hits;
+};
+
+// Directory from PATH
+struct path_dir {
+    const char* name;
+    // Modification time at the moment the directory was checked. Zero if there
+    // is no such directory.
+    struct timespec mtime;
+};
+
+// Frees cached path. Works with NULL.
+static void free_cmd_path(struct cmd_path* self);
+
+// Frees program name
+static void free_name(const char* name);
+
+#define FM_SOURCE
+#define fm_name         cmd_path
+#define fm_key_t        const char*
+#define fm_free_key     free_name
+#define fm_key_cmp      strcmp
+#define fm_data_t       struct cmd_path*
+#define fm_free_data    free_cmd_path
+#include "util/flatmap.h"
+#undef FM_SOURCE
+
+#define VEC_SOURCE
+#define vec_name    path_dir
+#define vec_elem_t  struct path_dir
+#include "util/vector.h"
+#undef VEC_SOURCE
+
+#define FAIL            -1
+#define SUCCESS         0
+// The same PATH as execvp(3) uses if there is no PATH in the environment
+#define DEFAULT_PATH    "/bin:/usr/bin"
+#define CURRENT_DIR     "."
+
+// Cached paths by program names
+static struct fm_cmd_path_t* cache;
+// PATH that was used to fill the cache
+static char* cached_path_env;
+// Copy of cached_path_env splitted to directories. path_dirs point to it.
+static char* path_dirs_buff;
+// Directories from PATH in the same order
+static struct vec_path_dir_t* path_dirs;
+// Buffer for the last found path
+static char found_path[PATH_MAX];
+
+// Resets directories and clears the cache if PATH has changed.
+static int update_path_dirs();
+
+// Sets mtime of the directory.
+static void stat_path_dir(struct path_dir* dir);
+
+// Returns true iff the first count directories were not modified since the
+// last check.
+static bool path_dirs_unchanged(size_t count);
+
+// Searches for the program in PATH directories and puts its path to
+// found_path. Returns index of the directory or -1 if there is no such
+// program.
+static long search_path_dirs(const char* name);
+
+// Prints one cached path. This function will be passed to flatmap.
+static void print_cmd_path(const char* name, struct cmd_path* cmd_path, void* arg);
+
+const char* find_command(const char* name)
+{
+    _shell_assert(name);
+
+    if (strchr(name, '/'))
+        return name;
+
+    if (update_path_dirs() == FAIL)
+        return NULL;
+
+    struct cmd_path* cmd_path = NULL;
+    if (fm_cmd_path_find(cache, name, &cmd_path)) {
+        if (path_dirs_unchanged(cmd_path->dir + 1)) {
+            cmd_path->hits++;
+            return cmd_path->path;
+        }
+        // Program may be removed or shadowed by another one, so nothing in
+        // the cache can be trusted
+        reset_command_cache();
+    }
+
+    long dir = search_path_dirs(name);
+    if (dir == FAIL)
+        return NULL;
+
+    // Relative directories depend on the current directory
+    if (vec_at(path_dirs, dir).name[0] != '/')
+        return found_path;
+
+    // It's OK to not cache the path if there is no memory
+    char* key = strdup(name);
+    cmd_path = (struct cmd_path*)malloc(sizeof(struct cmd_path));
+    if (!key || !cmd_path || !(cmd_path->path = strdup(found_path))) {
+        free(key);
+        free(cmd_path);
+        return found_path;
+    }
+    cmd_path->dir = dir;
+    cmd_path->hits = 1;
+    if (!fm_cmd_path_insert(cache, key, cmd_path)) {
+        free(key);
+        free_cmd_path(cmd_path);
+        return found_path;
+    }
+
+    return cmd_path->path;
+}
+
+void reset_command_cache()
+{
+    if (!cache)
+        return;
+
+    fm_cmd_path_clear(cache);
+    for (vec_size_t i = 0; i < vec_size(path_dirs); ++i) {
+        stat_path_dir(vec_at_ptr(path_dirs, i));
+    }
+}
+
+void print_command_cache()
+{
+    if (!cache || !fm_cmd_path_size(cache)) {
+        _shell_flush_fputs("hash: hash table empty\n");
+        return;
+    }
+    fprintf(shell_outstream, "hits\tcommand\n");
+    fm_cmd_path_foreach(cache, print_cmd_path, NULL);
+    fflush(shell_outstream);
+}
+
+void release_command_cache()
+{
+    fm_cmd_path_delete(cache);
+    vec_path_dir_delete(path_dirs);
+    free(cached_path_env);
+    free(path_dirs_buff);
+    cache = NULL;
+    path_dirs = NULL;
+    cached_path_env = NULL;
+    path_dirs_buff = NULL;
+}
+
+static void free_cmd_path(struct cmd_path* self)
+{
+    if (self)
+        free(self->path);
+    free(self);
+}
+
+static void free_name(const char* name)
+{
+    free((char*)name);
+}
+
+static int update_path_dirs()
+{
+    const char* path_env = getenv("PATH");
+    if (!path_env)
+        path_env = DEFAULT_PATH;
+
+    if (cached_path_env && strcmp(cached_path_env, path_env) == 0)
+        return SUCCESS;
+
+    if (!cache && !(cache = fm_cmd_path_new()))
+        return FAIL;
+    if (!path_dirs && !(path_dirs = vec_path_dir_new()))
+        return FAIL;
+
+    fm_cmd_path_clear(cache);
+    vec_path_dir_clear(path_dirs);
+    free(cached_path_env);
+    free(path_dirs_buff);
+    cached_path_env = strdup(path_env);
+    path_dirs_buff = strdup(path_env);
+    if (!cached_path_env || !path_dirs_buff)
+        goto ERROR_HANDLER;
+
+    // Empty directory is the current one
+    for (char* dir = path_dirs_buff; dir; ) {
+        char* next = strchr(dir, ':');
+        if (next)
+            *next++ = '\0';
+        struct path_dir path_dir = {.name = *dir ? dir : CURRENT_DIR};
+        stat_path_dir(&path_dir);
+        if (vec_path_dir_push_back(path_dirs, path_dir) == FAIL)
+            goto ERROR_HANDLER;
+        dir = next;
+    }
+    return SUCCESS;
+
+ERROR_HANDLER:
+    // PATH will be parsed again next time
+    free(cached_path_env);
+    free(path_dirs_buff);
+    cached_path_env = NULL;
+    path_dirs_buff = NULL;
+    vec_path_dir_clear(path_dirs);
+    return FAIL;
+}
+
+static void stat_path_dir(struct path_dir* dir)
+{
+    _shell_assert(dir);
+
+    struct stat st;
+    if (stat(dir->name, &st) == FAIL) {
+        dir->mtime = (struct timespec){0};
+        return;
+    }
+    dir->mtime = st.st_mtim;
+}
+
+static bool path_dirs_unchanged(size_t count)
+{
+    _shell_assert(count <= vec_size(path_dirs));
+
+    for (size_t i = 0; i < count; ++i) {
+        struct path_dir dir = vec_at(path_dirs, i);
+        stat_path_dir(&dir);
+        if (dir.mtime.tv_sec != vec_at(path_dirs, i).mtime.tv_sec
+            || dir.mtime.tv_nsec != vec_at(path_dirs, i).mtime.tv_nsec) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static long search_path_dirs(const char* name)
+{
+    _shell_assert(name);
+
+    for (vec_size_t i = 0; i < vec_size(path_dirs); ++i) {
+        int len = snprintf(found_path, PATH_MAX, "%s/%s", vec_at(path_dirs, i).name, name);
+        if (len < 0 || len >= PATH_MAX)
+            continue;
+
+        struct stat st;
+        if (stat(found_path, &st) != FAIL && S_ISREG(st.st_mode)
+            && access(found_path, X_OK) != FAIL) {
+            return i;
+        }
+    }
+    return FAIL;
+}
+
+static void print_cmd_path(const char* name, struct cmd_path* cmd_path, void* arg)
+{
+    (void) name;
+    (void) arg;
+    fprintf(shell_outstream, "%4zu\t%s\n", cmd_path->hits, cmd_path->path);
+}
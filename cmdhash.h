@@ -0,0 +1,19 @@
+#ifndef OS_LABS_RSHELL_CMDHASH_H_
+#define OS_LABS_RSHELL_CMDHASH_H_
+
+// Returns path of the program found in PATH or NULL if there is no such.
+// Names with '/' are returned as they are.
+// Found paths are cached until PATH or mtime of any directory before the found
+// one changes. The returned string is valid until the next call.
+const char* find_command(const char* name);
+
+// Forgets all cached paths
+void reset_command_cache();
+
+// Prints all cached paths with number of hits
+void print_command_cache();
+
+// Releases all resources of the cache
+void release_command_cache();
+
+#endif // OS_LABS_RSHELL_CMDHASH_H_
@@ -8,7 +8,7 @@
 #include "util/config.h"
 #include "util/vec_string.h"
 
-void reset_cmd(struct command* cmd)
+void reset_cmd(struct command* cmd, struct arena* arena)
 {
     if (!cmd)
         return;
@@ -20,15 +20,18 @@ void reset_cmd(struct command* cmd)
     cmd->flags.pipe_in = false;
     cmd->flags.skip_next_on_success = false;
     cmd->flags.skip_next_on_fail = false;
+    cmd->flags.timed = false;
+    cmd->cpus = NULL;
+    cmd->pipe_size = 0;
+    cmd->full_samples = 0;
+    // The vector belongs to the pushed copy
+    cmd->fanout = NULL;
 
     if (cmd->args)
-        vec_string_resize(cmd->args, 0);
+        vec_string_clear(cmd->args);
     else
-        cmd->args = vec_string_new();
-    if (cmd->redirections)
-        fm_redirection_clear(cmd->redirections);
-    else
-        cmd->redirections = fm_redirection_new();
+        cmd->args = vec_string_new_in(arena);
+    fm_redirection_clear(&cmd->redirections);
 }
 
 void release_cmd(struct command* cmd)
@@ -36,7 +39,8 @@ void release_cmd(struct command* cmd)
     if (!cmd)
         return;
     vec_string_delete(cmd->args);
-    fm_redirection_delete(cmd->redirections);
+    vec_redirection_delete(cmd->fanout);
+    fm_redirection_release(&cmd->redirections);
 }
 
 int push_cmd(struct command* cmd, struct vec_command_t* commands)
@@ -46,7 +50,7 @@ int push_cmd(struct command* cmd, struct vec_command_t* commands)
 
     struct command cmd_copy = *cmd;
     cmd->args = NULL;
-    cmd->redirections = NULL;
+    fm_redirection_init(&cmd->redirections);
     vec_string_push_back(cmd_copy.args, NULL);
 
     return vec_command_push_back(commands, cmd_copy);
@@ -2,17 +2,50 @@
 #define OS_LABS_RSHELL_COMMAND_H_
 
 #include <stdbool.h>
+#include <sys/resource.h>
 #include <sys/types.h>
+#include <time.h>
+
+#include "redirection.h"
 
 struct vec_string_t;
-struct fm_redirection_t;
+struct cpu_list;
+
+#define VEC_UNDEF
+
+// Extra targets of descriptors that are redirected several times
+#define vec_name    redirection
+#define vec_elem_t  struct redirection
+#include "util/vector.h"
+
+#undef VEC_UNDEF
+
+// Resources used by a timed command. They are known after it's finished.
+struct command_usage {
+    // Monotonic time before the command was started and after it was reaped
+    struct timespec start;
+    struct timespec end;
+    struct rusage rusage;
+};
 
 struct command {
     // This vector does not hold any resources
     struct vec_string_t* args;
-    struct fm_redirection_t* redirections;
+    // Few redirections are inside the command
+    struct fm_redirection_t redirections;
+    // Outputs after the first one of descriptors redirected several times or
+    // NULL. It holds no resources.
+    struct vec_redirection_t* fanout;
     pid_t pid;
     int status;
+    // Filled only if the command is timed
+    struct command_usage usage;
+    // CPUs the command is bound to or NULL
+    const struct cpu_list* cpus;
+    // Capacity of the pipe to the next command, 0 is the shell's one
+    size_t pipe_size;
+    // Number of samples in a row the pipe to the next command was full
+    unsigned full_samples;
 
     // Flags to customize the execution.
     struct
@@ -22,6 +55,8 @@ struct command {
         bool pipe_in                : 1;
         bool skip_next_on_success   : 1;
         bool skip_next_on_fail      : 1;
+        // The pipeline was prefixed with time keyword
+        bool timed                  : 1;
     } flags;
 };
 
@@ -33,8 +68,10 @@ struct command {
 
 #undef VEC_UNDEF
 
-// Resets cmd to default values.
-void reset_cmd(struct command* cmd);
+struct arena;
+
+// Resets cmd to default values. Missing args are allocated in the arena.
+void reset_cmd(struct command* cmd, struct arena* arena);
 
 // Releases all resources cmd had
 void release_cmd(struct command* cmd);
@@ -0,0 +1,177 @@
+#include "events.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/signalfd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "jobs.h"
+#include "util/config.h"
+#include "util/trace.h"
+
+#define FAIL        -1
+#define SUCCESS     0
+#define INVALID_FD  -1
+#define MAX_EVENTS  2
+
+#ifndef WAIT_ANY
+#   define WAIT_ANY -1
+#endif
+
+// Signal mask of the shell before SIGCHLD was blocked
+static sigset_t child_sigmask;
+// Reads SIGCHLD
+static int child_fd = INVALID_FD;
+// Watches only child_fd
+static int child_epoll = INVALID_FD;
+// Watches child_fd and input_fd. Separate instance is used so input that was
+// typed ahead does not wake the shell while it waits for a job.
+static int input_epoll = INVALID_FD;
+static int input_fd = INVALID_FD;
+
+// Moves fd to the shell's descriptors. Returns new fd or -1.
+static int move_event_fd(int fd);
+
+// Creates epoll instance that watches child_fd and fd if it's not -1.
+static int create_epoll(int fd);
+
+// Reads pending SIGCHLD from child_fd
+static void drain_child_fd();
+
+int init_events(int fd)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    // Signals are read from child_fd, so the handler is never called
+    if (sigprocmask(SIG_BLOCK, &set, &child_sigmask) == FAIL) {
+        _shell_pperror("sigprocmask");
+        return FAIL;
+    }
+    sigdelset(&child_sigmask, SIGCHLD);
+
+    if ((child_fd = move_event_fd(signalfd(INVALID_FD, &set, SFD_NONBLOCK | SFD_CLOEXEC))) == FAIL) {
+        _shell_pperror("signalfd");
+        goto ERROR_HANDLER;
+    }
+    if ((child_epoll = create_epoll(INVALID_FD)) == FAIL) {
+        _shell_pperror("epoll");
+        goto ERROR_HANDLER;
+    }
+    // If input can't be watched, it's just read without waiting
+    if (fd != INVALID_FD && (input_epoll = create_epoll(fd)) != FAIL)
+        input_fd = fd;
+    return SUCCESS;
+
+ERROR_HANDLER:
+    release_events();
+    return FAIL;
+}
+
+void release_events()
+{
+    if (input_epoll != INVALID_FD)
+        close(input_epoll);
+    if (child_epoll != INVALID_FD)
+        close(child_epoll);
+    if (child_fd != INVALID_FD)
+        close(child_fd);
+    input_epoll = INVALID_FD;
+    child_epoll = INVALID_FD;
+    child_fd = INVALID_FD;
+    input_fd = INVALID_FD;
+}
+
+void get_child_sigmask(sigset_t* set)
+{
+    _shell_assert(set);
+    *set = child_sigmask;
+}
+
+int wait_events(bool input, int timeout)
+{
+    if (input && input_epoll == INVALID_FD)
+        return EVENT_INPUT;
+
+    int epoll = input ? input_epoll : child_epoll;
+    _shell_assert(epoll != INVALID_FD);
+
+    struct epoll_event events[MAX_EVENTS];
+    int count = epoll_wait(epoll, events, MAX_EVENTS, timeout);
+    if (count == FAIL)
+        return FAIL;
+    if (!count)
+        return EVENT_TIMEOUT;
+
+    // Children are processed first so their jobs are up to date for input
+    bool input_ready = false;
+    bool child_ready = false;
+    for (int i = 0; i < count; ++i) {
+        if (events[i].data.fd == child_fd)
+            child_ready = true;
+        else if (events[i].data.fd == input_fd)
+            input_ready = true;
+    }
+    if (child_ready) {
+        drain_child_fd();
+        reap_children();
+    }
+    return input_ready ? EVENT_INPUT : EVENT_CHILD;
+}
+
+void reap_children()
+{
+    int status = 0;
+    pid_t pid = 0;
+    // Resources of a finished child are reported only once, by this call
+    struct rusage rusage;
+    while ((pid = wait4(WAIT_ANY, &status, WNOHANG | WUNTRACED | WCONTINUED, &rusage)) != FAIL
+           && pid != 0) {
+        trace_instant("reap", "pid", pid);
+        set_job_pid_status(pid, status, &rusage);
+    }
+}
+
+static int move_event_fd(int fd)
+{
+    if (fd == FAIL)
+        return FAIL;
+    int newfd = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_MIN);
+    close(fd);
+    return newfd;
+}
+
+static int create_epoll(int fd)
+{
+    int epoll = move_event_fd(epoll_create1(EPOLL_CLOEXEC));
+    if (epoll == FAIL)
+        return FAIL;
+
+    struct epoll_event event = {.events = EPOLLIN, .data.fd = child_fd};
+    if (epoll_ctl(epoll, EPOLL_CTL_ADD, child_fd, &event) == FAIL)
+        goto ERROR_HANDLER;
+    event.data.fd = fd;
+    if (fd != INVALID_FD && epoll_ctl(epoll, EPOLL_CTL_ADD, fd, &event) == FAIL)
+        goto ERROR_HANDLER;
+    return epoll;
+
+ERROR_HANDLER:
+    close(epoll);
+    return FAIL;
+}
+
+static void drain_child_fd()
+{
+    // Standard signals are not queued, so there is at most one
+    struct signalfd_siginfo info;
+    if (read(child_fd, &info, sizeof(info)) == FAIL) {
+        if (errno != EAGAIN)
+            _shell_pperror("signalfd");
+        return;
+    }
+    trace_instant("SIGCHLD", "pid", info.ssi_pid);
+}
@@ -0,0 +1,41 @@
+#ifndef OS_LABS_RSHELL_EVENTS_H_
+#define OS_LABS_RSHELL_EVENTS_H_
+
+#include <signal.h>
+#include <stdbool.h>
+
+// Timeout of wait_events() that never expires
+#define EVENTS_NO_TIMEOUT   -1
+
+// Events returned by wait_events()
+enum EVENT {
+    EVENT_INPUT,    // input descriptor is readable
+    EVENT_CHILD,    // children changed their state and jobs were updated
+    EVENT_TIMEOUT,  // timeout expired
+};
+
+// Blocks SIGCHLD and creates the event loop: epoll(7) with signalfd(2) for
+// SIGCHLD and input_fd if it's not -1 and may be watched. From now on 
+// children are reaped only by wait_events() and reap_children().
+int init_events(int input_fd);
+
+// Closes descriptors of the event loop
+void release_events();
+
+// Fills set with the signal mask the shell had before init_events(). It's
+// the mask for children.
+void get_child_sigmask(sigset_t* set);
+
+// Waits until children change their state, input becomes readable (only if
+// input is true) or timeout in milliseconds expires. If input is not watched,
+// returns EVENT_INPUT at once. Changes of children are applied to jobs before
+// return.
+// Returns one of EVENT or -1 on error. errno is EINTR if it was interrupted
+// by a signal.
+int wait_events(bool input, int timeout);
+
+// Reaps all children whose state has changed and updates their jobs.
+// Does not block.
+void reap_children();
+
+#endif // OS_LABS_RSHELL_EVENTS_H_
@@ -1,30 +1,60 @@
 #include "execute_cmd.h"
 
 #include <errno.h>
-#include <poll.h>
+#include <fcntl.h>
+#include <spawn.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/resource.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "affinity.h"
+#include "builtins.h"
+#include "cmdhash.h"
 #include "command.h"
+#include "events.h"
+#include "fanout.h"
+#include "history.h"
 #include "jobs.h"
+#include "parallel.h"
+#include "pipes.h"
+#include "prompt.h"
+#include "qos.h"
 #include "redirection.h"
 #include "sig.h"
 #include "util/config.h"
+#include "util/line.h"
 #include "util/pperror.h"
+#include "util/trace.h"
 #include "util/vec_string.h"
 
 #define FAIL            -1
 #define SUCCESS         0
 #define NUMBASE         10
-#define INFINITE_POLL   -1
 #define INVALID_FD      -1
+#define SIGNAL_STATUS   128
+// Returned by internal command if the shell must exit
+#define SHELL_CMD_EXIT  1
+// Exit status of a program that was not found
+#define NOT_FOUND_STATUS    127
+// Queued jobs are checked this often if the load or memory is limited
+#define QUEUE_POLL_MS       1000
+#define MEMINFO_FILE        "/proc/meminfo"
+#define MEMINFO_AVAILABLE   "MemAvailable:"
+#define MEMINFO_SIZE        4096
+// Executable files without #! are run by it like execvp(3) does
+#define SCRIPT_SHELL        "/bin/sh"
+
+extern char** environ;
 
 enum SKIP_STRATEGY {
     SKIP_NOSKIP,
@@ -39,14 +69,18 @@ static int pipe_out[2] = {INVALID_FD, INVALID_FD};
 // Flag that is needed for exit after warning if it isn't quite right to just quit.
 // For example, if there are still stopped jobs.
 static bool warning_given;
-// Saved blocking masks that are used to block SIGCHLD in critical sections
-static sigset_t nvar, ovar;
 // Describes strategy to skip next
 static int skip_stategy = SKIP_NOSKIP;
 // Either FAIL or SUCCESS
 static int last_result = SUCCESS;
-// Marks that terminal should not be passed. Used in the fg function.
-static bool do_not_pass_terminal;
+// Exit status of the last job waited in the foreground
+static int last_status = EXIT_SUCCESS;
+// Commands of the current background pipeline are queued
+static bool queuing;
+// Job the shell waits for, it's not counted as a background one
+static const struct job* foreground_job;
+// CPUs of the current pipeline in the automatic mode
+static const struct cpu_list* pipeline_cpus;
 
 // Bit mask of command modes
 enum MODE {
@@ -69,12 +103,48 @@ enum SHELL_CMD {
     SHELL_FG,
     SHELL_CD,
     SHELL_EXIT,
+    SHELL_HASH,
+    SHELL_HISTORY,
+    SHELL_PARALLEL,
+    // Fast builtins that replace programs
+    SHELL_ECHO,
+    SHELL_PRINTF,
+    SHELL_TEST,
+    SHELL_TRUE,
+    SHELL_FALSE,
+    SHELL_PWD,
+    SHELL_SLEEP,
 };
 
+// Descriptor that was replaced by a redirection of an internal command executed
+// in the shell
+struct saved_fd {
+    int fd;
+    // Copy of the replaced descriptor or -1 if fd was not opened
+    int copy;
+};
+
+#define VEC_SOURCE
+#define vec_name        saved_fd
+#define vec_elem_t      struct saved_fd
+// Internal commands usually redirect only standard descriptors
+#define vec_inline_size 3
+#include "util/vector.h"
+#undef VEC_SOURCE
+
 struct redirection_result {
     int result;
     bool stdin_redirected;
     bool stdout_redirected;
+    // File actions for posix_spawn(3), NULL if redirections are made in the
+    // current process
+    posix_spawn_file_actions_t* actions;
+};
+
+struct open_result {
+    int result;
+    // Redirections of the command whose files are opened
+    struct fm_redirection_t* redirections;
 };
 
 // Gets pointer to the current job from jobs. Returns NULL on error.
@@ -89,18 +159,106 @@ static void redirect_fm_func(int fd, struct redirection* redirection, void* arg)
 
 // Redirects all files specified in cmd.
 // Redirects all pipes if needed. Closes pipes after redirection.
-static int make_redirections(const struct command* cmd);
+static int make_redirections(struct command* cmd);
 
 // Closes all fd except STDIN_FILENO, STDOUT_FILENO and STDERR_FILENO
 static void close_redirection_fm_func(int fd, struct redirection*, void*);
 
 // Close all redirections specified in cmd except STDIN_FILENO, STDOUT_FILENO 
 // and STDERR_FILENO
-static void close_redirections(const struct command* cmd);
+static void close_redirections(struct command* cmd);
+
+// Opens the file of the redirection. Prints errors.
+// Arg must be struct open_result*.
+// This is special function for foreach(). 
+static void open_redirection_fm_func(int fd, struct redirection* redirection, void* arg);
+
+// Opens files of all redirections specified in cmd, so the child only 
+// duplicates descriptors. Files are not touched if the command is skipped.
+static int open_redirections(struct command* cmd);
+
+// Closes files opened by open_redirections(). This is special function for
+// foreach().
+static void close_opened_fm_func(int fd, struct redirection* redirection, void* arg);
+
+// Same as make_redirections(), but adds redirections to the file actions of
+// posix_spawn(3).
+static int make_spawn_redirections(struct command* cmd, 
+                                   posix_spawn_file_actions_t* actions);
+
+// Starts program with the path with posix_spawn(3) in the job's process group.
+// Returns pid of the child or -1 if the program was not started. Does not print
+// any errors.
+static pid_t spawn_cmd(struct command* cmd, const struct job* job, const char* path);
+
+// Returns arguments to run the file with the path by SCRIPT_SHELL:
+// SCRIPT_SHELL, path and args after the name. They must be freed.
+// Returns NULL on error.
+static char** make_script_args(const char* path, char* const* args);
+
+// Executes the program with the path. Files without #! that exec(3) rejects
+// with ENOEXEC are executed by SCRIPT_SHELL. Returns only on error.
+static void exec_program(const char* path, char* const* args);
+
+// Returns mode of the command, a combination of MODE
+static int get_cmd_mode(const struct command* cmd);
+
+// Starts cmd of the job: creates the pipe for the next command, opens files and
+// launches the program. The last command of a foreground job is waited.
+// Returns FAIL if the shell can't go on, the command may fail to start anyway.
+static int start_cmd(struct command* cmd, struct job* job, int shell_cmd, 
+                     const char* path);
+
+// Moves output pipe to input pipe and closes the previous input pipe
+static void rotate_pipes();
+
+// Closes both pipes
+static void close_pipes();
+
+// Moves cmd to the job without starting it. The queued job is reported when
+// its last command is added.
+static int queue_cmd(struct command* cmd, struct job* job);
+
+// Starts all commands of the queued job regardless of the limits. Statuses
+// and skip strategy of the shell are not changed. The job is released if 
+// nothing was started.
+static int start_queued_job(struct job* job);
+
+// Returns true iff there are queued jobs
+static bool has_queued_jobs();
+
+// Returns true iff one more background job fits the limits
+static bool may_start_background_job();
+
+// Returns MemAvailable from /proc/meminfo in kB or SIZE_MAX if it's unknown
+static size_t get_available_memory();
 
 // Internal execution function. 
 // Forks, executes and sets current_job fields.
-static int execute_cmd_internal(struct command* cmd, struct job* job);
+// path is the path of the program found with find_command(). If it's NULL,
+// the program is searched by the child.
+static int execute_cmd_internal(struct command* cmd, struct job* job, int shell_cmd,
+                                const char* path);
+
+// Updates skip strategy according to the flags of the last command of a job
+static void update_skip_strategy(const struct command* cmd);
+
+// Saves fd and makes redirection. Arg must be struct vec_saved_fd_t*, it's set
+// to NULL on error.
+// This is special function for foreach(). 
+static void save_and_redirect_fm_func(int fd, struct redirection* redirection, void* arg);
+
+// Restores all fds saved by save_and_redirect_fm_func() in the reverse order.
+static void restore_saved_fds(struct vec_saved_fd_t* saved);
+
+// Executes internal command in the shell process. Its redirections are made 
+// only for the time of execution.
+// Returns status of the command or SHELL_CMD_EXIT.
+static int execute_shell_cmd_in_shell(int internal_command, struct command* cmd);
+
+// Same as execute_shell_cmd_in_shell(), but prints resources the shell used 
+// while the command was executed
+static int time_shell_cmd_in_shell(int internal_command, struct command* cmd);
 
 // Moves cmd to job. Does modify jobs.
 // Marking job as valid is not perfomed in the move_cmd_to_job() function so 
@@ -115,23 +273,33 @@ static void update_job_validity(struct job* job);
 // Executes shell cmd.
 // exit, bg, fg, jobs are supported
 // May modify jobs.
-static int execute_shell_cmd(int internal_command, const struct command* cmd, struct job* job);
+// Returns SUCCESS or FAIL as status of the command or SHELL_CMD_EXIT.
+static int execute_shell_cmd(int internal_command, const struct command* cmd);
 
 // Prints current jobs
-static void execute_shell_jobs();
+static int execute_shell_jobs();
 
 // Runs stopped job(s) in the background
-static void execute_shell_bg(const struct command* cmd);
+static int execute_shell_bg(const struct command* cmd);
 
 // Moves job to the foreground
-static void execute_shell_fg(const struct command* cmd, struct job* fg_job);
+static int execute_shell_fg(const struct command* cmd);
 
 // Changes current working directory
-static void execute_shell_cd(const struct command* cmd);
+static int execute_shell_cd(const struct command* cmd);
 
 // Tries to exit shell
 static int execute_shell_exit();
 
+// Prints, fills or resets cache of program paths
+static int execute_shell_hash(const struct command* cmd);
+
+// Prints the whole history, its last entries or entries that are searched
+static int execute_shell_history(const struct command* cmd);
+
+// Runs a program for every line of the input with a bounded number of jobs
+static int execute_shell_parallel(const struct command* cmd);
+
 // Returns true iff there are stopped jobs
 static bool has_stopped_jobs();
 
@@ -139,11 +307,15 @@ static bool has_stopped_jobs();
 static void kill_stopped_jobs();
 
 // Starts job in the background. Supportive function for the execute_shell_bg()
-static void start_job_in_background(vec_size_t job, const char* jobnostr);
+static int start_job_in_background(vec_size_t job, const char* jobnostr);
 
 // Checks if the command is provided by shell.
 static int is_shell_cmd(const char* cmd);
 
+// Returns true iff the internal command is a fast builtin that replaces a
+// program
+static bool is_fast_builtin(int internal_command);
+
 // Gives terminal to processes with group pgrp.
 static int give_terminal_to(pid_t pgrp, const struct termios* nattr, struct termios* oattr);
 
@@ -156,34 +328,68 @@ static int pass_foreground(struct job* job);
 // Prints job number and pid
 static void print_background_info(const struct job* job);
 
+// Waits for queued jobs and starts them. Scripts don't lose them on exit.
+static void start_all_queued_jobs();
+
 // Waits untill job is done
 static int wait_for_job(struct job* job);
 
-// Marks cmd as continued
+// Returns true iff any command of the job is running
+static bool has_running_commands(const struct job* job);
+
+// Marks cmd as continued if it was stopped
 static void mark_command_continued_vec_func(struct command* cmd);
 
 int execute_cmd(struct command* cmd)
 {
     _shell_assert(cmd);
-    BLOCK_CHILD(nvar, ovar);
 
     // Skips if the current job must be skipped.
     if ((skip_stategy == SKIP_ON_SUCCESS && last_result == SUCCESS)
             || (skip_stategy == SKIP_ON_FAIL && last_result == FAIL)) {
-        // If it's not the last command of the job, does not update skip_strategy
-        if (!cmd->flags.pipe_out) {
-            skip_stategy = cmd->flags.skip_next_on_fail ? SKIP_ON_FAIL :    
-                           cmd->flags.skip_next_on_success ? SKIP_ON_SUCCESS :
-                           SKIP_NOSKIP;
-        }
-
+        update_skip_strategy(cmd);
         goto ERROR_HANDLER;
     }
 
     int retval = SUCCESS;
-    int mode = (cmd->flags.bkgrnd ? mode_bkgrnd : 0) 
-               | (cmd->flags.pipe_out ? mode_pipe_out : 0)
-               | (cmd->flags.pipe_in ? mode_pipe_in : 0);
+    int mode = get_cmd_mode(cmd);
+
+    int shell_cmd = is_shell_cmd(vec_front(cmd->args));
+
+    // If it is not "exit" command, the flag for warning will be unset
+    if (shell_cmd != SHELL_EXIT) {
+        warning_given = false;
+    }
+
+    // Internal commands are executed by the shell itself unless they are a 
+    // part of a pipeline or a background job or their output has several
+    // targets
+    if (shell_cmd != SHELL_NOTCMD && mode == mode_simple && !has_fanout(cmd)) {
+        update_skip_strategy(cmd);
+        int status = cmd->flags.timed ? time_shell_cmd_in_shell(shell_cmd, cmd)
+                                      : execute_shell_cmd_in_shell(shell_cmd, cmd);
+        if (status == SHELL_CMD_EXIT) {
+            retval = FAIL;
+        }
+        // fg already has the status of the job it waited for
+        else if (shell_cmd != SHELL_FG || status == FAIL) {
+            last_result = status;
+            last_status = status == FAIL ? EXIT_FAILURE : EXIT_SUCCESS;
+        }
+        goto ERROR_HANDLER;
+    }
+
+    // Unknown programs fail without spawning anything unless they are a part 
+    // of a pipeline which must be constructed anyway
+    const char* path = NULL;
+    if (shell_cmd == SHELL_NOTCMD && !(path = find_command(vec_front(cmd->args)))
+        && !cmd->flags.pipe_in && !cmd->flags.pipe_out) {
+        _shell_flush_fprintf("Command '%s' not found\n", vec_front(cmd->args));
+        update_skip_strategy(cmd);
+        last_result = FAIL;
+        last_status = NOT_FOUND_STATUS;
+        goto ERROR_HANDLER;
+    }
 
     struct job* job = get_current_job();
 
@@ -192,17 +398,190 @@ int execute_cmd(struct command* cmd)
         goto ERROR_HANDLER;
     }
 
+    // Background pipeline over the limits waits in the queue with all its
+    // commands. Jobs are started in order, so nobody overtakes queued jobs.
+    if (cmd->flags.bkgrnd && !cmd->flags.pipe_in)
+        queuing = has_queued_jobs() || !may_start_background_job();
+    if (cmd->flags.bkgrnd && queuing) {
+        retval = queue_cmd(cmd, job);
+        goto ERROR_HANDLER;
+    }
+
+    retval = start_cmd(cmd, job, shell_cmd, path);
+    
+ERROR_HANDLER:
+    rotate_pipes();
+
+    return retval;
+}
+
+int end_execution(bool print_msg)
+{
+    if (print_msg) {
+        fprintf(shell_outstream, "exit\n");
+    }
+
+    reap_children();
+    bool stopped = has_stopped_jobs();
+    // Queued jobs of the interactive shell are dropped after the warning
+    bool queued = shell_interactive && has_queued_jobs();
+    bool give_warning = !warning_given && (stopped || queued);
+
+    if (give_warning) {
+        if (print_msg) {
+            fprintf(shell_outstream, stopped ? "There are stopped jobs\n" 
+                                             : "There are queued jobs\n");
+        }
+        warning_given = true;
+        return FAIL;
+    }
+
+    // It's OK to call end_execution() again
+    close_pipes();
+
+    if (!internal_executing && !shell_interactive)
+        start_all_queued_jobs();
+
+    // Doesn't kill children if it's not the parent process
+    if (!internal_executing) {
+        kill_stopped_jobs();
+    }
+
+    return SUCCESS;
+}
+
+int get_last_status()
+{
+    return last_status;
+}
+
+void start_queued_jobs()
+{
+    if (!jobs)
+        return;
+
+    // Jobs are started in the order they were queued
+    for (vec_size_t i = 0; i < vec_size(jobs); ++i) {
+        struct job* job = vec_at_ptr(jobs, i);
+        if (get_job_status(job) != JOB_QUEUED)
+            continue;
+        if (!may_start_background_job())
+            break;
+        trace_instant("start_queued", "job", i + 1);
+        start_queued_job(job);
+        // Started job is reported as running with other changed jobs
+        if (job->state == JOB_VALID)
+            job->notify_status = true;
+    }
+}
+
+int get_queue_timeout()
+{
+    // Otherwise only reaped children free places
+    if ((shell_bg_limits.load > 0 || shell_bg_limits.mem_kb) && has_queued_jobs())
+        return QUEUE_POLL_MS;
+    return EVENTS_NO_TIMEOUT;
+}
+
+size_t start_shell_pgrp_job(struct command* cmd, const char* path)
+{
+    _shell_assert(cmd);
+    _shell_assert(path);
+    _shell_assert(jobs);
+    _shell_assert(!cmd->flags.pipe_in && !cmd->flags.pipe_out);
+
+    // Free entries are reused, so many short jobs don't grow jobs
+    struct job* job = NULL;
+    for (vec_size_t i = 0; i < vec_size(jobs) && !job; ++i) {
+        if (vec_at_ptr(jobs, i)->state == JOB_INVALID)
+            job = vec_at_ptr(jobs, i);
+    }
+    if (!job && !(job = vec_job_emplace_back(jobs))) {
+        _shell_pperror("Failed to add job");
+        return 0;
+    }
+    clear_job(job);
+    job->pgid = getpgrp();
+    // The builtin may start thousands of jobs from one line, so their pipelines
+    // are freed with the jobs instead of growing the line's arena
+    if (!(job->pipeline = vec_command_new())) {
+        _shell_pperror("Failed to add job");
+        return 0;
+    }
+
+    pid_t shell_pid = getpid();
+    int retval = execute_cmd_internal(cmd, job, SHELL_NOTCMD, path);
+    // The forked child returns only if the program was not executed, the error
+    // is already printed
+    if (getpid() != shell_pid)
+        _exit(EXIT_FAILURE);
+    if (retval == FAIL) {
+        release_job(job);
+        return 0;
+    }
+    return job - vec_begin(jobs) + 1;
+}
+
+static struct job* get_current_job()
+{
+    // Checks jobs
+    if (!jobs && !(jobs = vec_job_new()))
+        return NULL;
+    // Checks if last job is not yet finished or even set
+    if (vec_size(jobs) && vec_at_ptr(jobs, vec_size(jobs) - 1)->state != JOB_VALID) {
+        return vec_at_ptr(jobs, vec_size(jobs) - 1);
+    }
+    struct job* job = vec_job_emplace_back(jobs);
+    if (!job)
+        return NULL;
+    clear_job(job);
+    return job;
+}
+
+static int get_cmd_mode(const struct command* cmd)
+{
+    _shell_assert(cmd);
+
+    return (cmd->flags.bkgrnd ? mode_bkgrnd : 0) 
+           | (cmd->flags.pipe_out ? mode_pipe_out : 0)
+           | (cmd->flags.pipe_in ? mode_pipe_in : 0);
+}
+
+static int start_cmd(struct command* cmd, struct job* job, int shell_cmd, 
+                     const char* path)
+{
+    _shell_assert(cmd);
+    _shell_assert(job);
+
+    int retval = SUCCESS;
+
+    // Stages of the pipeline share the cache unless they have their own CPUs
+    if (!cmd->flags.pipe_in)
+        pipeline_cpus = cmd->flags.pipe_out ? get_pipeline_cpus() : NULL;
+    if (!cmd->cpus)
+        cmd->cpus = pipeline_cpus;
+
     // Creates new pipe for output if needed
     if (cmd->flags.pipe_out) {
-        if (pipe(pipe_out) == FAIL) {
+        if (make_pipe(pipe_out, cmd->pipe_size) == FAIL) {
             _shell_pperror("Failed to create pipe");
             retval = FAIL;
             goto ERROR_HANDLER;
         }
     }
 
-    do_not_pass_terminal = false;
-    if (execute_cmd_internal(cmd, job) == FAIL) {
+    // Internal commands open their files in the child. If a file can't be 
+    // opened in a pipeline, the child fails. Pipes are already created, so
+    // opened files do not take their descriptors.
+    if (shell_cmd == SHELL_NOTCMD && open_redirections(cmd) == FAIL
+        && !cmd->flags.pipe_in && !cmd->flags.pipe_out) {
+        update_skip_strategy(cmd);
+        last_result = FAIL;
+        last_status = EXIT_FAILURE;
+        goto ERROR_HANDLER;
+    }
+
+    if (execute_cmd_internal(cmd, job, shell_cmd, path) == FAIL) {
         retval = FAIL;
         goto ERROR_HANDLER;
     }
@@ -210,28 +589,37 @@ int execute_cmd(struct command* cmd)
     if (internal_executing)
         goto ERROR_HANDLER;
     
-    switch (mode) {
+    switch (get_cmd_mode(cmd)) {
     case mode_pipe_in_bkgrnd:
     case mode_bkgrnd:
-        // Prints pid
-        print_background_info(job);
+        // Prints pid. Started queued jobs are reported with their status.
+        if (!job->queued)
+            print_background_info(job);
         break;
     case mode_pipe_in_out:
     case mode_pipe_out:
+    case mode_pipe_in_out_bkgrnd:
+    case mode_pipe_out_bkgrnd:
         // Starts in the background, foreground was not given
         break;
     case mode_pipe_in:
     case mode_simple:
-        if (!do_not_pass_terminal && pass_foreground(job) == FAIL)
+        if (pass_foreground(job) == FAIL)
             retval = FAIL;
         break;
     default:
         break;
     }
-    
+
 ERROR_HANDLER:
-    UNBLOCK_CHILD(ovar);
+    // Does nothing if cmd was moved to the job
+    fm_redirection_foreach(&cmd->redirections, close_opened_fm_func, NULL);
 
+    return retval;
+}
+
+static void rotate_pipes()
+{
     // Closes input pipe
     if (pipe_in[0] != INVALID_FD) {
         close(pipe_in[0]);
@@ -243,125 +631,221 @@ ERROR_HANDLER:
     // Resets output pipe
     pipe_out[0] = INVALID_FD;
     pipe_out[1] = INVALID_FD;
+}
 
-    return retval;
+static void close_pipes()
+{
+    rotate_pipes();
+    rotate_pipes();
 }
 
-int end_execution(bool print_msg)
+static int queue_cmd(struct command* cmd, struct job* job)
 {
-    sigset_t nset, oset;
+    _shell_assert(cmd);
+    _shell_assert(job);
 
-    if (print_msg) {
-        fprintf(shell_outstream, "exit\n");
-    }
+    // The command gets its pid when the job is started
+    cmd->pid = 0;
+    if (!cmd->flags.pipe_in)
+        job->queued = true;
+    if (move_cmd_to_job(cmd, job) == FAIL)
+        return FAIL;
+    update_job_validity(job);
 
-    BLOCK_CHILD(nset, oset);
-    bool give_warning = !warning_given && has_stopped_jobs();
-    UNBLOCK_CHILD(oset);
+    if (job->state == JOB_VALID && shell_interactive) {
+        fprintf(shell_outstream, "[%zu] \t%s\n", (size_t)(job - vec_begin(jobs) + 1),
+                get_job_status_msg(job));
+    }
+    return SUCCESS;
+}
 
-    if (give_warning) {
-        if (print_msg) {
-            fprintf(shell_outstream, "There are stopped jobs\n");
-        }
-        warning_given = true;
+static int start_queued_job(struct job* job)
+{
+    _shell_assert(job);
+    _shell_assert(job->queued);
+
+    // The job starts between other commands, which must not notice it
+    int saved_skip_stategy = skip_stategy;
+    int saved_result = last_result;
+    int saved_status = last_status;
+
+    // Started commands are moved to the new pipeline as usual
+    struct vec_command_t* queued = job->pipeline;
+    if (!(job->pipeline = vec_command_new_in(sp_line_get(job->line)->arena))) {
+        _shell_pperror("Failed to start queued job");
+        job->pipeline = queued;
         return FAIL;
     }
 
-    if (pipe_in[0] != INVALID_FD) {
-        close(pipe_in[0]);
-        close(pipe_in[1]);
-        // Null them so it would be OK to call end_execution() again
-        pipe_in[0] = INVALID_FD;
-        pipe_in[1] = INVALID_FD;
+    // Nobody sees the job until it's started, even the forked internal commands
+    job->state = JOB_CONSTRUCTING;
+    int retval = SUCCESS;
+    for (vec_size_t i = 0; i < vec_size(queued) && retval == SUCCESS; ++i) {
+        struct command* cmd = vec_at_ptr(queued, i);
+        int shell_cmd = is_shell_cmd(vec_front(cmd->args));
+        const char* path = NULL;
+        if (shell_cmd == SHELL_NOTCMD && !(path = find_command(vec_front(cmd->args)))
+            && vec_size(queued) == 1) {
+            _shell_flush_fprintf("Command '%s' not found\n", vec_front(cmd->args));
+            break;
+        }
+        retval = start_cmd(cmd, job, shell_cmd, path);
+        rotate_pipes();
+        // The forked internal command has nowhere to return
+        if (internal_executing) {
+            fflush(stdout);
+            fflush(shell_outstream);
+            _exit(retval == FAIL ? EXIT_FAILURE : EXIT_SUCCESS);
+        }
     }
-    if (pipe_out[0] != INVALID_FD) {
-        close(pipe_out[0]);
-        close(pipe_out[1]);
-        // Null them so it would be OK to call end_execution() again
-        pipe_out[0] = INVALID_FD;
-        pipe_out[1] = INVALID_FD;
+    // The rest of the broken pipeline is not started
+    close_pipes();
+    vec_command_foreach(queued, release_cmd);
+    vec_command_delete(queued);
+
+    skip_stategy = saved_skip_stategy;
+    last_result = saved_result;
+    last_status = saved_status;
+
+    job->queued = false;
+    if (vec_empty(job->pipeline))
+        release_job(job);
+    else
+        job->state = JOB_VALID;
+    return retval;
+}
+
+static bool has_queued_jobs()
+{
+    if (!jobs)
+        return false;
+
+    for (vec_size_t i = 0; i < vec_size(jobs); ++i) {
+        if (get_job_status(vec_at_ptr(jobs, i)) == JOB_QUEUED)
+            return true;
     }
+    return false;
+}
 
-    // Doesn't kill children if it's not the parent process
-    BLOCK_CHILD(nset, oset);
-    if (!internal_executing) {
-        kill_stopped_jobs();
+static bool may_start_background_job()
+{
+    const struct bg_limits* limits = &shell_bg_limits;
+
+    if (limits->jobs) {
+        size_t running = 0;
+        for (vec_size_t i = 0; i < vec_size(jobs); ++i) {
+            const struct job* job = vec_at_ptr(jobs, i);
+            if (job != foreground_job && get_job_status(job) == JOB_RUNNING)
+                ++running;
+        }
+        if (running >= limits->jobs)
+            return false;
     }
-    UNBLOCK_CHILD(oset);
 
-    return SUCCESS;
+    double load;
+    if (limits->load > 0 && getloadavg(&load, 1) == 1 && load > limits->load)
+        return false;
+
+    return !limits->mem_kb || get_available_memory() >= limits->mem_kb;
 }
 
-static struct job* get_current_job()
+static size_t get_available_memory()
 {
-    // Checks jobs
-    if (!jobs && !(jobs = vec_job_new()))
-        return NULL;
-    // Checks if last job is not yet finished or even set
-    if (vec_size(jobs) && vec_at_ptr(jobs, vec_size(jobs) - 1)->state != JOB_VALID) {
-        return vec_at_ptr(jobs, vec_size(jobs) - 1);
-    }
-    // Resizes jobs
-    if (vec_job_resize(jobs, vec_size(jobs) + 1) == FAIL) 
-        return NULL;
-    struct job* job = vec_end(jobs) - 1;
-    clear_job(job);
-    return job;
+    int fd = open(MEMINFO_FILE, O_RDONLY | O_CLOEXEC);
+    if (fd == FAIL)
+        return SIZE_MAX;
+
+    char buf[MEMINFO_SIZE];
+    ssize_t count = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (count <= 0)
+        return SIZE_MAX;
+    buf[count] = '\0';
+
+    char* field = strstr(buf, MEMINFO_AVAILABLE);
+    if (!field)
+        return SIZE_MAX;
+    return strtoull(field + sizeof(MEMINFO_AVAILABLE) - 1, NULL, NUMBASE);
 }
 
-static int execute_cmd_internal(struct command* cmd, struct job* job) 
+static int execute_cmd_internal(struct command* cmd, struct job* job, int shell_cmd,
+                                const char* path) 
 {
     _shell_assert(cmd);
     
-    int shell_cmd = is_shell_cmd(vec_front(cmd->args));
-
-    // If it is not "exit" command, the flag for warning will be unset
-    if (shell_cmd != SHELL_EXIT) {
-        warning_given = false;
+    // The end is taken when the command is reaped
+    if (cmd->flags.timed)
+        clock_gettime(CLOCK_MONOTONIC, &cmd->usage.start);
+
+    // Internal commands need the shell's memory, so only programs are spawned.
+    // If spawning fails, the forked child will report the error. Priorities of
+    // background jobs are set by the forked child before exec(3), so are 
+    // relays of outputs with several targets started.
+    cmd->pid = FAIL;
+    if (path && shell_launch_engine == LAUNCH_SPAWN 
+        && !(cmd->flags.bkgrnd && has_bg_qos()) && !has_fanout(cmd)) {
+        // posix_spawn(3) returns after the program is executed
+        uint64_t start = trace_begin();
+        cmd->pid = spawn_cmd(cmd, job, path);
+        trace_complete("posix_spawn", start, "pid", cmd->pid);
     }
-    
-    cmd->pid = fork();
 
     if (cmd->pid == FAIL) {
-        _shell_pperror("fork");
-        return FAIL;
-    }
-
-    if (setpgid(cmd->pid, job->pgid) == FAIL)
-        _shell_pperrorf("setpgid(%d, %d) from %d", cmd->pid, job->pgid, getpid());
+        uint64_t start = trace_begin();
+        cmd->pid = fork();
 
-    // Child
-    if (cmd->pid == 0) {
-        UNBLOCK_CHILD(ovar);
-        internal_executing = true;
-        set_child_signals();
-        if (make_redirections(cmd) == FAIL) {
+        if (cmd->pid == FAIL) {
+            _shell_pperror("fork");
             return FAIL;
         }
-        // Execute internal shell cmd
-        if (shell_cmd != SHELL_NOTCMD) {
-            return execute_shell_cmd(shell_cmd, cmd, job);
-        }
-        // Execute something else as program
-        if (execvp(vec_front(cmd->args), vec_data(cmd->args)) == FAIL) {
+        if (cmd->pid)
+            trace_complete("fork", start, "pid", cmd->pid);
+
+        // Without job control every job stays in the shell's process group
+        start = trace_begin();
+        if (shell_interactive && setpgid(cmd->pid, job->pgid) == FAIL)
+            _shell_pperrorf("setpgid(%d, %d) from %d", cmd->pid, job->pgid, getpid());
+        if (shell_interactive)
+            trace_complete("setpgid", start, "pgid", job->pgid);
+
+        // Child
+        if (cmd->pid == 0) {
+            sigset_t mask;
+            get_child_sigmask(&mask);
+            sigprocmask(SIG_SETMASK, &mask, NULL);
+            internal_executing = true;
+            set_child_signals();
+            if (make_redirections(cmd) == FAIL) {
+                return FAIL;
+            }
+            // The command runs anyway, just where the scheduler puts it
+            if (cmd->cpus && set_cpu_affinity(cmd->cpus) == FAIL)
+                _shell_pperror("sched_setaffinity");
+            // The same, errors are already printed
+            if (cmd->flags.bkgrnd && has_bg_qos())
+                apply_bg_qos();
+            // Execute internal shell cmd
+            if (shell_cmd != SHELL_NOTCMD) {
+                return execute_shell_cmd(shell_cmd, cmd) == FAIL ? FAIL : SUCCESS;
+            }
+            // Execute something else as program, exec(3) returns only on error
+            trace_instant("exec", NULL, 0);
+            if (path)
+                exec_program(path, vec_data(cmd->args));
+            else
+                execvp(vec_front(cmd->args), vec_data(cmd->args));
             _shell_flush_fprintf("Command '%s' not found\n", vec_at(cmd->args, 0));
             close_redirections(cmd);
             return FAIL;
         }
-        _shell_unreachable();
     }
     
     // Parent
     int retval = SUCCESS;
+    fm_redirection_foreach(&cmd->redirections, close_opened_fm_func, NULL);
     if ((retval = move_cmd_to_job(cmd, job)) == FAIL) 
         goto RELEASE_RESOURCES;
 
-    cmd = vec_end(job->pipeline) - 1;
-    
-    if (shell_cmd != SHELL_NOTCMD && execute_shell_cmd(shell_cmd, cmd, job) == FAIL) {
-        retval = FAIL;
-    }
-
     update_job_validity(job);
 
 RELEASE_RESOURCES:
@@ -380,34 +864,56 @@ static int move_cmd_to_job(struct command* cmd, struct job* job)
     _shell_assert(cmd);
     _shell_assert(job);
 
-    // First cmd in pipeline
+    // First cmd in pipeline. Jobs started in the shell's process group keep it.
     if (!cmd->flags.pipe_in) {
-        job->pgid = cmd->pid;
-        if (!(job->pipeline = vec_command_new()))
-            return FAIL;
-        job->line = sp_string_add_link(parsing_line);
-    }
-    // Updates skip strategy
-    if (!cmd->flags.pipe_out) {
-        skip_stategy = cmd->flags.skip_next_on_fail ? SKIP_ON_FAIL :    
-                       cmd->flags.skip_next_on_success ? SKIP_ON_SUCCESS :
-                       SKIP_NOSKIP;
+        if (!job->pgid)
+            job->pgid = cmd->pid;
+        // The pipeline lives as long as the line its commands came from.
+        // Queued jobs already have both, jobs in the shell's process group
+        // have their own pipeline.
+        if (!job->line) {
+            struct arena* arena = sp_line_get(parsing_line)->arena;
+            if (!job->pipeline && !(job->pipeline = vec_command_new_in(arena)))
+                return FAIL;
+            job->line = sp_line_add_link(parsing_line);
+        }
     }
+    update_skip_strategy(cmd);
     job->pid = cmd->pid;
     job->state = JOB_CONSTRUCTING;
 
     cmd->status = CLD_CONTINUED;
 
-    if (vec_command_push_back_by_ptr(job->pipeline, cmd) == FAIL)
+    // The SIGCHLD handler finds the command by its pid. Queued commands have
+    // no pid yet.
+    vec_size_t jobno = job - vec_begin(jobs);
+    vec_size_t cmdno = vec_size(job->pipeline);
+    if (cmd->pid && add_job_pid(cmd->pid, jobno, cmdno) == FAIL)
+        return FAIL;
+    if (vec_command_push_back_by_ptr(job->pipeline, cmd) == FAIL) {
+        remove_job_pid(cmd->pid, jobno, cmdno);
         return FAIL;
+    }
 
     // Cleares cmd's values so the resources pushed to job would not released
     cmd->args = NULL;
-    cmd->redirections = NULL;
+    fm_redirection_init(&cmd->redirections);
 
     return SUCCESS;
 }
 
+static void update_skip_strategy(const struct command* cmd)
+{
+    _shell_assert(cmd);
+
+    // If it's not the last command of the job, does not update skip_strategy
+    if (!cmd->flags.pipe_out) {
+        skip_stategy = cmd->flags.skip_next_on_fail ? SKIP_ON_FAIL :    
+                       cmd->flags.skip_next_on_success ? SKIP_ON_SUCCESS :
+                       SKIP_NOSKIP;
+    }
+}
+
 static void update_job_validity(struct job* job)
 {
     _shell_assert(job);
@@ -419,67 +925,267 @@ static void update_job_validity(struct job* job)
     }
 }
 
-static void redirect_fm_func(int fd, struct redirection* redirection, void* arg)
+static void redirect_fm_func(int fd, struct redirection* redirection, void* arg)
+{
+    _shell_assert(arg);
+
+    if (!redirection) {
+        ((struct redirection_result*)arg)->result = FAIL;
+        return;
+    }
+
+    posix_spawn_file_actions_t* actions = ((struct redirection_result*)arg)->actions;
+    if ((actions ? add_spawn_redirection(actions, redirection) : redirect(redirection)) == FAIL) {
+        ((struct redirection_result*)arg)->result = FAIL;
+    }
+    if (redirection->fd == STDIN_FILENO)
+        ((struct redirection_result*)arg)->stdin_redirected = true;
+    if (redirection->fd == STDOUT_FILENO)
+        ((struct redirection_result*)arg)->stdout_redirected = true;
+}
+
+static int make_redirections(struct command* cmd)
+{
+    _shell_assert(cmd);
+    // Internal commands that start jobs must not close the descriptors again
+    if (shell_interactive) {
+        close(shell_tty);
+        shell_tty = INVALID_FD;
+    }
+
+    struct redirection_result result = {.result = SUCCESS, 
+                                        .stdin_redirected = false, 
+                                        .stdout_redirected = false,
+                                        .actions = NULL};
+    fm_redirection_foreach(&cmd->redirections, redirect_fm_func, &result);
+
+    if (result.result == FAIL)
+        return FAIL;
+
+    if (cmd->flags.pipe_in) {
+        if (!result.stdin_redirected) {
+            struct redirection redirection = {.type = REDIRECTION_FD,
+                                              .fd = STDIN_FILENO,  
+                                              .file_fd = pipe_in[0]};
+            if (redirect(&redirection) == FAIL) {
+                return FAIL;
+            }
+        }
+        close(pipe_in[0]);
+        close(pipe_in[1]);
+        pipe_in[0] = INVALID_FD;
+        pipe_in[1] = INVALID_FD;
+    }
+    // Redirected stdout is copied to the pipe by the relay
+    int fanout_pipe = INVALID_FD;
+    if (cmd->flags.pipe_out) {
+        if (!result.stdout_redirected) {
+            struct redirection redirection = {.type = REDIRECTION_FD,
+                                              .fd = STDOUT_FILENO,  
+                                              .file_fd = pipe_out[1]};
+            if (redirect(&redirection) == FAIL) {
+                return FAIL;
+            }
+        }
+        else if (has_fanout(cmd)) {
+            fanout_pipe = fcntl(pipe_out[1], F_DUPFD_CLOEXEC, 0);
+            if (fanout_pipe == FAIL)
+                return FAIL;
+        }
+        close(pipe_out[0]);
+        close(pipe_out[1]);
+        pipe_out[0] = INVALID_FD;
+        pipe_out[1] = INVALID_FD;
+    }
+
+    if (has_fanout(cmd))
+        return start_fanout(cmd, fanout_pipe);
+    return SUCCESS;
+}
+
+static void open_redirection_fm_func(int fd, struct redirection* redirection, void* arg)
+{
+    _shell_assert(arg);
+    (void) fd;
+
+    struct open_result* result = (struct open_result*)arg;
+    if (result->result == FAIL || !redirection)
+        return;
+
+    if (open_redirection(redirection) == FAIL) {
+        _shell_pperror(redirection->file_name);
+        result->result = FAIL;
+        return;
+    }
+    // The descriptor must not be replaced by another redirection before it's
+    // duplicated. The same descriptor as the target one would stay close-on-exec.
+    while (redirection->opened_fd != FAIL
+           && fm_redirection_find(result->redirections, redirection->opened_fd, NULL)) {
+        if (move_redirection(redirection, redirection->opened_fd + 1) == FAIL) {
+            _shell_pperror(redirection->file_name);
+            result->result = FAIL;
+            return;
+        }
+    }
+}
+
+static int open_redirections(struct command* cmd)
+{
+    _shell_assert(cmd);
+
+    struct open_result result = {.result = SUCCESS, 
+                                 .redirections = &cmd->redirections};
+    fm_redirection_foreach(&cmd->redirections, open_redirection_fm_func, &result);
+    if (result.result == FAIL)
+        fm_redirection_foreach(&cmd->redirections, close_opened_fm_func, NULL);
+    return result.result;
+}
+
+static void close_opened_fm_func(int fd, struct redirection* redirection, void* arg)
 {
-    _shell_assert(arg);
-
-    if (!redirection) {
-        ((struct redirection_result*)arg)->result = FAIL;
-        return;
-    }
-
-    if (redirect(redirection) == FAIL) {
-        ((struct redirection_result*)arg)->result = FAIL;
-    }
-    if (redirection->fd == STDIN_FILENO)
-        ((struct redirection_result*)arg)->stdin_redirected = true;
-    if (redirection->fd == STDOUT_FILENO)
-        ((struct redirection_result*)arg)->stdout_redirected = true;
+    (void) fd;
+    (void) arg;
+    if (redirection)
+        close_redirection(redirection);
 }
 
-static int make_redirections(const struct command* cmd)
+static int make_spawn_redirections(struct command* cmd, 
+                                   posix_spawn_file_actions_t* actions)
 {
     _shell_assert(cmd);
-    close(shell_tty);
-    close(waiting_pipe[0]);
-    close(waiting_pipe[1]);
+    _shell_assert(actions);
+
+    // The same descriptors as make_redirections() closes
+    if (shell_interactive && shell_tty != INVALID_FD 
+        && posix_spawn_file_actions_addclose(actions, shell_tty)) {
+        return FAIL;
+    }
 
     struct redirection_result result = {.result = SUCCESS, 
                                         .stdin_redirected = false, 
-                                        .stdout_redirected = false};
-    fm_redirection_foreach(cmd->redirections, redirect_fm_func, &result);
+                                        .stdout_redirected = false,
+                                        .actions = actions};
+    fm_redirection_foreach(&cmd->redirections, redirect_fm_func, &result);
 
     if (result.result == FAIL)
         return FAIL;
 
     if (cmd->flags.pipe_in) {
-        if (!result.stdin_redirected) {
-            struct redirection redirection = {.type = REDIRECTION_FD,
-                                              .fd = STDIN_FILENO,  
-                                              .file_fd = pipe_in[0]};
-            if (redirect(&redirection) == FAIL) {
-                return FAIL;
-            }
+        if (!result.stdin_redirected 
+            && posix_spawn_file_actions_adddup2(actions, pipe_in[0], STDIN_FILENO)) {
+            return FAIL;
+        }
+        if (posix_spawn_file_actions_addclose(actions, pipe_in[0])
+            || posix_spawn_file_actions_addclose(actions, pipe_in[1])) {
+            return FAIL;
         }
-        close(pipe_in[0]);
-        close(pipe_in[1]);
     }
     if (cmd->flags.pipe_out) {
-        if (!result.stdout_redirected) {
-            struct redirection redirection = {.type = REDIRECTION_FD,
-                                              .fd = STDOUT_FILENO,  
-                                              .file_fd = pipe_out[1]};
-            if (redirect(&redirection) == FAIL) {
-                return FAIL;
-            }
+        if (!result.stdout_redirected 
+            && posix_spawn_file_actions_adddup2(actions, pipe_out[1], STDOUT_FILENO)) {
+            return FAIL;
+        }
+        if (posix_spawn_file_actions_addclose(actions, pipe_out[0])
+            || posix_spawn_file_actions_addclose(actions, pipe_out[1])) {
+            return FAIL;
         }
-        close(pipe_out[0]);
-        close(pipe_out[1]);
     }
 
     return SUCCESS;
 }
 
+static pid_t spawn_cmd(struct command* cmd, const struct job* job, const char* path)
+{
+    _shell_assert(cmd);
+    _shell_assert(job);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    pid_t pid = FAIL;
+
+    if (posix_spawn_file_actions_init(&actions))
+        return FAIL;
+    if (posix_spawnattr_init(&attr)) {
+        posix_spawn_file_actions_destroy(&actions);
+        return FAIL;
+    }
+
+    // The same as set_child_signals() and unblocking SIGCHLD in a forked child
+    sigset_t sigdefault, sigmask;
+    get_child_signals(&sigdefault);
+    get_child_sigmask(&sigmask);
+    short flags = POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK;
+    // Without job control every job stays in the shell's process group
+    if (shell_interactive) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        posix_spawnattr_setpgroup(&attr, job->pgid);
+    }
+    if (posix_spawnattr_setflags(&attr, flags) 
+        || posix_spawnattr_setsigdefault(&attr, &sigdefault)
+        || posix_spawnattr_setsigmask(&attr, &sigmask)) {
+        goto RELEASE_RESOURCES;
+    }
+
+    if (make_spawn_redirections(cmd, &actions) == FAIL)
+        goto RELEASE_RESOURCES;
+
+    // posix_spawn(3) can't set affinity, but the child inherits the shell's
+    // one. If CPUs can't be set, the forked child reports the error.
+    if (cmd->cpus && push_cpu_affinity(cmd->cpus) == FAIL)
+        goto RELEASE_RESOURCES;
+    int error = posix_spawn(&pid, path, &actions, &attr, vec_data(cmd->args), environ);
+    // posix_spawn(3) doesn't run files without #! by the shell like execvp(3)
+    if (error == ENOEXEC) {
+        char** script_args = make_script_args(path, vec_data(cmd->args));
+        error = !script_args
+                || posix_spawn(&pid, SCRIPT_SHELL, &actions, &attr, script_args, environ);
+        free(script_args);
+    }
+    if (error) {
+        pid = FAIL;
+    }
+    if (cmd->cpus)
+        pop_cpu_affinity();
+
+RELEASE_RESOURCES:
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+
+    return pid;
+}
+
+static char** make_script_args(const char* path, char* const* args)
+{
+    _shell_assert(path);
+    _shell_assert(args && *args);
+
+    size_t count = 0;
+    while (args[count])
+        ++count;
+    // SCRIPT_SHELL and path replace the name, NULL is at the end
+    char** script_args = malloc((count + 2) * sizeof(char*));
+    if (!script_args)
+        return NULL;
+    script_args[0] = SCRIPT_SHELL;
+    script_args[1] = (char*)path;
+    memcpy(script_args + 2, args + 1, count * sizeof(char*));
+    return script_args;
+}
+
+static void exec_program(const char* path, char* const* args)
+{
+    _shell_assert(path);
+    _shell_assert(args);
+
+    execv(path, args);
+    if (errno != ENOEXEC)
+        return;
+    char** script_args = make_script_args(path, args);
+    if (script_args)
+        execv(SCRIPT_SHELL, script_args);
+    free(script_args);
+}
+
 static void close_redirection_fm_func(int fd, struct redirection* r, void* a)
 {
     (void) r;
@@ -488,117 +1194,203 @@ static void close_redirection_fm_func(int fd, struct redirection* r, void* a)
         close(fd);
 }
 
-static void close_redirections(const struct command* cmd)
+static void close_redirections(struct command* cmd)
 {
     _shell_assert(cmd);
 
-    fm_redirection_foreach(cmd->redirections, close_redirection_fm_func, NULL);
+    fm_redirection_foreach(&cmd->redirections, close_redirection_fm_func, NULL);
 }
 
 static int get_terminal_back(struct termios* oattr)
 {
-    sigset_t set, oset;
-    int oerrno = 0;
-    int retval = SUCCESS;
-    sigemptyset(&set);
-    sigaddset(&set, SIGTTOU);
-    sigaddset(&set, SIGTTIN);
-    sigaddset(&set, SIGTSTP);
-    sigaddset(&set, SIGCHLD);
-    sigemptyset(&oset);
-    sigprocmask(SIG_BLOCK, &set, &oset);
-
-    if (tcsetpgrp(shell_tty, shell_pgrp) == FAIL) {
-        oerrno = errno;
-        retval = FAIL;
-        goto EXIT;
-    }
+    if (!shell_interactive)
+        return SUCCESS;
 
-    if (oattr && tcgetattr(shell_tty, oattr) == FAIL) {
-        oerrno = errno;
-        retval = FAIL;
-        goto EXIT;
-    }
+    uint64_t start = trace_begin();
 
-    if (tcsetattr(shell_tty, TCSADRAIN, &shell_attr) == FAIL) {
-        oerrno = errno;
-        retval = FAIL;
-        goto EXIT;
-    }
+    // Nothing is blocked: the interactive shell ignores SIGTTOU, SIGTTIN and
+    // SIGTSTP, and SIGCHLD is never delivered
+    if (tcsetpgrp(shell_tty, shell_pgrp) == FAIL)
+        return FAIL;
+    if (oattr && tcgetattr(shell_tty, oattr) == FAIL)
+        return FAIL;
+    if (tcsetattr(shell_tty, TCSADRAIN, &shell_attr) == FAIL)
+        return FAIL;
     tcflush(shell_tty, TCIFLUSH);
+    trace_complete("get_terminal_back", start, NULL, 0);
 
-EXIT:
-    sigprocmask(SIG_SETMASK, &oset, NULL);
-
-    errno = oerrno;
-    return retval;
+    return SUCCESS;
 }
 
 static int give_terminal_to(pid_t pgrp, const struct termios* nattr, struct termios* oattr)
 {
-    sigset_t set, oset;
-    int oerrno = 0;
-    int retval = SUCCESS;
-    sigemptyset(&set);
-    sigaddset(&set, SIGTTOU);
-    sigaddset(&set, SIGTTIN);
-    sigaddset(&set, SIGTSTP);
-    sigaddset(&set, SIGCHLD);
-    sigemptyset(&oset);
-    sigprocmask(SIG_BLOCK, &set, &oset);
-
-    if (oattr && tcgetattr(shell_tty, oattr) == FAIL) {
-        oerrno = errno;
-        retval = FAIL;
-        goto EXIT;
+    if (!shell_interactive)
+        return SUCCESS;
+
+    // The same as get_terminal_back(), no signals must be blocked
+    uint64_t start = trace_begin();
+    if (oattr && tcgetattr(shell_tty, oattr) == FAIL)
+        return FAIL;
+    if (nattr && tcsetattr(shell_tty, TCSADRAIN, nattr) == FAIL)
+        return FAIL;
+    if (tcsetpgrp(shell_tty, pgrp) == FAIL)
+        return FAIL;
+    trace_complete("give_terminal_to", start, "pgrp", pgrp);
+
+    return SUCCESS;
+}
+
+static void save_and_redirect_fm_func(int fd, struct redirection* redirection, void* arg)
+{
+    _shell_assert(arg);
+
+    struct vec_saved_fd_t** saved = (struct vec_saved_fd_t**)arg;
+    if (!*saved || !redirection)
+        return;
+
+    // Copy does not conflict with any other redirection. If fd was not 
+    // opened, it will be closed back.
+    struct saved_fd saved_fd = {.fd = fd, 
+                                .copy = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_MIN)};
+    if (saved_fd.copy == FAIL && errno != EBADF) {
+        _shell_pperrorf("%d", fd);
+        goto ERROR;
+    }
+    if (vec_saved_fd_push_back(*saved, saved_fd) == FAIL) {
+        _shell_pperror("Failed to save descriptor");
+        if (saved_fd.copy != FAIL)
+            close(saved_fd.copy);
+        goto ERROR;
+    }
+    if (redirect(redirection) == FAIL) {
+        if (redirection->type == REDIRECTION_FILE_NAME)
+            _shell_pperror(redirection->file_name);
+        else
+            _shell_pperrorf("%d", fd);
+        goto ERROR;
     }
+    return;
 
-    if (nattr && tcsetattr(shell_tty, TCSADRAIN, nattr) == FAIL) {
-        oerrno = errno;
-        retval = FAIL;
-        goto EXIT;
+ERROR:
+    restore_saved_fds(*saved);
+    vec_saved_fd_delete(*saved);
+    *saved = NULL;
+}
+
+static void restore_saved_fds(struct vec_saved_fd_t* saved)
+{
+    _shell_assert(saved);
+
+    fflush(stdout);
+    fflush(shell_outstream);
+    while (!vec_empty(saved)) {
+        struct saved_fd saved_fd = vec_back(saved);
+        if (saved_fd.copy == FAIL) {
+            close(saved_fd.fd);
+        }
+        else {
+            dup2(saved_fd.copy, saved_fd.fd);
+            close(saved_fd.copy);
+        }
+        vec_saved_fd_pop_back(saved);
     }
+}
 
-    if (tcsetpgrp(shell_tty, pgrp) == FAIL) {
-        oerrno = errno;
-        retval = FAIL;
-        goto EXIT;
+static int execute_shell_cmd_in_shell(int internal_command, struct command* cmd)
+{
+    _shell_assert(cmd);
+
+    // Saved descriptors are dropped with the line
+    struct vec_saved_fd_t* saved = vec_saved_fd_new_in(sp_line_get(parsing_line)->arena);
+    if (!saved) {
+        _shell_pperror("Failed to save descriptors");
+        return FAIL;
     }
+    fm_redirection_foreach(&cmd->redirections, save_and_redirect_fm_func, &saved);
+    // Everything was already restored
+    if (!saved)
+        return FAIL;
 
-EXIT:
-    sigprocmask(SIG_SETMASK, &oset, NULL);
+    int status = execute_shell_cmd(internal_command, cmd);
 
-    errno = oerrno;
-    return retval;
+    restore_saved_fds(saved);
+    vec_saved_fd_delete(saved);
+
+    return status;
 }
 
-static int execute_shell_cmd(int internal_command, const struct command* cmd, struct job* job)
+static int time_shell_cmd_in_shell(int internal_command, struct command* cmd)
+{
+    _shell_assert(cmd);
+
+    struct rusage before;
+    getrusage(RUSAGE_SELF, &before);
+    clock_gettime(CLOCK_MONOTONIC, &cmd->usage.start);
+
+    int status = execute_shell_cmd_in_shell(internal_command, cmd);
+    if (status == SHELL_CMD_EXIT)
+        return status;
+
+    clock_gettime(CLOCK_MONOTONIC, &cmd->usage.end);
+    struct rusage* after = &cmd->usage.rusage;
+    getrusage(RUSAGE_SELF, after);
+    // Maximum resident set size is the shell's one, other values are used by
+    // the command
+    timersub(&after->ru_utime, &before.ru_utime, &after->ru_utime);
+    timersub(&after->ru_stime, &before.ru_stime, &after->ru_stime);
+    after->ru_nvcsw -= before.ru_nvcsw;
+    after->ru_nivcsw -= before.ru_nivcsw;
+    print_cmd_times(cmd);
+
+    return status;
+}
+
+static int execute_shell_cmd(int internal_command, const struct command* cmd)
 {
     if (!cmd)
         return FAIL;
 
+    // Job commands must see the latest states of the jobs
+    if (internal_command == SHELL_FG || internal_command == SHELL_BG 
+        || internal_command == SHELL_JOBS) {
+        reap_children();
+    }
+
     switch (internal_command) {
     case SHELL_FG:
-        execute_shell_fg(cmd, job);
-        break;
+        return execute_shell_fg(cmd);
     case SHELL_EXIT:
         return execute_shell_exit();
     case SHELL_BG:
-        execute_shell_bg(cmd);
-        break;
+        return execute_shell_bg(cmd);
     case SHELL_JOBS:
-        execute_shell_jobs();
-        break;
+        return execute_shell_jobs();
     case SHELL_CD:
-        execute_shell_cd(cmd);
-        break;
+        return execute_shell_cd(cmd);
+    case SHELL_HASH:
+        return execute_shell_hash(cmd);
+    case SHELL_HISTORY:
+        return execute_shell_history(cmd);
+    case SHELL_PARALLEL:
+        return execute_shell_parallel(cmd);
+    case SHELL_ECHO:
+        return run_echo(vec_data(cmd->args));
+    case SHELL_PRINTF:
+        return run_printf(vec_data(cmd->args));
+    case SHELL_TEST:
+        return run_test(vec_data(cmd->args));
+    case SHELL_TRUE:
+        return SUCCESS;
+    case SHELL_FALSE:
+        return FAIL;
+    case SHELL_PWD:
+        return run_pwd(vec_data(cmd->args));
+    case SHELL_SLEEP:
+        return run_sleep(vec_data(cmd->args));
     default:
         _shell_flush_fprintf("\"%s\" not implemented.\n", vec_at(cmd->args, 0));
         return FAIL;
-        break;
     };
-
-    return SUCCESS;
 }
 
 static int is_shell_cmd(const char* cmd)
@@ -613,42 +1405,56 @@ static int is_shell_cmd(const char* cmd)
         return SHELL_CD;
     if (strcmp("exit", cmd) == 0)
         return SHELL_EXIT;
+    if (strcmp("hash", cmd) == 0)
+        return SHELL_HASH;
+    if (strcmp("history", cmd) == 0)
+        return SHELL_HISTORY;
+    if (strcmp("parallel", cmd) == 0)
+        return SHELL_PARALLEL;
+    // Programs are executed instead of disabled builtins
+    if (!has_fast_builtins())
+        return SHELL_NOTCMD;
+    if (strcmp("echo", cmd) == 0)
+        return SHELL_ECHO;
+    if (strcmp("printf", cmd) == 0)
+        return SHELL_PRINTF;
+    if (strcmp("test", cmd) == 0 || strcmp("[", cmd) == 0)
+        return SHELL_TEST;
+    if (strcmp("true", cmd) == 0)
+        return SHELL_TRUE;
+    if (strcmp("false", cmd) == 0)
+        return SHELL_FALSE;
+    if (strcmp("pwd", cmd) == 0)
+        return SHELL_PWD;
+    if (strcmp("sleep", cmd) == 0)
+        return SHELL_SLEEP;
     
     return SHELL_NOTCMD;
 }
 
-static void execute_shell_jobs()
+static bool is_fast_builtin(int internal_command)
 {
-    // Parent
-    if (!internal_executing) {
-        for (vec_size_t i = 0; i < vec_size(jobs); ++i) {
-            struct job* job = vec_at_ptr(jobs, i);
-            if (job->state != JOB_VALID)
-                continue;
-            // Sets in the shell that all statuses didn't change since 
-            // last print
-            job->notify_status = false;
-        }
-        return;
-    }
-    
-    // Child
-    {
-        for (vec_size_t i = 0; i < vec_size(jobs); ++i) {
-            struct job* job = vec_at_ptr(jobs, i);
-            if (job->state != JOB_VALID)
-                continue;
-            // Prints every finished and not yet cleared job
-            fprintf(shell_outstream, "[%zu] \t", i + 1);
-            print_job_with_status(job);
-            fprintf(shell_outstream, "\n");
-            job->notify_status = false;
-        }
-        fflush(shell_outstream);
+    return internal_command >= SHELL_ECHO;
+}
+
+static int execute_shell_jobs()
+{
+    for (vec_size_t i = 0; i < vec_size(jobs); ++i) {
+        struct job* job = vec_at_ptr(jobs, i);
+        if (job->state != JOB_VALID)
+            continue;
+        // Prints every finished and not yet cleared job
+        fprintf(shell_outstream, "[%zu] \t", i + 1);
+        print_job_with_status(job);
+        fprintf(shell_outstream, "\n");
+        // Sets in the shell that all statuses didn't change since last print
+        job->notify_status = false;
     }
+    fflush(shell_outstream);
+    return SUCCESS;
 }
 
-static void start_job_in_background(vec_size_t jobno, const char* jobnostr)
+static int start_job_in_background(vec_size_t jobno, const char* jobnostr)
 {
     _shell_assert(jobnostr);
     _shell_assert(jobno <= vec_size(jobs));
@@ -656,44 +1462,47 @@ static void start_job_in_background(vec_size_t jobno, const char* jobnostr)
     struct job* job = jobno ? vec_at_ptr(jobs, jobno - 1) : NULL;
     // Check that job is valid
     if (!job || job->state != JOB_VALID) {
-        if (internal_executing)
-            _shell_flush_fprintf("bg: %s: no such job\n", jobnostr);
+        _shell_flush_fprintf("bg: %s: no such job\n", jobnostr);
+        return FAIL;
     }
     // Do nothing if job is already running
-    else if (get_job_status(job) == JOB_RUNNING) {
-        if (internal_executing)
-            _shell_flush_fprintf("bg: job %zu already in background\n", jobno);
+    if (get_job_status(job) == JOB_RUNNING) {
+        _shell_flush_fprintf("bg: job %zu already in background\n", jobno);
+        return SUCCESS;
+    }
+    if (get_job_status(job) == JOB_TERMINATED) {
+        _shell_flush_fputs("bg: job has terminated\n");
+        return FAIL;
     }
-    else if (get_job_status(job) == JOB_TERMINATED) {
-        if (internal_executing)
-            _shell_flush_fputs("bg: job has terminated\n");
+    // Queued job is started regardless of the limits
+    if (get_job_status(job) == JOB_QUEUED) {
+        if (start_queued_job(job) == FAIL || job->state != JOB_VALID)
+            return FAIL;
     }
-    // Finally, invoke all alive processes of the job
+    // Finally, invoke all alive processes of the job with priorities of the
+    // background
     else {
+        demote_job(job);
+        if (kill(-job->pgid, SIGCONT) == FAIL) {
+            _shell_pperror("bg: kill");
+            return FAIL;
+        }
         job->forced_running = true;
-
-        if (internal_executing) {
-            // Child kills because only child is able to write error message
-            if (kill(-job->pgid, SIGCONT) == FAIL) {
-                    _shell_pperror("bg: kill");
-                return;
-            }
-            fprintf(shell_outstream, "[%zu] \t", jobno);
-            print_job(job);
-            fprintf(shell_outstream, "\n");
-        }        
     }
+    fprintf(shell_outstream, "[%zu] \t", jobno);
+    print_job(job);
+    fprintf(shell_outstream, "\n");
+    return SUCCESS;
 }
 
-static void execute_shell_bg(const struct command* cmd)
+static int execute_shell_bg(const struct command* cmd)
 {
     _shell_assert(cmd);
 
     // BG must get terminal
-    if (cmd->flags.bkgrnd || cmd->flags.pipe_out || cmd->flags.pipe_in) {
-        if (internal_executing)
-            _shell_flush_fputs("bg: no job control\n");
-        return;
+    if (!shell_interactive || cmd->flags.bkgrnd || cmd->flags.pipe_out || cmd->flags.pipe_in) {
+        _shell_flush_fputs("bg: no job control\n");
+        return FAIL;
     }
 
     // Current job, actually the job with the biggest jobno
@@ -703,10 +1512,10 @@ static void execute_shell_bg(const struct command* cmd)
             if (vec_at_ptr(jobs, i)->state == JOB_VALID)
                 last_finished_job = i + 1;
         }
-        start_job_in_background(last_finished_job, "current");
-        return;
+        return start_job_in_background(last_finished_job, "current");
     }
 
+    int retval = SUCCESS;
     // list of job numbers
     for (vec_size_t i = 1; i < vec_size(cmd->args) - 1; ++i) {
         char* jobnostr = vec_at(cmd->args, i);
@@ -715,22 +1524,22 @@ static void execute_shell_bg(const struct command* cmd)
         if (endptr != jobnostr + strlen(jobnostr) || jobno > vec_size(jobs)) {
             jobno = 0;
         }
-        start_job_in_background(jobno, jobnostr);
+        if (start_job_in_background(jobno, jobnostr) == FAIL)
+            retval = FAIL;
     }
 
-    if (internal_executing)
-        fflush(shell_outstream);
+    fflush(shell_outstream);
+    return retval;
 }
 
-static void execute_shell_fg(const struct command* cmd, struct job* fg_job)
+static int execute_shell_fg(const struct command* cmd)
 {
     _shell_assert(cmd);
 
     // FG must get terminal
-    if (cmd->flags.bkgrnd || cmd->flags.pipe_out || cmd->flags.pipe_in) {
-        if (internal_executing)
-            _shell_flush_fputs("fg: no job control\n");
-        return;
+    if (!shell_interactive || cmd->flags.bkgrnd || cmd->flags.pipe_out || cmd->flags.pipe_in) {
+        _shell_flush_fputs("fg: no job control\n");
+        return FAIL;
     }
 
     char* jobnostr = "current";
@@ -759,56 +1568,142 @@ static void execute_shell_fg(const struct command* cmd, struct job* fg_job)
     }
     struct job* job = jobno ? vec_at_ptr(jobs, jobno - 1) : NULL;
 
-    // Child -- prints error on error
-    if (internal_executing) {
-        if (!job || job->state != JOB_VALID)
-            _shell_flush_fprintf("fg: %s: no such job\n", jobnostr);
-        else if (get_job_status(job) == JOB_TERMINATED)
-            _shell_flush_fputs("fg: job has terminated\n");
-        return;
+    if (!job || job->state != JOB_VALID) {
+        _shell_flush_fprintf("fg: %s: no such job\n", jobnostr);
+        return FAIL;
     }
-
-    // Parent -- passes foreground if any appropriate job found
-    if (job && job->state == JOB_VALID && get_job_status(job) != JOB_TERMINATED) {
-        // Waits for the child here because during pass_foreground() to another
-        // job this little process may die and release its resources, so
-        // it would be unappropriate to either wait for it or pass foreground.
-        wait_for_job(fg_job);
-        do_not_pass_terminal = true;
-        if (get_job_status(job) == JOB_TERMINATED)
-            return;
-        // Prints pipeline of commands to help user understand what was just run
-        print_job(job);
-        fprintf(shell_outstream, "\n");
-        pass_foreground(job);
+    if (get_job_status(job) == JOB_TERMINATED) {
+        _shell_flush_fputs("fg: job has terminated\n");
+        return FAIL;
+    }
+    // Queued job is started regardless of the limits
+    if (get_job_status(job) == JOB_QUEUED 
+        && (start_queued_job(job) == FAIL || job->state != JOB_VALID)) {
+        return FAIL;
     }
+
+    // Prints pipeline of commands to help user understand what was just run
+    print_job(job);
+    fprintf(shell_outstream, "\n");
+    boost_job(job);
+    if (pass_foreground(job) == FAIL)
+        return FAIL;
+    return last_result;
 }
 
-static void execute_shell_cd(const struct command* cmd)
+static int execute_shell_cd(const struct command* cmd)
 {
     _shell_assert(cmd);
 
     char* dir = vec_at(cmd->args, 1);
     if (!dir)
         dir = getenv("HOME");
-    if (!dir)
-        return;
-
-    // Child changes directory too to see the same permission errors as the main 
-    // process.
-    if (internal_executing) {
-        if (chdir(dir) == FAIL)
-            _shell_pperrorf("cd: %s", dir);
-        return;
+    if (!dir) {
+        _shell_flush_fputs("cd: HOME not set\n");
+        return FAIL;
     }
 
-    (void) chdir(dir);
+    if (chdir(dir) == FAIL) {
+        _shell_pperrorf("cd: %s", dir);
+        return FAIL;
+    }
+    update_prompt_cwd();
+    return SUCCESS;
 }
 
 static int execute_shell_exit()
 {
-    // If exiting was successful, shell must exit too so it returns FAIL
-    return end_execution(internal_executing) == SUCCESS ? FAIL : SUCCESS;
+    // If exiting was successful, shell must exit too. The forked child exits
+    // anyway and prints nothing.
+    return end_execution(shell_interactive && !internal_executing) == SUCCESS 
+           ? SHELL_CMD_EXIT : FAIL;
+}
+
+static int execute_shell_hash(const struct command* cmd)
+{
+    _shell_assert(cmd);
+
+    if (vec_size(cmd->args) == 2) {
+        print_command_cache();
+        return SUCCESS;
+    }
+
+    int retval = SUCCESS;
+    for (vec_size_t i = 1; i < vec_size(cmd->args) - 1; ++i) {
+        char* name = vec_at(cmd->args, i);
+        if (strcmp(name, "-r") == 0) {
+            reset_command_cache();
+        }
+        else if (!find_command(name)) {
+            _shell_flush_fprintf("hash: %s: not found\n", name);
+            retval = FAIL;
+        }
+    }
+    return retval;
+}
+
+static int execute_shell_history(const struct command* cmd)
+{
+    _shell_assert(cmd);
+
+    // args are NULL-terminated
+    size_t argc = vec_size(cmd->args) - 1;
+    if (argc == 1) {
+        print_history(0);
+        return SUCCESS;
+    }
+
+    char* arg = vec_at(cmd->args, 1);
+    if (argc == 3 && strcmp(arg, "-p") == 0)
+        return print_history_prefix(vec_at(cmd->args, 2));
+    if (argc == 3 && strcmp(arg, "-s") == 0)
+        return print_history_substring(vec_at(cmd->args, 2));
+
+    char* endptr;
+    unsigned long long count = strtoull(arg, &endptr, NUMBASE);
+    if (argc != 2 || !*arg || *endptr) {
+        _shell_flush_fputs("history: usage: history [n | -p prefix | -s string]\n");
+        return FAIL;
+    }
+    print_history(count);
+    return SUCCESS;
+}
+
+static int execute_shell_parallel(const struct command* cmd)
+{
+    _shell_assert(cmd);
+
+    // args are NULL-terminated
+    size_t argc = vec_size(cmd->args) - 1;
+    size_t first = 1;
+    long max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    if (max_jobs <= 0)
+        max_jobs = 1;
+    if (argc > 2 && strcmp(vec_at(cmd->args, 1), "-j") == 0) {
+        char* arg = vec_at(cmd->args, 2);
+        char* endptr;
+        max_jobs = strtol(arg, &endptr, NUMBASE);
+        if (!*arg || *endptr)
+            max_jobs = 0;
+        first = 3;
+    }
+    if (first >= argc || max_jobs <= 0) {
+        _shell_flush_fputs("parallel: usage: parallel [-j N] command [args...]\n");
+        return FAIL;
+    }
+
+    // Fast builtins are replaced by their programs
+    char* name = vec_at(cmd->args, first);
+    if (is_shell_cmd(name) != SHELL_NOTCMD && !is_fast_builtin(is_shell_cmd(name))) {
+        _shell_flush_fprintf("parallel: %s: internal commands are not supported\n", name);
+        return FAIL;
+    }
+    const char* path = find_command(name);
+    if (!path) {
+        _shell_flush_fprintf("Command '%s' not found\n", name);
+        return FAIL;
+    }
+    return run_parallel(max_jobs, path, vec_data(cmd->args) + first);
 }
 
 static int pass_foreground(struct job* job)
@@ -820,7 +1715,8 @@ static int pass_foreground(struct job* job)
         return FAIL;
     }
 
-    if (kill(-job->pgid, SIGCONT) == FAIL) {
+    // Without job control nobody could stop the job
+    if (shell_interactive && kill(-job->pgid, SIGCONT) == FAIL) {
         // _shell_pperror("fg: kill");
         goto GET_TERMINAL_BACK;
     }
@@ -834,8 +1730,10 @@ GET_TERMINAL_BACK:
     if (get_terminal_back(&job->tcattr) == FAIL)
         return FAIL;
 
-    if (get_job_status(job) == JOB_TERMINATED)
+    if (get_job_status(job) == JOB_TERMINATED) {
+        print_job_times(job);
         release_job(job);
+    }
     // Just makes format more pretty
     else if (get_job_status(job) == JOB_STOPPED)
         fprintf(shell_outstream, "\n");
@@ -846,7 +1744,21 @@ GET_TERMINAL_BACK:
 static void print_background_info(const struct job* job)
 {
     _shell_assert(job);
-    fprintf(shell_outstream, "[%zu] \t%jd\n", vec_size(jobs), (intmax_t)job->pid);
+    if (shell_interactive)
+        fprintf(shell_outstream, "[%zu] \t%jd\n", (size_t)(job - vec_begin(jobs) + 1), 
+                (intmax_t)job->pid);
+}
+
+static void start_all_queued_jobs()
+{
+    start_queued_jobs();
+    while (has_queued_jobs()) {
+        if (wait_events(false, get_queue_timeout()) == FAIL && errno != EINTR) {
+            _shell_pperror("wait for queued jobs");
+            return;
+        }
+        start_queued_jobs();
+    }
 }
 
 static bool has_stopped_jobs()
@@ -878,55 +1790,28 @@ static int wait_for_job(struct job* job)
 
     int retval = SUCCESS;
     last_result = FAIL;
+    foreground_job = job;
     
-    // Waits for every process of the pipeline
-    for (vec_size_t i = 0; i < vec_size(job->pipeline); ++i) {
-        struct command* cmd = vec_at_ptr(job->pipeline, i);
-        // If the process is not dead, waits for it
-        if (cmd->status != CLD_EXITED && cmd->status != CLD_KILLED 
-            && cmd->status != CLD_DUMPED && cmd->status != CLD_STOPPED) {
-            // siginfo_t status;
-            int status = 0;
-
-            waited_pid = cmd->pid;
-            // Unblocks SIGCHLD only after waited_pid set. It's done
-            // so while long-running process executes, other processes may 
-            // be freed.
-            UNBLOCK_CHILD(ovar);
-            struct pollfd pollfd = {.fd = waiting_pipe[0], .events = POLLIN};
-
-            int pollretval = 0;
-
-            // Waits SIGCHLD to pass status for the waited pid.
-            while ((pollretval = poll(&pollfd, 1, INFINITE_POLL)) == FAIL && errno == EINTR) ;
-
-            // Exactly one fd must chnage its state out of 1
-            if (pollretval != 1) {
-                _shell_pperror("poll wait for child");
-                retval = FAIL;
-                goto BLOCK;
-            }
-            // Some strange thing happened to the pipe
-            if (!(pollfd.revents & POLLIN)) {
-                _shell_pperror("pipe error");
-                retval = FAIL;
-                goto BLOCK;
-            }
-            // Checks for programmer errors. Exactly sizeof(int) shound be written
-            // to and read from the pipe.
-            if (read(waiting_pipe[0], &status, sizeof(status)) != sizeof(status)) {
-                _shell_pperror("pipe transmission error");
-                retval = FAIL;
-                goto BLOCK;
-            }
-
-            BLOCK_CHILD(nvar, ovar);
-
-            cmd->status = transform_status(status);
-            if (cmd->pid == job->pid)
-                job->status = status;
+    // Every process of the pipeline is waited at once. Their statuses are
+    // updated by the event loop. Queued jobs take places that are freed
+    // meanwhile, pipes of the job are sampled.
+    while (has_running_commands(job)) {
+        int timeout = get_queue_timeout();
+        int sample_timeout = get_pipe_sample_timeout(job);
+        if (timeout == EVENTS_NO_TIMEOUT || (sample_timeout != EVENTS_NO_TIMEOUT 
+                                             && sample_timeout < timeout)) {
+            timeout = sample_timeout;
         }
+        if (wait_events(false, timeout) == FAIL && errno != EINTR) {
+            _shell_pperror("wait for child");
+            retval = FAIL;
+            break;
+        }
+        start_queued_jobs();
+        sample_pipes(job);
     }
+    foreground_job = NULL;
+    job->forced_running = false;
 
     // Job's status was monitored, so it's status is already known by the user
 
@@ -936,24 +1821,31 @@ static int wait_for_job(struct job* job)
         break;
     case JOB_TERMINATED:
         last_result = WEXITSTATUS(job->status) ? FAIL : SUCCESS;
+        last_status = WIFSIGNALED(job->status) ? SIGNAL_STATUS + WTERMSIG(job->status) 
+                                               : WEXITSTATUS(job->status);
         __attribute__((fallthrough));
     default:
         job->notify_status = false;
         break;
     }
 
-    waited_pid = 0;
-
     return retval;
+}
 
-BLOCK:
-    BLOCK_CHILD(nvar, ovar);
-    waited_pid = 0;
+static bool has_running_commands(const struct job* job)
+{
+    _shell_assert(job);
 
-    return retval;
+    for (vec_size_t i = 0; i < vec_size(job->pipeline); ++i) {
+        if (vec_at_ptr(job->pipeline, i)->status == CLD_CONTINUED)
+            return true;
+    }
+    return false;
 }
 
 static void mark_command_continued_vec_func(struct command* cmd)
 {
-    cmd->status = CLD_CONTINUED;
+    // Already reaped commands won't change their status anymore
+    if (cmd->status == CLD_STOPPED)
+        cmd->status = CLD_CONTINUED;
 }
@@ -2,6 +2,7 @@
 #define OS_LABS_RSHELL_EXECUTE_CMD_H_
 
 #include <stdbool.h>
+#include <stddef.h>
 
 struct command;
 
@@ -17,4 +18,23 @@ int execute_cmd(struct command* cmd);
 // free everything successfully.
 int end_execution(bool print_msg);
 
+// Returns exit status of the last job waited in the foreground in the format 
+// of exit(3). Killed jobs have status 128 + signal number.
+int get_last_status();
+
+// Starts the program with the path as a new job in the process group of the 
+// shell without waiting for it or printing anything. Signals from the terminal
+// reach the job together with the shell's foreground. cmd is moved to the job.
+// Returns number of the job in jobs or 0 on error.
+size_t start_shell_pgrp_job(struct command* cmd, const char* path);
+
+// Starts queued background jobs in the order they were queued while they fit
+// the limits. Started jobs are reported as running by the next check of jobs.
+void start_queued_jobs();
+
+// Returns timeout in milliseconds for wait_events() after which queued jobs 
+// must be checked again or EVENTS_NO_TIMEOUT if only reaped children may free
+// places for them.
+int get_queue_timeout();
+
 #endif // OS_LABS_RSHELL_EXECUTE_CMD_H_
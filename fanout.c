@@ -0,0 +1,422 @@
+#define _GNU_SOURCE
+#include "fanout.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "command.h"
+#include "pipes.h"
+#include "redirection.h"
+#include "util/config.h"
+
+#define FAIL            -1
+#define SUCCESS         0
+#define INVALID_FD      -1
+#define NULL_FILE       "/dev/null"
+#define PIPE_NAME       "pipe"
+// Data is written by blocks of this size if it can't be spliced
+#define COPY_BLOCK      4096
+
+// Output of the relay
+struct target {
+    int fd;
+    // Name for errors
+    const char* name;
+    // Pipe that gets a copy of the input. The last live target takes data
+    // from the input itself.
+    int copy[2];
+    // splice(2) is not supported by the target
+    bool written;
+};
+
+#define VEC_SOURCE
+#define vec_name    target
+#define vec_elem_t  struct target
+#include "util/vector.h"
+#undef VEC_SOURCE
+
+// Returns true iff the output has extra targets
+static bool has_extra_targets(const struct command* cmd, int fd);
+
+// Starts the relay of the output fd. Returns only in the child.
+static int start_relay(struct command* cmd, int fd, int pipe_fd);
+
+// Adds the target with a duplicate of fd
+static int add_target(struct vec_target_t* targets, int fd, const char* name);
+
+// Creates copy pipes for all targets except the last one. They get the
+// capacity of the input, so a copy of everything in it fits.
+static int make_copy_pipes(struct vec_target_t* targets, int in);
+
+// Closes descriptors of the target
+static void close_target(struct target* target);
+
+// Copies the input to the targets until its end or until all targets are
+// closed
+static void relay(int in, struct vec_target_t* targets, int null_fd);
+
+// Moves len bytes from the pipe to the target. If once is set, returns after
+// the first move that may be shorter. The target that fails is closed, the
+// rest of the data is dropped.
+// Returns the number of moved bytes, 0 at the end of the input.
+static ssize_t move_data(int from, struct target* target, size_t len, bool once, int null_fd);
+
+// Writes len bytes from the pipe to the target. Returns the number of written
+// bytes like move_data()
+static ssize_t write_data(int from, struct target* target, size_t len, bool once);
+
+// Closes the target after the error. Closed readers are not reported.
+static void drop_target(struct target* target);
+
+// Exits with the status of the child. Signals are raised again.
+static void exit_with_status(int status);
+
+bool has_fanout(const struct command* cmd)
+{
+    _shell_assert(cmd);
+
+    if (cmd->fanout && !vec_empty(cmd->fanout))
+        return true;
+    // Redirected stdout goes to the pipe too
+    struct redirection redirection;
+    return cmd->flags.pipe_out
+           && fm_redirection_find((struct fm_redirection_t*)&cmd->redirections,
+                                  STDOUT_FILENO, &redirection)
+           && (redirection.flags & O_WRONLY);
+}
+
+int start_fanout(struct command* cmd, int pipe_fd)
+{
+    _shell_assert(cmd);
+
+    int retval = SUCCESS;
+    if (pipe_fd != INVALID_FD || has_extra_targets(cmd, STDOUT_FILENO))
+        retval = start_relay(cmd, STDOUT_FILENO, pipe_fd);
+    // Relays of other outputs don't keep the pipe
+    if (pipe_fd != INVALID_FD)
+        close(pipe_fd);
+
+    for (size_t i = 0; cmd->fanout && i < vec_size(cmd->fanout) && retval == SUCCESS; ++i) {
+        // Every output has one relay
+        int fd = vec_at(cmd->fanout, i).fd;
+        bool started = fd == STDOUT_FILENO;
+        for (size_t j = 0; j < i && !started; ++j)
+            started = vec_at(cmd->fanout, j).fd == fd;
+        if (!started)
+            retval = start_relay(cmd, fd, INVALID_FD);
+    }
+    return retval;
+}
+
+static bool has_extra_targets(const struct command* cmd, int fd)
+{
+    _shell_assert(cmd);
+
+    for (size_t i = 0; cmd->fanout && i < vec_size(cmd->fanout); ++i) {
+        if (vec_at(cmd->fanout, i).fd == fd)
+            return true;
+    }
+    return false;
+}
+
+static int start_relay(struct command* cmd, int fd, int pipe_fd)
+{
+    _shell_assert(cmd);
+
+    int retval = FAIL;
+    int relay_pipe[2] = {INVALID_FD, INVALID_FD};
+    struct vec_target_t* targets = vec_target_new();
+    if (!targets) {
+        _shell_pperror("fanout");
+        return FAIL;
+    }
+
+    // The first target is already the descriptor
+    struct redirection first;
+    const char* name = fm_redirection_find(&cmd->redirections, fd, &first)
+                       && first.type == REDIRECTION_FILE_NAME ? first.file_name : PIPE_NAME;
+    if (add_target(targets, fd, name) == FAIL) {
+        _shell_pperror(name);
+        goto ERROR_HANDLER;
+    }
+    for (size_t i = 0; cmd->fanout && i < vec_size(cmd->fanout); ++i) {
+        struct redirection redirection = vec_at(cmd->fanout, i);
+        if (redirection.fd != fd)
+            continue;
+        if (open_redirection(&redirection) == FAIL) {
+            _shell_pperror(redirection.file_name);
+            goto ERROR_HANDLER;
+        }
+        int added = add_target(targets, redirection.opened_fd, redirection.file_name);
+        close_redirection(&redirection);
+        if (added == FAIL) {
+            _shell_pperror(redirection.file_name);
+            goto ERROR_HANDLER;
+        }
+    }
+    if (pipe_fd != INVALID_FD && add_target(targets, pipe_fd, PIPE_NAME) == FAIL) {
+        _shell_pperror(PIPE_NAME);
+        goto ERROR_HANDLER;
+    }
+
+    // Pipes are created before the command writes anything, so their
+    // capacities may still be changed
+    if (make_pipe(relay_pipe, 0) == FAIL || fcntl(relay_pipe[0], F_SETFD, FD_CLOEXEC) == FAIL
+        || fcntl(relay_pipe[1], F_SETFD, FD_CLOEXEC) == FAIL
+        || make_copy_pipes(targets, relay_pipe[0]) == FAIL) {
+        _shell_pperror("Failed to create pipe");
+        goto ERROR_HANDLER;
+    }
+
+    pid_t pid = fork();
+    if (pid == FAIL) {
+        _shell_pperror("fork");
+        goto ERROR_HANDLER;
+    }
+    // Child continues the command
+    if (pid == 0) {
+        retval = dup2(relay_pipe[1], fd) == FAIL ? FAIL : SUCCESS;
+        if (retval == FAIL)
+            _shell_pperror("dup2");
+        goto ERROR_HANDLER;
+    }
+
+    // Relay doesn't keep the command's descriptors, so its readers and
+    // writers see when the command closes them
+    close(relay_pipe[1]);
+    close(STDIN_FILENO);
+    close(STDOUT_FILENO);
+    if (fd != STDERR_FILENO)
+        close(fd);
+    if (pipe_fd != INVALID_FD)
+        close(pipe_fd);
+    signal(SIGPIPE, SIG_IGN);
+    int null_fd = open(NULL_FILE, O_WRONLY | O_CLOEXEC);
+    if (null_fd == FAIL)
+        _shell_pperror(NULL_FILE);
+    else
+        relay(relay_pipe[0], targets, null_fd);
+
+    // The command gets SIGPIPE if the relay stops before the end
+    close(relay_pipe[0]);
+    int status;
+    while (waitpid(pid, &status, 0) == FAIL) {
+        if (errno != EINTR)
+            _exit(EXIT_FAILURE);
+    }
+    exit_with_status(status);
+
+ERROR_HANDLER:
+    vec_target_foreach(targets, close_target);
+    vec_target_delete(targets);
+    if (relay_pipe[0] != INVALID_FD) {
+        close(relay_pipe[0]);
+        close(relay_pipe[1]);
+    }
+    return retval;
+}
+
+static int add_target(struct vec_target_t* targets, int fd, const char* name)
+{
+    _shell_assert(targets);
+    _shell_assert(name);
+
+    struct target target = {.fd = fcntl(fd, F_DUPFD_CLOEXEC, STDERR_FILENO + 1),
+                            .name = name,
+                            .copy = {INVALID_FD, INVALID_FD},
+                            .written = false};
+    if (target.fd == FAIL)
+        return FAIL;
+    if (vec_target_push_back(targets, target) == FAIL) {
+        close(target.fd);
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+static int make_copy_pipes(struct vec_target_t* targets, int in)
+{
+    _shell_assert(targets);
+
+    for (size_t i = 0; i + 1 < vec_size(targets); ++i) {
+        struct target* target = vec_at_ptr(targets, i);
+        if (pipe2(target->copy, O_CLOEXEC) == FAIL)
+            return FAIL;
+    }
+    // All pipes get the smallest capacity, so tee(2) copies the same data to
+    // every copy
+    int capacity = fcntl(in, F_GETPIPE_SZ);
+    for (size_t i = 0; i + 1 < vec_size(targets) && capacity != FAIL; ++i) {
+        int copy = vec_at(targets, i).copy[0];
+        int copy_capacity = fcntl(copy, F_SETPIPE_SZ, capacity);
+        if (copy_capacity == FAIL)
+            copy_capacity = fcntl(copy, F_GETPIPE_SZ);
+        if (copy_capacity == FAIL)
+            return FAIL;
+        if (copy_capacity < capacity)
+            capacity = fcntl(in, F_SETPIPE_SZ, copy_capacity);
+    }
+    return capacity == FAIL ? FAIL : SUCCESS;
+}
+
+static void close_target(struct target* target)
+{
+    _shell_assert(target);
+
+    int fds[] = {target->fd, target->copy[0], target->copy[1]};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(*fds); ++i) {
+        if (fds[i] != INVALID_FD)
+            close(fds[i]);
+    }
+    target->fd = target->copy[0] = target->copy[1] = INVALID_FD;
+}
+
+static void relay(int in, struct vec_target_t* targets, int null_fd)
+{
+    _shell_assert(targets);
+
+    while (true) {
+        size_t last = vec_size(targets);
+        for (size_t i = vec_size(targets); i > 0 && last == vec_size(targets); --i) {
+            if (vec_at(targets, i - 1).fd != INVALID_FD)
+                last = i - 1;
+        }
+        // Nobody reads anymore
+        if (last == vec_size(targets))
+            return;
+
+        // The first copy waits for data, the others copy the same amount
+        ssize_t len = FAIL;
+        for (size_t i = 0; i < last; ++i) {
+            struct target* target = vec_at_ptr(targets, i);
+            if (target->fd == INVALID_FD)
+                continue;
+            ssize_t count;
+            do {
+                count = tee(in, target->copy[1], len == FAIL ? INT_MAX : (size_t)len, 0);
+            } while (count == FAIL && errno == EINTR);
+            if (count == FAIL || (len != FAIL && count != len)) {
+                _shell_pperror("tee");
+                return;
+            }
+            if (!count)
+                return;
+            len = count;
+        }
+
+        // Copies go to their targets after the last target takes the input
+        struct target* last_target = vec_at_ptr(targets, last);
+        if (len == FAIL) {
+            if (!move_data(in, last_target, INT_MAX, true, null_fd))
+                return;
+            continue;
+        }
+        move_data(in, last_target, len, false, null_fd);
+        for (size_t i = 0; i < last; ++i) {
+            struct target* target = vec_at_ptr(targets, i);
+            if (target->fd != INVALID_FD)
+                move_data(target->copy[0], target, len, false, null_fd);
+        }
+    }
+}
+
+static ssize_t move_data(int from, struct target* target, size_t len, bool once, int null_fd)
+{
+    _shell_assert(target);
+
+    size_t moved = 0;
+    while (moved < len) {
+        // The rest of the data of the closed target is dropped
+        bool live = target->fd != INVALID_FD;
+        if (live && target->written) {
+            ssize_t count = write_data(from, target, len - moved, once);
+            if (once || count <= 0)
+                return count;
+            moved += count;
+            continue;
+        }
+
+        ssize_t count = splice(from, NULL, live ? target->fd : null_fd, NULL, len - moved,
+                               SPLICE_F_MOVE);
+        if (count == FAIL && errno == EINTR)
+            continue;
+        if (count == FAIL && errno == EINVAL && live) {
+            target->written = true;
+            continue;
+        }
+        if (count == FAIL && live) {
+            drop_target(target);
+            if (once)
+                return 0;
+            continue;
+        }
+        if (count <= 0)
+            return count;
+        moved += count;
+        if (once)
+            break;
+    }
+    return moved;
+}
+
+static ssize_t write_data(int from, struct target* target, size_t len, bool once)
+{
+    _shell_assert(target);
+
+    char block[COPY_BLOCK];
+    size_t written = 0;
+    while (written < len) {
+        ssize_t count = read(from, block, len - written < sizeof(block) ? len - written
+                                                                         : sizeof(block));
+        if (count == FAIL && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return count;
+        for (ssize_t done = 0; done < count && target->fd != INVALID_FD; ) {
+            ssize_t result = write(target->fd, block + done, count - done);
+            if (result == FAIL && errno == EINTR)
+                continue;
+            if (result == FAIL)
+                drop_target(target);
+            else
+                done += result;
+        }
+        written += count;
+        // Data of the dropped target is read anyway
+        if (once)
+            break;
+    }
+    return written;
+}
+
+static void drop_target(struct target* target)
+{
+    _shell_assert(target);
+
+    if (errno != EPIPE)
+        _shell_pperror(target->name);
+    close(target->fd);
+    target->fd = INVALID_FD;
+}
+
+static void exit_with_status(int status)
+{
+    if (WIFSIGNALED(status)) {
+        int sig = WTERMSIG(status);
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigaddset(&mask, sig);
+        signal(sig, SIG_DFL);
+        sigprocmask(SIG_UNBLOCK, &mask, NULL);
+        raise(sig);
+    }
+    _exit(WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE);
+}
@@ -0,0 +1,28 @@
+#ifndef OS_LABS_RSHELL_FANOUT_H_
+#define OS_LABS_RSHELL_FANOUT_H_
+
+#include <stdbool.h>
+
+// Output of a descriptor redirected several times, like zsh multios does:
+// `cmd > a >> b | cat` writes to a, b and the pipe. The command writes to a
+// pipe, its relay copies the data to every target with tee(2) and moves it
+// with splice(2), so the data never gets to user space. Targets that don't
+// support splice(2), like terminals and files opened with O_APPEND, are
+// written by the relay.
+
+struct command;
+
+// Returns true iff an output of cmd has several targets
+bool has_fanout(const struct command* cmd);
+
+// Starts relays for outputs of cmd that have several targets. It's called by
+// the forked child after redirections are made, so the first target of every
+// output is its descriptor. pipe_fd is the pipe to the next command if stdout
+// is redirected too or -1, it's closed.
+// The calling process becomes the relay of the first output and the command
+// is continued by its child. The relay exits with the status of the child
+// when the output is closed, so the shell waits for both. Returns only in
+// the child, -1 on error.
+int start_fanout(struct command* cmd, int pipe_fd);
+
+#endif // OS_LABS_RSHELL_FANOUT_H_
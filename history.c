@@ -0,0 +1,566 @@
+// memmem(3)
+#define _GNU_SOURCE
+#include "history.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "util/binsearch.h"
+#include "util/config.h"
+#include "util/vec_string.h"
+
+// Offsets of the entries in the file or numbers of the entries. 32 bits are
+// enough and the index of a million entries takes only 4 MB.
+#define VEC_SOURCE
+#define vec_name    history_index
+#define vec_elem_t  uint32_t
+#include "util/vector.h"
+#undef VEC_SOURCE
+
+#define FAIL                -1
+#define SUCCESS             0
+#define HISTORY_FILE        ".rshell_history"
+#define HISTORY_FILE_MODE   0600
+// Bigger files are indexed only up to this size
+#define HISTORY_MAX_SIZE    UINT32_MAX
+// New entries are merged to the sorted ones when there are more of them
+#define UNSORTED_MAX        1024
+// The text is searched for a substring from the end by blocks of this size
+#define SEARCH_BLOCK_SIZE   (1 << 16)
+#define HISTORY_SIGN        '!'
+#define SEARCH_SIGN         '?'
+#define DESIGNATOR_END      " \f\n\r\t\v|&;<>"
+#define WHITESPACES         " \f\n\r\t\v"
+#define NUMBER_WIDTH        6
+#define NUMBASE             10
+
+// Prefix to be found among the sorted entries
+struct prefix_key {
+    const char* str;
+    size_t len;
+    // Result of comparison with an entry that starts with the prefix. Lower
+    // bound of the entries is found with -1, upper bound with 1.
+    int tie;
+};
+
+static int history_fd = FAIL;
+// Mapped history file
+static const char* text;
+static size_t mapped_size;
+// Number of bytes in the indexed lines. Each of them ends with a newline.
+static size_t indexed_size;
+// Offsets of the entries in the text
+static struct vec_history_index_t* offsets;
+// Numbers of the older entries (from 0) sorted by their text. The newer ones
+// are not sorted yet and are checked one by one.
+static struct vec_history_index_t* sorted;
+// Temporary numbers of entries
+static struct vec_history_index_t* numbers;
+
+// Maps the file again if it has grown and indexes new lines.
+// Returns -1 if there is no history.
+static int update_history();
+
+// Indexes complete lines after indexed_size
+static int index_entries();
+
+// Forgets all entries
+static void reset_index();
+
+// Merges the newer entries to the sorted ones if there are too many of them
+static int update_sorted();
+
+// Returns text of the entry from 0 and sets *len
+static const char* entry_text(size_t entry, size_t* len);
+
+// Returns number of the entry from 0 that contains offset
+static size_t entry_at(size_t offset);
+
+// Compares texts of two entries, the older one is less if they are equal.
+// This is special function for qsort().
+static int cmp_entries(const void* lhs, const void* rhs);
+
+// Compares struct prefix_key with text of the entry. This is special function
+// for binsearch().
+static int cmp_prefix(const void* key, const void* entry);
+
+// Compares offset with an entry offset, equal ones are less. This is special
+// function for binsearch().
+static int cmp_offset(const void* offset, const void* entry_offset);
+
+// Compares numbers of entries. This is special function for qsort().
+static int cmp_numbers(const void* lhs, const void* rhs);
+
+// Finds range of the sorted entries that start with prefix
+static void find_sorted_prefix(const char* prefix, size_t len,
+                               uint32_t** begin, uint32_t** end);
+
+// Returns true iff the entry from 0 starts with prefix
+static bool has_prefix(size_t entry, const char* prefix, size_t len);
+
+// Prints entry from 0 with its number
+static void print_entry(size_t entry);
+
+int init_history(const char* name)
+{
+    const char* file_name = getenv(name);
+    char path[PATH_MAX];
+    if (!file_name) {
+        const char* home = getenv("HOME");
+        if (!home)
+            return SUCCESS;
+        if (snprintf(path, PATH_MAX, "%s/%s", home, HISTORY_FILE) >= PATH_MAX) {
+            errno = ENAMETOOLONG;
+            _shell_pperror("history");
+            return FAIL;
+        }
+        file_name = path;
+    }
+    if (!*file_name)
+        return SUCCESS;
+
+    int fd = open(file_name, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, HISTORY_FILE_MODE);
+    // Redirections of the internal commands won't replace it
+    if (fd == FAIL || (history_fd = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_MIN)) == FAIL) {
+        _shell_pperrorf("history: %s", file_name);
+        if (fd != FAIL)
+            close(fd);
+        return FAIL;
+    }
+    close(fd);
+
+    if (!(offsets = vec_history_index_new()) || !(sorted = vec_history_index_new())
+        || !(numbers = vec_history_index_new()) || update_history() == FAIL) {
+        _shell_pperrorf("history: %s", file_name);
+        release_history();
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+void release_history()
+{
+    if (text)
+        munmap((void*)text, mapped_size);
+    if (history_fd != FAIL)
+        close(history_fd);
+    vec_history_index_delete(offsets);
+    vec_history_index_delete(sorted);
+    vec_history_index_delete(numbers);
+    history_fd = FAIL;
+    text = NULL;
+    mapped_size = 0;
+    indexed_size = 0;
+    offsets = NULL;
+    sorted = NULL;
+    numbers = NULL;
+}
+
+int add_history(const char* line)
+{
+    _shell_assert(line);
+
+    if (update_history() == FAIL)
+        return FAIL;
+
+    // Prompt may leave a whitespace at the end
+    size_t len = strlen(line);
+    while (len && isspace(line[len - 1]))
+        --len;
+    if (len == strspn(line, WHITESPACES))
+        return SUCCESS;
+
+    size_t last_len = 0;
+    const char* last = vec_empty(offsets) ? NULL : entry_text(vec_size(offsets) - 1, &last_len);
+    if (last && last_len == len && memcmp(last, line, len) == 0)
+        return SUCCESS;
+
+    // Appending by a single write keeps lines of concurrent shells whole
+    struct iovec iov[] = {{.iov_base = (void*)line, .iov_len = len},
+                          {.iov_base = "\n", .iov_len = 1}};
+    if (writev(history_fd, iov, sizeof(iov) / sizeof(*iov)) == FAIL) {
+        _shell_pperror("history");
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+size_t history_size()
+{
+    return update_history() == FAIL ? 0 : vec_size(offsets);
+}
+
+const char* get_history_entry(size_t number, size_t* len)
+{
+    _shell_assert(len);
+
+    if (!offsets || !number || number > vec_size(offsets))
+        return NULL;
+    return entry_text(number - 1, len);
+}
+
+size_t find_history_prefix(const char* prefix, size_t len)
+{
+    _shell_assert(prefix);
+
+    if (update_history() == FAIL || update_sorted() == FAIL)
+        return 0;
+
+    // The latest entries are not sorted
+    for (size_t i = vec_size(offsets); i > vec_size(sorted); --i) {
+        if (has_prefix(i - 1, prefix, len))
+            return i;
+    }
+
+    uint32_t* begin;
+    uint32_t* end;
+    find_sorted_prefix(prefix, len, &begin, &end);
+    size_t latest = 0;
+    for (uint32_t* it = begin; it != end; ++it) {
+        if (*it + 1 > latest)
+            latest = *it + 1;
+    }
+    return latest;
+}
+
+size_t find_history_substring(const char* str, size_t len)
+{
+    _shell_assert(str);
+
+    if (!len || update_history() == FAIL)
+        return 0;
+
+    // Lines have no newlines, so any match is inside one entry. The latest one
+    // is searched in blocks from the end. Blocks overlap so matches on their
+    // borders are not lost.
+    size_t block_size = len < SEARCH_BLOCK_SIZE ? SEARCH_BLOCK_SIZE : 2 * len;
+    size_t end = indexed_size;
+    while (end >= len) {
+        size_t begin = end > block_size ? end - block_size : 0;
+        const char* found = NULL;
+        const char* it = text + begin;
+        while ((it = memmem(it, text + end - it, str, len))) {
+            found = it++;
+        }
+        if (found)
+            return entry_at(found - text) + 1;
+        if (!begin)
+            break;
+        end = begin + len - 1;
+    }
+    return 0;
+}
+
+int expand_history(struct vec_char_t* line)
+{
+    _shell_assert(line);
+
+    char* str = vec_data(line);
+    size_t skip = strspn(str, WHITESPACES);
+    if (str[skip] != HISTORY_SIGN)
+        return SUCCESS;
+
+    char* designator = str + skip + 1;
+    char* rest = NULL;
+    size_t number = 0;
+    if (*designator == HISTORY_SIGN) {
+        number = history_size();
+        rest = designator + 1;
+    }
+    else if (*designator == SEARCH_SIGN) {
+        char* end = strchr(designator + 1, SEARCH_SIGN);
+        size_t len = end ? (size_t)(end - designator - 1) : strlen(designator + 1);
+        number = find_history_substring(designator + 1, len);
+        rest = end ? end + 1 : designator + 1 + len;
+    }
+    else if (isdigit(*designator) || (*designator == '-' && isdigit(designator[1]))) {
+        long long n = strtoll(designator, &rest, NUMBASE);
+        size_t size = history_size();
+        // !-1 is the last entry
+        if (n < 0)
+            number = (size_t)-n <= size ? size + n + 1 : 0;
+        else
+            number = n;
+    }
+    else {
+        size_t len = strcspn(designator, DESIGNATOR_END);
+        // Single ! is left as it is
+        if (!len)
+            return SUCCESS;
+        number = find_history_prefix(designator, len);
+        rest = designator + len;
+    }
+
+    size_t entry_len = 0;
+    const char* entry = get_history_entry(number, &entry_len);
+    if (!entry) {
+        _shell_flush_fprintf("%.*s: event not found\n", (int)(rest - str - skip), str + skip);
+        return FAIL;
+    }
+
+    // The designator is replaced by the entry, the rest is moved after it
+    size_t rest_pos = rest - str;
+    size_t rest_size = vec_size(line) - rest_pos;
+    size_t new_size = entry_len + rest_size;
+    if (new_size > vec_size(line) && vec_char_resize(line, new_size) == FAIL) {
+        _shell_pperror("history");
+        return FAIL;
+    }
+    memmove(vec_data(line) + entry_len, vec_data(line) + rest_pos, rest_size);
+    memcpy(vec_data(line), entry, entry_len);
+    vec_char_resize(line, new_size);
+
+    if (shell_interactive) {
+        fprintf(shell_outstream, "%s\n", vec_data(line));
+        fflush(shell_outstream);
+    }
+    return SUCCESS;
+}
+
+void print_history(size_t count)
+{
+    size_t size = history_size();
+    for (size_t i = count && count < size ? size - count : 0; i < size; ++i) {
+        print_entry(i);
+    }
+    fflush(shell_outstream);
+}
+
+int print_history_prefix(const char* prefix)
+{
+    _shell_assert(prefix);
+
+    if (update_history() == FAIL || update_sorted() == FAIL)
+        return FAIL;
+
+    size_t len = strlen(prefix);
+    uint32_t* begin;
+    uint32_t* end;
+    find_sorted_prefix(prefix, len, &begin, &end);
+    if (vec_history_index_reserve(numbers, end - begin) == FAIL) {
+        _shell_pperror("history");
+        return FAIL;
+    }
+    vec_history_index_clear(numbers);
+    for (uint32_t* it = begin; it != end; ++it) {
+        vec_history_index_push_back(numbers, *it);
+    }
+    // Empty vector has no data
+    if (!vec_empty(numbers))
+        qsort(vec_data(numbers), vec_size(numbers), sizeof(uint32_t), cmp_numbers);
+
+    for (size_t i = 0; i < vec_size(numbers); ++i) {
+        print_entry(vec_at(numbers, i));
+    }
+    bool found = !vec_empty(numbers);
+    for (size_t i = vec_size(sorted); i < vec_size(offsets); ++i) {
+        if (has_prefix(i, prefix, len)) {
+            print_entry(i);
+            found = true;
+        }
+    }
+    fflush(shell_outstream);
+    return found ? SUCCESS : FAIL;
+}
+
+int print_history_substring(const char* str)
+{
+    _shell_assert(str);
+
+    size_t len = strlen(str);
+    if (!len || update_history() == FAIL)
+        return FAIL;
+
+    bool found = false;
+    const char* it = text;
+    const char* end = text + indexed_size;
+    while ((it = memmem(it, end - it, str, len))) {
+        size_t entry = entry_at(it - text);
+        print_entry(entry);
+        found = true;
+        // The next entry
+        size_t entry_len = 0;
+        it = entry_text(entry, &entry_len) + entry_len + 1;
+    }
+    fflush(shell_outstream);
+    return found ? SUCCESS : FAIL;
+}
+
+static int update_history()
+{
+    if (history_fd == FAIL)
+        return FAIL;
+
+    struct stat st;
+    if (fstat(history_fd, &st) == FAIL)
+        return FAIL;
+    size_t size = (uintmax_t)st.st_size < HISTORY_MAX_SIZE ? (size_t)st.st_size
+                                                          : HISTORY_MAX_SIZE;
+    // Somebody has truncated the file, it's indexed again
+    if (size < indexed_size)
+        reset_index();
+    if (size == mapped_size)
+        return SUCCESS;
+
+    if (text)
+        munmap((void*)text, mapped_size);
+    text = NULL;
+    mapped_size = 0;
+    if (!size)
+        return SUCCESS;
+
+    void* mem = mmap(NULL, size, PROT_READ, MAP_SHARED, history_fd, 0);
+    if (mem == MAP_FAILED) {
+        reset_index();
+        return FAIL;
+    }
+    text = (const char*)mem;
+    mapped_size = size;
+    return index_entries();
+}
+
+static int index_entries()
+{
+    const char* end = text + mapped_size;
+    const char* line = text + indexed_size;
+    const char* newline;
+    // A line that is being written by another shell is indexed later
+    while (line < end && (newline = memchr(line, '\n', end - line))) {
+        if (vec_history_index_push_back(offsets, line - text) == FAIL)
+            return FAIL;
+        line = newline + 1;
+    }
+    indexed_size = line - text;
+    return SUCCESS;
+}
+
+static void reset_index()
+{
+    vec_history_index_clear(offsets);
+    vec_history_index_clear(sorted);
+    indexed_size = 0;
+}
+
+static int update_sorted()
+{
+    size_t old_size = vec_size(sorted);
+    size_t size = vec_size(offsets);
+    if (size - old_size <= UNSORTED_MAX)
+        return SUCCESS;
+
+    if (vec_history_index_resize(numbers, size - old_size) == FAIL
+        || vec_history_index_resize(sorted, size) == FAIL) {
+        vec_history_index_resize(sorted, old_size);
+        return FAIL;
+    }
+    for (size_t i = old_size; i < size; ++i) {
+        vec_history_index_put(numbers, i - old_size, i);
+    }
+    qsort(vec_data(numbers), vec_size(numbers), sizeof(uint32_t), cmp_entries);
+
+    // Merges from the end, so the sorted entries are moved in place
+    size_t i = old_size;
+    size_t j = vec_size(numbers);
+    size_t k = size;
+    while (j) {
+        if (i && cmp_entries(vec_at_ptr(sorted, i - 1), vec_at_ptr(numbers, j - 1)) > 0)
+            vec_history_index_put(sorted, --k, vec_at(sorted, --i));
+        else
+            vec_history_index_put(sorted, --k, vec_at(numbers, --j));
+    }
+    return SUCCESS;
+}
+
+static const char* entry_text(size_t entry, size_t* len)
+{
+    size_t begin = vec_at(offsets, entry);
+    size_t end = entry + 1 < vec_size(offsets) ? vec_at(offsets, entry + 1) : indexed_size;
+    // Without the newline
+    *len = end - begin - 1;
+    return text + begin;
+}
+
+static size_t entry_at(size_t offset)
+{
+    uint32_t* it = binsearch(&offset, vec_begin(offsets), vec_end(offsets),
+                             sizeof(uint32_t), cmp_offset);
+    return it - vec_begin(offsets) - 1;
+}
+
+static int cmp_entries(const void* lhs, const void* rhs)
+{
+    size_t lhs_len, rhs_len;
+    const char* lhs_text = entry_text(*(const uint32_t*)lhs, &lhs_len);
+    const char* rhs_text = entry_text(*(const uint32_t*)rhs, &rhs_len);
+    int cmp = memcmp(lhs_text, rhs_text, lhs_len < rhs_len ? lhs_len : rhs_len);
+    if (cmp)
+        return cmp;
+    if (lhs_len != rhs_len)
+        return lhs_len < rhs_len ? -1 : 1;
+    return cmp_numbers(lhs, rhs);
+}
+
+static int cmp_prefix(const void* key, const void* entry)
+{
+    const struct prefix_key* prefix = (const struct prefix_key*)key;
+    size_t len;
+    const char* str = entry_text(*(const uint32_t*)entry, &len);
+    int cmp = memcmp(prefix->str, str, prefix->len < len ? prefix->len : len);
+    if (cmp)
+        return cmp;
+    // The entry is a part of the prefix
+    if (prefix->len > len)
+        return 1;
+    return prefix->tie;
+}
+
+static int cmp_offset(const void* offset, const void* entry_offset)
+{
+    return *(const size_t*)offset < *(const uint32_t*)entry_offset ? -1 : 1;
+}
+
+static int cmp_numbers(const void* lhs, const void* rhs)
+{
+    uint32_t lhs_number = *(const uint32_t*)lhs;
+    uint32_t rhs_number = *(const uint32_t*)rhs;
+    return lhs_number < rhs_number ? -1 : lhs_number > rhs_number;
+}
+
+static void find_sorted_prefix(const char* prefix, size_t len,
+                               uint32_t** begin, uint32_t** end)
+{
+    *begin = *end = vec_begin(sorted);
+    if (vec_empty(sorted))
+        return;
+
+    struct prefix_key key = {.str = prefix, .len = len, .tie = -1};
+    *begin = binsearch(&key, vec_begin(sorted), vec_end(sorted), sizeof(uint32_t), cmp_prefix);
+    key.tie = 1;
+    *end = binsearch(&key, *begin, vec_end(sorted), sizeof(uint32_t), cmp_prefix);
+}
+
+static bool has_prefix(size_t entry, const char* prefix, size_t len)
+{
+    size_t entry_len;
+    const char* str = entry_text(entry, &entry_len);
+    return entry_len >= len && memcmp(str, prefix, len) == 0;
+}
+
+static void print_entry(size_t entry)
+{
+    size_t len;
+    const char* str = entry_text(entry, &len);
+    fprintf(shell_outstream, "%*zu  %.*s\n", NUMBER_WIDTH, entry + 1, (int)len, str);
+}
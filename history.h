@@ -0,0 +1,58 @@
+#ifndef OS_LABS_RSHELL_HISTORY_H_
+#define OS_LABS_RSHELL_HISTORY_H_
+
+#include <stddef.h>
+
+// Persistent history of entered lines. Every line is appended to the file as
+// a single write with O_APPEND, so several shells may share the file, and the
+// file is never rewritten. The file is mapped and offsets of its lines are
+// indexed. Lines appended by other shells are indexed when the file grows.
+// Entries are numbered from 1 in the order of the file.
+
+struct vec_char_t;
+
+// Opens history file named by the environment variable name or
+// ~/.rshell_history if there is no such variable. Empty variable disables
+// history. Returns 0 if history is opened or disabled, -1 on error.
+int init_history(const char* name);
+
+// Unmaps and closes history file
+void release_history();
+
+// Appends line to the history. Empty lines and repetitions of the last entry
+// are skipped.
+int add_history(const char* line);
+
+// Returns number of entries
+size_t history_size();
+
+// Returns text of the entry with the number and sets *len. The text is not
+// null-terminated and is valid until the next call of history functions.
+// Returns NULL if there is no such entry.
+const char* get_history_entry(size_t number, size_t* len);
+
+// Returns number of the latest entry that starts with prefix or 0.
+size_t find_history_prefix(const char* prefix, size_t len);
+
+// Returns number of the latest entry that contains str or 0.
+size_t find_history_substring(const char* str, size_t len);
+
+// Replaces history designator at the beginning of the line with the entry:
+// !! -- the last entry, !n -- entry n, !-n -- n'th entry from the end,
+// !prefix -- the latest entry that starts with prefix, !?str? -- the latest
+// entry that contains str. The rest of the line is kept. Prints the new line
+// if the shell is interactive.
+// Returns 0 if the line was expanded or has no designator, -1 and prints
+// error if there is no such entry.
+int expand_history(struct vec_char_t* line);
+
+// Prints count last entries or all entries if count is 0
+void print_history(size_t count);
+
+// Prints all entries that start with prefix
+int print_history_prefix(const char* prefix);
+
+// Prints all entries that contain str
+int print_history_substring(const char* str);
+
+#endif // OS_LABS_RSHELL_HISTORY_H_
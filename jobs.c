@@ -3,20 +3,48 @@
 #undef VEC_SOURCE
 
 #include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include <time.h>
 
 #include "command.h"
 #include "redirection.h"
+#include "sig.h"
 #include "util/config.h"
+#include "util/line.h"
 #include "util/vec_string.h"
 
+#define FAIL            -1
+#define SUCCESS         0
 #define STATUS_INDENT   15
 #define BUFLEN          128
+// Initial capacity of the pid index, must be a power of two
+#define PID_INDEX_MIN   64
+#define EMPTY_PID       0
+#define TIMES_NAME_WIDTH    16
+#define NSEC_PER_SEC    1e9
+#define USEC_PER_SEC    1e6
+
+// Entry of the pid index. Indices are used because jobs and pipelines may be
+// reallocated.
+struct pid_entry {
+    pid_t pid;
+    vec_size_t job;
+    vec_size_t cmd;
+};
+
+// Open addressing hash table with linear probing
+static struct pid_entry* pid_index;
+static size_t pid_index_capacity;
+static size_t pid_index_size;
 
 static const char* job_status_msg[JOB_STATUS_COUNT] = {
     [JOB_TERMINATED]    = "Terminated",
     [JOB_RUNNING]       = "Running",
     [JOB_STOPPED]       = "Stopped",
+    [JOB_QUEUED]        = "Queued",
     [JOB_EXITED]        = "Exit",
     [JOB_DONE]          = "Done",
     [JOB_KILLED]        = "Killed",
@@ -28,20 +56,50 @@ static void print_str(char** str);
 // Prints redirection if format "fd> file_name"
 static void print_redirection(int fd, struct redirection* redirection, void* arg);
 
+// Prints extra targets of outputs
+static void print_fanout(const struct command* cmd);
+
 // Returns wide range of possible statuses for function that prints status
 static int get_job_status_internal(const struct job* job);
 
+// Adds resources of a command to the total ones of its job. The job lasts
+// from the earliest start until the latest end.
+static void add_cmd_usage(struct command_usage* total, const struct command_usage* usage);
+
+// Prints header of the table of used resources
+static void print_times_header();
+
+// Prints one row of the table of used resources
+static void print_times(const char* name, const struct command_usage* usage);
+
+// Returns home position of pid in the pid index
+static size_t hash_pid(pid_t pid);
+
+// Returns position of pid in the pid index or of the empty entry where it must
+// be placed
+static size_t find_pid_entry(pid_t pid);
+
+// Reallocates pid index with the new capacity and puts all entries again
+static int rehash_pid_index(size_t capacity);
+
 void release_job(struct job* job)
 {
     if (!job)
         return;
+
+    // Only jobs from jobs are indexed
+    if (jobs && job->pipeline && job >= vec_begin(jobs) && job < vec_end(jobs)) {
+        for (vec_size_t i = 0; i < vec_size(job->pipeline); ++i) {
+            remove_job_pid(vec_at(job->pipeline, i).pid, job - vec_begin(jobs), i);
+        }
+    }
     
     vec_command_foreach(job->pipeline, release_cmd);
     vec_command_delete(job->pipeline);
     if (job->line) {
-        sp_string_release(job->line);
-        if (sp_string_empty(job->line))
-            sp_string_delete(job->line);
+        sp_line_release(job->line);
+        if (sp_line_empty(job->line))
+            sp_line_delete(job->line);
     }
 
     *job = (struct job){.pgid = 0, 
@@ -51,7 +109,8 @@ void release_job(struct job* job)
                         .state = JOB_INVALID,
                         .tcattr = prev_attr,
                         .notify_status = false,
-                        .forced_running = false};
+                        .forced_running = false,
+                        .queued = false};
 }
 
 void clear_job(struct job* job)
@@ -66,31 +125,156 @@ void clear_job(struct job* job)
                         .state = JOB_INVALID,
                         .tcattr = prev_attr,
                         .notify_status = false,
-                        .forced_running = false};
+                        .forced_running = false,
+                        .queued = false};
 }
 
-struct job* find_job(pid_t pid, struct vec_job_t* jobs)
+int add_job_pid(pid_t pid, vec_size_t job, vec_size_t cmd)
 {
-    if (!jobs)
-        return NULL;
-    for (vec_size_t i = 0; i < vec_size(jobs); ++i) {
-        struct job* job = vec_at_ptr(jobs, i);
-        if (find_cmd(pid, job))
-            return job;
+    _shell_assert(pid != EMPTY_PID);
+
+    // Keeps at least half of the entries empty so probes stay short
+    if ((pid_index_size + 1) * 2 > pid_index_capacity
+        && rehash_pid_index(pid_index_capacity ? pid_index_capacity * 2 : PID_INDEX_MIN) == FAIL) {
+        return FAIL;
     }
-    return NULL;
+
+    struct pid_entry* entry = pid_index + find_pid_entry(pid);
+    if (entry->pid == EMPTY_PID)
+        ++pid_index_size;
+    *entry = (struct pid_entry){.pid = pid, .job = job, .cmd = cmd};
+    return SUCCESS;
 }
 
-struct command* find_cmd(pid_t pid, struct job* job)
+void remove_job_pid(pid_t pid, vec_size_t job, vec_size_t cmd)
 {
-    if (!job || job->state == JOB_INVALID)
+    if (!pid_index || pid == EMPTY_PID)
+        return;
+
+    size_t pos = find_pid_entry(pid);
+    // The pid may be reused by a newer command
+    if (pid_index[pos].pid != pid || pid_index[pos].job != job || pid_index[pos].cmd != cmd)
+        return;
+    pid_index[pos].pid = EMPTY_PID;
+    --pid_index_size;
+
+    // Moves back the following entries that can't be found after the hole,
+    // i.e. whose home position is not in (pos, next]
+    size_t mask = pid_index_capacity - 1;
+    for (size_t next = (pos + 1) & mask; pid_index[next].pid != EMPTY_PID; next = (next + 1) & mask) {
+        size_t home = hash_pid(pid_index[next].pid);
+        bool reachable = pos < next ? (home > pos && home <= next)
+                                    : (home > pos || home <= next);
+        if (!reachable) {
+            pid_index[pos] = pid_index[next];
+            pid_index[next].pid = EMPTY_PID;
+            pos = next;
+        }
+    }
+}
+
+struct command* find_job_cmd(pid_t pid, struct job** job)
+{
+    if (!pid_index || !jobs || pid == EMPTY_PID)
+        return NULL;
+
+    struct pid_entry entry = pid_index[find_pid_entry(pid)];
+    if (entry.pid != pid || entry.job >= vec_size(jobs))
+        return NULL;
+
+    struct job* found = vec_at_ptr(jobs, entry.job);
+    if (found->state == JOB_INVALID || entry.cmd >= vec_size(found->pipeline))
+        return NULL;
+
+    struct command* cmd = vec_at_ptr(found->pipeline, entry.cmd);
+    if (cmd->pid != pid)
         return NULL;
-    for (vec_size_t j = 0; j < vec_size(job->pipeline); ++j) {
-        struct command* cmd = vec_at_ptr(job->pipeline, j);
-        if (cmd->pid == pid)
-            return cmd;
+    if (job)
+        *job = found;
+    return cmd;
+}
+
+void set_job_pid_status(pid_t pid, int status, const struct rusage* rusage)
+{
+    int cld_code = transform_status(status);
+    // Checks that status represents interesting state to us
+    if (cld_code == FAIL)
+        return;
+
+    struct job* job = NULL;
+    struct command* cmd = find_job_cmd(pid, &job);
+    if (!cmd)
+        return;
+
+    int job_status = get_job_status(job);
+    // It's important to update cmd's status after status of job was asked
+    cmd->status = cld_code;
+
+    switch (cld_code) {
+    case CLD_CONTINUED:
+        return;
+    case CLD_STOPPED:
+        if (job_status != JOB_STOPPED)
+            job->notify_status = true; 
+        break;
+    default: 
+        if (job_status != JOB_TERMINATED)
+            job->notify_status = true; 
+        if (cmd->flags.timed) {
+            clock_gettime(CLOCK_MONOTONIC, &cmd->usage.end);
+            if (rusage)
+                cmd->usage.rusage = *rusage;
+        }
+        break;
     }
-    return NULL;
+    job->forced_running = false;
+    if (job->pid == pid)
+        job->status = status;
+}
+
+void release_job_pids()
+{
+    free(pid_index);
+    pid_index = NULL;
+    pid_index_capacity = 0;
+    pid_index_size = 0;
+}
+
+static size_t hash_pid(pid_t pid)
+{
+    // Odd multiplier keeps sequential pids in different positions
+    return ((uint32_t)pid * UINT32_C(2654435769)) & (pid_index_capacity - 1);
+}
+
+static size_t find_pid_entry(pid_t pid)
+{
+    _shell_assert(pid_index);
+
+    size_t mask = pid_index_capacity - 1;
+    size_t pos = hash_pid(pid);
+    while (pid_index[pos].pid != EMPTY_PID && pid_index[pos].pid != pid) {
+        pos = (pos + 1) & mask;
+    }
+    return pos;
+}
+
+static int rehash_pid_index(size_t capacity)
+{
+    struct pid_entry* old_index = pid_index;
+    size_t old_capacity = pid_index_capacity;
+
+    struct pid_entry* new_index = (struct pid_entry*)calloc(capacity, sizeof(struct pid_entry));
+    if (!new_index)
+        return FAIL;
+
+    pid_index = new_index;
+    pid_index_capacity = capacity;
+    for (size_t i = 0; i < old_capacity; ++i) {
+        if (old_index[i].pid != EMPTY_PID)
+            pid_index[find_pid_entry(old_index[i].pid)] = old_index[i];
+    }
+    free(old_index);
+    return SUCCESS;
 }
 
 static int get_job_status_internal(const struct job* job)
@@ -100,6 +284,9 @@ static int get_job_status_internal(const struct job* job)
     if (job->state != JOB_VALID)
         return JOB_NOT_PRESENTED;
 
+    if (job->queued)
+        return JOB_QUEUED;
+
     if (job->forced_running) 
         return JOB_RUNNING;
 
@@ -144,6 +331,7 @@ int get_job_status(const struct job* job)
     switch (status) {
     case JOB_STOPPED:
     case JOB_RUNNING:
+    case JOB_QUEUED:
         return status;
     case JOB_NOT_PRESENTED:
         return JOB_NOT_PRESENTED;
@@ -152,6 +340,14 @@ int get_job_status(const struct job* job)
     }
 }
 
+const char* get_job_status_msg(const struct job* job)
+{
+    _shell_assert(job);
+
+    int status = get_job_status_internal(job);
+    return status == JOB_NOT_PRESENTED ? NULL : job_status_msg[status];
+}
+
 static void print_str(char** str)
 {
     if (*str) 
@@ -162,13 +358,22 @@ static void print_redirection(int fd, struct redirection* redirection, void* arg
 {
     (void) arg;
     int flags = redirection->flags;
+    const char* mode = (flags & O_APPEND) ? ">>" : (flags & O_WRONLY) ? ">" : "<";
+    if (redirection->type == REDIRECTION_MEMORY)
+        mode = redirection->here_string ? "<<<" : "<<";
     fprintf(shell_outstream, "%d%s %s ", 
             fd, // redirected fd
-            (flags & O_APPEND) ? ">>" : (flags & O_WRONLY) ? ">" : "<", // mode
+            mode, // mode
             redirection->file_name // file name
     );
 }
 
+static void print_fanout(const struct command* cmd)
+{
+    for (size_t i = 0; cmd->fanout && i < vec_size(cmd->fanout); ++i)
+        print_redirection(vec_at(cmd->fanout, i).fd, vec_at_ptr(cmd->fanout, i), NULL);
+}
+
 void print_job(const struct job* job)
 {
     if (!job || job->state != JOB_VALID)
@@ -179,14 +384,16 @@ void print_job(const struct job* job)
     for (vec_size_t i = 0; i < vec_size(job->pipeline) - 1; ++i) {
         struct command* cmd = vec_at_ptr(job->pipeline, i);
         vec_string_foreach(cmd->args, print_str);
-        fm_redirection_foreach(cmd->redirections, print_redirection, NULL);
+        fm_redirection_foreach(&cmd->redirections, print_redirection, NULL);
+        print_fanout(cmd);
         fprintf(shell_outstream, "| ");
     }
     struct command* cmd = vec_at_ptr(job->pipeline, vec_size(job->pipeline) - 1);
     vec_string_foreach(cmd->args, print_str);
-    fm_redirection_foreach(cmd->redirections, print_redirection, NULL);
+    fm_redirection_foreach(&cmd->redirections, print_redirection, NULL);
+    print_fanout(cmd);
 
-    if (job_state == JOB_RUNNING)
+    if (job_state == JOB_RUNNING || job_state == JOB_QUEUED)
         fprintf(shell_outstream, "& ");
 }
 
@@ -206,3 +413,74 @@ void print_job_with_status(const struct job* job)
     fprintf(shell_outstream, "%-*s ", STATUS_INDENT, buff);
     print_job(job);
 }
+
+void print_job_times(const struct job* job)
+{
+    if (!job || job->state != JOB_VALID || !vec_front(job->pipeline).flags.timed)
+        return;
+
+    struct command_usage total = {.start = vec_front(job->pipeline).usage.start,
+                                  .end = vec_front(job->pipeline).usage.end};
+    print_times_header();
+    for (vec_size_t i = 0; i < vec_size(job->pipeline); ++i) {
+        struct command* cmd = vec_at_ptr(job->pipeline, i);
+        add_cmd_usage(&total, &cmd->usage);
+        // A single command is the whole job
+        if (vec_size(job->pipeline) > 1) {
+            char name[BUFLEN];
+            snprintf(name, BUFLEN, "%zu %s", (size_t)i + 1, vec_front(cmd->args));
+            print_times(name, &cmd->usage);
+        }
+    }
+    print_times("total", &total);
+    fflush(shell_outstream);
+}
+
+void print_cmd_times(const struct command* cmd)
+{
+    if (!cmd)
+        return;
+
+    print_times_header();
+    print_times("total", &cmd->usage);
+    fflush(shell_outstream);
+}
+
+static void add_cmd_usage(struct command_usage* total, const struct command_usage* usage)
+{
+    if (usage->start.tv_sec < total->start.tv_sec 
+        || (usage->start.tv_sec == total->start.tv_sec 
+            && usage->start.tv_nsec < total->start.tv_nsec)) {
+        total->start = usage->start;
+    }
+    if (usage->end.tv_sec > total->end.tv_sec 
+        || (usage->end.tv_sec == total->end.tv_sec 
+            && usage->end.tv_nsec > total->end.tv_nsec)) {
+        total->end = usage->end;
+    }
+    timeradd(&total->rusage.ru_utime, &usage->rusage.ru_utime, &total->rusage.ru_utime);
+    timeradd(&total->rusage.ru_stime, &usage->rusage.ru_stime, &total->rusage.ru_stime);
+    // Processes of a pipeline run at the same time, but each has its own peak
+    if (usage->rusage.ru_maxrss > total->rusage.ru_maxrss)
+        total->rusage.ru_maxrss = usage->rusage.ru_maxrss;
+    total->rusage.ru_nvcsw += usage->rusage.ru_nvcsw;
+    total->rusage.ru_nivcsw += usage->rusage.ru_nivcsw;
+}
+
+static void print_times_header()
+{
+    fprintf(shell_outstream, "%-*s %10s %10s %10s %10s %8s %8s\n", 
+            TIMES_NAME_WIDTH, "", "real", "user", "sys", "maxrss", "vcsw", "ivcsw");
+}
+
+static void print_times(const char* name, const struct command_usage* usage)
+{
+    double real = (usage->end.tv_sec - usage->start.tv_sec)
+                  + (usage->end.tv_nsec - usage->start.tv_nsec) / NSEC_PER_SEC;
+    const struct rusage* rusage = &usage->rusage;
+    fprintf(shell_outstream, "%-*.*s %9.3fs %9.3fs %9.3fs %8ldkB %8ld %8ld\n", 
+            TIMES_NAME_WIDTH, TIMES_NAME_WIDTH, name, real,
+            rusage->ru_utime.tv_sec + rusage->ru_utime.tv_usec / USEC_PER_SEC,
+            rusage->ru_stime.tv_sec + rusage->ru_stime.tv_usec / USEC_PER_SEC,
+            rusage->ru_maxrss, rusage->ru_nvcsw, rusage->ru_nivcsw);
+}
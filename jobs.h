@@ -2,10 +2,12 @@
 #define OS_LABS_RSHELL_JOBS_H_
 
 #include <stdbool.h>
+#include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <termios.h>
 
+struct command;
 struct vec_command_t;
 
 // Structure that desribes job in the shell.
@@ -19,7 +21,7 @@ struct job {
     // Pipeline of one or more commands
     struct vec_command_t* pipeline;
     // Shared ptr for the line
-    struct sp_string_t* line;
+    struct sp_line_t* line;
     // Job state
     int state;
     // Terminal attributes
@@ -29,6 +31,8 @@ struct job {
         // True iff the status has changed since last check and must be printed
         bool notify_status : 1;
         bool forced_running : 1;
+        // Background job over the limits, its commands are not started yet
+        bool queued : 1;
     };
 };
 
@@ -45,6 +49,7 @@ enum JOB_STATUS {
     JOB_TERMINATED,
     JOB_RUNNING,
     JOB_STOPPED,
+    JOB_QUEUED,
     // Job is not yet finished so status makes no sense. 
     JOB_NOT_PRESENTED,
     // These jobs may not be returnd by get_job_status():
@@ -67,21 +72,45 @@ void release_job(struct job* job);
 // Similar to release_job(), but assumes all resources as garbage
 void clear_job(struct job* job);
 
-// Searches for a job that have cmd with the passed pid and returns pointer to it. 
-// If there is no such, returns NULL.
-struct job* find_job(pid_t pid, struct vec_job_t* jobs);
+// Remembers that the process with pid is the cmd'th command of the job'th job
+// in jobs. The previous entry of the same pid is replaced.
+int add_job_pid(pid_t pid, vec_size_t job, vec_size_t cmd);
 
-// Searches for a command in any of the job from jobs. Returns pointer to is
-// if there is one, otherwise returns NULL.
-struct command* find_cmd(pid_t pid, struct job* job);
+// Forgets the process with pid if it's still the cmd'th command of the job'th
+// job.
+void remove_job_pid(pid_t pid, vec_size_t job, vec_size_t cmd);
+
+// Searches for a command with the passed pid in jobs in O(1). Returns pointer
+// to it and sets *job if there is one, otherwise returns NULL.
+struct command* find_job_cmd(pid_t pid, struct job** job);
+
+// Sets status from wait4(2) to the command with pid and marks its job to be
+// printed if the job's status changes. Timed commands that have finished keep
+// rusage. Does nothing if there is no such pid.
+void set_job_pid_status(pid_t pid, int status, const struct rusage* rusage);
+
+// Frees memory of the pid index
+void release_job_pids();
 
 // Returns job status
 int get_job_status(const struct job* job);
 
+// Returns name of the job's status like "Done" or "Stopped" or NULL if the
+// job is not valid
+const char* get_job_status_msg(const struct job* job);
+
 // Prints status, all arguments and all redirections
 void print_job(const struct job* job);
 
 // Same as print_job(), but before printing cmd prints its status
 void print_job_with_status(const struct job* job);
 
+// Prints real, user and system time, maximum resident set size and context
+// switches of every command of a timed pipeline and of the whole job. Does
+// nothing if the job is not timed.
+void print_job_times(const struct job* job);
+
+// Prints resources used by a single timed command
+void print_cmd_times(const struct command* cmd);
+
 #endif // OS_LABS_RSHELL_JOBS_H_
@@ -2,5 +2,5 @@
 
 int main(int argc, char** argv)
 {
-    start_shell(argc, argv);
+    return start_shell(argc, argv);
 }
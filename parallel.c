@@ -0,0 +1,336 @@
+#define _GNU_SOURCE
+#include "parallel.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "command.h"
+#include "events.h"
+#include "execute_cmd.h"
+#include "jobs.h"
+#include "redirection.h"
+#include "util/config.h"
+#include "util/vec_string.h"
+
+#define FAIL        -1
+#define SUCCESS     0
+#define INVALID_FD  -1
+// Input is read by blocks of this size
+#define READ_BLOCK  4096
+#define NULL_FILE   "/dev/null"
+
+// Place of one running job
+struct slot {
+    // Number of the job in jobs or 0 if the slot is free
+    size_t jobno;
+    // Memory files for standard output and error of the job
+    int out_fd;
+    int err_fd;
+    // Line of the input, the last argument of the job points to it
+    struct vec_char_t* arg;
+};
+
+#define VEC_SOURCE
+#define vec_name    slot
+#define vec_elem_t  struct slot
+#include "util/vector.h"
+#undef VEC_SOURCE
+
+// Lines of the standard input
+struct input {
+    struct vec_char_t* buffer;
+    // Position of the first unread line in buffer
+    size_t begin;
+    bool eof;
+};
+
+// Adds a free slot with its files
+static int add_slot(struct vec_slot_t* slots);
+
+// Closes files of the slot and frees its argument
+static void release_slot(struct slot* slot);
+
+// Reads the next non-empty line without '\n' to arg.
+// Returns 1 if the line is read, 0 at the end of input and -1 on error.
+static int read_arg(struct input* input, struct vec_char_t* arg);
+
+// Starts the program with args and the slot's argument as a new job
+static int start_slot_job(struct slot* slot, const char* path, char* const* args,
+                          int null_fd);
+
+// Prints output of the finished job and releases it. Returns its status.
+static int finish_slot_job(struct slot* slot);
+
+// Writes everything from the memory file to fd and empties the file
+static void flush_output(int file, int fd);
+
+int run_parallel(size_t max_jobs, const char* path, char* const* args)
+{
+    _shell_assert(max_jobs);
+    _shell_assert(path);
+    _shell_assert(args && *args);
+
+    int retval = FAIL;
+    struct vec_slot_t* slots = vec_slot_new();
+    struct input input = {.buffer = vec_char_new(), .begin = 0, .eof = false};
+    int null_fd = open(NULL_FILE, O_RDONLY | O_CLOEXEC);
+    if (!slots || !input.buffer || vec_char_reserve(input.buffer, READ_BLOCK) == FAIL
+        || null_fd == FAIL) {
+        _shell_pperror("parallel");
+        goto RELEASE_RESOURCES;
+    }
+    // The forked shell can't wait with the event loop of its parent
+    if (internal_executing) {
+        release_events();
+        if (init_events(INVALID_FD) == FAIL)
+            goto RELEASE_RESOURCES;
+    }
+
+    size_t started = 0;
+    size_t running = 0;
+    size_t failed = 0;
+    bool error = false;
+    // No more jobs are started
+    bool stop = false;
+    while (true) {
+        for (size_t i = 0; !stop && running < max_jobs; ++i) {
+            if (i < vec_size(slots) && vec_at(slots, i).jobno)
+                continue;
+            // Without files for a new slot jobs go on in the existing ones
+            if (i == vec_size(slots) && add_slot(slots) == FAIL) {
+                _shell_pperror("parallel");
+                max_jobs = vec_size(slots);
+                if (!max_jobs)
+                    error = stop = true;
+                break;
+            }
+
+            struct slot* slot = vec_at_ptr(slots, i);
+            int has_arg = read_arg(&input, slot->arg);
+            if (has_arg == FAIL)
+                _shell_pperror("parallel: input");
+            if (has_arg == FAIL || (has_arg && start_slot_job(slot, path, args, null_fd) == FAIL))
+                error = true;
+            if (has_arg != 1 || error) {
+                stop = true;
+                break;
+            }
+            ++started;
+            ++running;
+        }
+        if (!running)
+            break;
+
+        // Slots are checked after every reaping, so the freed ones are refilled
+        // at once
+        if (wait_events(false, EVENTS_NO_TIMEOUT) == FAIL && errno != EINTR) {
+            _shell_pperror("parallel: wait for child");
+            error = true;
+            break;
+        }
+        for (size_t i = 0; i < vec_size(slots); ++i) {
+            struct slot* slot = vec_at_ptr(slots, i);
+            if (!slot->jobno)
+                continue;
+            struct job* job = vec_at_ptr(jobs, slot->jobno - 1);
+            int job_status = get_job_status(job);
+            // Jobs can't be stopped as a part of the builtin
+            if (job_status == JOB_STOPPED) {
+                kill(job->pid, SIGCONT);
+                vec_front(job->pipeline).status = CLD_CONTINUED;
+            }
+            if (job_status != JOB_TERMINATED)
+                continue;
+
+            int status = finish_slot_job(slot);
+            --running;
+            if (!WIFEXITED(status) || WEXITSTATUS(status))
+                ++failed;
+            // Ctrl+c interrupts the whole builtin
+            if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+                stop = true;
+        }
+    }
+
+    if (failed)
+        _shell_flush_fprintf("parallel: %zu of %zu jobs failed\n", failed, started);
+    retval = failed || error ? FAIL : SUCCESS;
+
+RELEASE_RESOURCES:
+    if (slots)
+        vec_slot_foreach(slots, release_slot);
+    vec_slot_delete(slots);
+    vec_char_delete(input.buffer);
+    if (null_fd != FAIL)
+        close(null_fd);
+    return retval;
+}
+
+static int add_slot(struct vec_slot_t* slots)
+{
+    _shell_assert(slots);
+
+    struct slot slot = {.jobno = 0,
+                        .out_fd = memfd_create("parallel_out", MFD_CLOEXEC),
+                        .err_fd = memfd_create("parallel_err", MFD_CLOEXEC),
+                        .arg = vec_char_new()};
+    if (slot.out_fd == FAIL || slot.err_fd == FAIL || !slot.arg
+        || vec_slot_push_back(slots, slot) == FAIL) {
+        release_slot(&slot);
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+static void release_slot(struct slot* slot)
+{
+    _shell_assert(slot);
+
+    if (slot->out_fd != FAIL)
+        close(slot->out_fd);
+    if (slot->err_fd != FAIL)
+        close(slot->err_fd);
+    vec_char_delete(slot->arg);
+}
+
+static int read_arg(struct input* input, struct vec_char_t* arg)
+{
+    _shell_assert(input);
+    _shell_assert(arg);
+
+    while (true) {
+        char* begin = vec_data(input->buffer) + input->begin;
+        size_t size = vec_size(input->buffer) - input->begin;
+        char* end = (char*)memchr(begin, '\n', size);
+        // The last line may have no '\n'
+        if (end || (input->eof && size)) {
+            size_t len = end ? (size_t)(end - begin) : size;
+            input->begin += end ? len + 1 : len;
+            if (!len)
+                continue;
+            if (vec_char_resize(arg, len + 1) == FAIL)
+                return FAIL;
+            memcpy(vec_data(arg), begin, len);
+            vec_at(arg, len) = '\0';
+            return 1;
+        }
+        if (input->eof)
+            return 0;
+
+        // Lines are read only when they are needed, so jobs start before the
+        // whole input is written
+        memmove(vec_data(input->buffer), begin, size);
+        input->begin = 0;
+        if (vec_char_resize(input->buffer, size + READ_BLOCK) == FAIL)
+            return FAIL;
+        ssize_t count = read(STDIN_FILENO, vec_data(input->buffer) + size, READ_BLOCK);
+        if (count == FAIL && errno != EINTR)
+            return FAIL;
+        input->eof = count == 0;
+        vec_char_resize(input->buffer, size + (count > 0 ? count : 0));
+    }
+}
+
+static int start_slot_job(struct slot* slot, const char* path, char* const* args,
+                          int null_fd)
+{
+    _shell_assert(slot);
+
+    int retval = FAIL;
+    // Arguments are not in the arena of the line, so they are freed with the
+    // job
+    struct command cmd = {0};
+    reset_cmd(&cmd, NULL);
+    if (!cmd.args) {
+        _shell_pperror("parallel");
+        goto ERROR_HANDLER;
+    }
+    for (char* const* arg = args; *arg; ++arg) {
+        if (vec_string_push_back(cmd.args, *arg) == FAIL) {
+            _shell_pperror("parallel");
+            goto ERROR_HANDLER;
+        }
+    }
+    if (vec_string_push_back(cmd.args, vec_data(slot->arg)) == FAIL
+        || vec_string_push_back(cmd.args, NULL) == FAIL) {
+        _shell_pperror("parallel");
+        goto ERROR_HANDLER;
+    }
+
+    const int fds[][2] = {{STDIN_FILENO, null_fd},
+                          {STDOUT_FILENO, slot->out_fd},
+                          {STDERR_FILENO, slot->err_fd}};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(*fds); ++i) {
+        struct redirection redirection = {.type = REDIRECTION_FD,
+                                          .fd = fds[i][0],
+                                          .file_fd = fds[i][1],
+                                          .opened_fd = FAIL};
+        if (!fm_redirection_insert(&cmd.redirections, redirection.fd, redirection)) {
+            _shell_pperror("parallel");
+            goto ERROR_HANDLER;
+        }
+    }
+
+    // Errors of starting are already printed
+    if ((slot->jobno = start_shell_pgrp_job(&cmd, path)))
+        retval = SUCCESS;
+
+ERROR_HANDLER:
+    // Does nothing if cmd was moved to the job
+    release_cmd(&cmd);
+    return retval;
+}
+
+static int finish_slot_job(struct slot* slot)
+{
+    _shell_assert(slot);
+    _shell_assert(slot->jobno);
+
+    struct job* job = vec_at_ptr(jobs, slot->jobno - 1);
+    int status = job->status;
+    release_job(job);
+    slot->jobno = 0;
+
+    flush_output(slot->out_fd, STDOUT_FILENO);
+    fflush(shell_outstream);
+    flush_output(slot->err_fd, STDERR_FILENO);
+    return status;
+}
+
+static void flush_output(int file, int fd)
+{
+    struct stat st;
+    if (fstat(file, &st) == FAIL || !st.st_size)
+        return;
+
+    char* data = (char*)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (data == MAP_FAILED) {
+        _shell_pperror("parallel");
+        return;
+    }
+    for (off_t written = 0; written < st.st_size; ) {
+        ssize_t count = write(fd, data + written, st.st_size - written);
+        if (count == FAIL && errno == EINTR)
+            continue;
+        if (count == FAIL) {
+            _shell_pperror("parallel");
+            break;
+        }
+        written += count;
+    }
+    munmap(data, st.st_size);
+
+    // The file is shared with the next job of the slot
+    if (ftruncate(file, 0) == FAIL || lseek(file, 0, SEEK_SET) == FAIL)
+        _shell_pperror("parallel");
+}
@@ -0,0 +1,16 @@
+#ifndef OS_LABS_RSHELL_PARALLEL_H_
+#define OS_LABS_RSHELL_PARALLEL_H_
+
+#include <stddef.h>
+
+// Runs the program with the path once for every non-empty line of the standard
+// input, the line is passed after args. args are NULL-terminated, args[0] is
+// the program's name. At most max_jobs jobs run at once, the next one is
+// started as soon as any of them is reaped. Jobs read /dev/null, their output
+// is kept in memory and printed when the job is finished, so outputs of
+// different jobs do not interleave. No new jobs are started after a job is
+// killed with SIGINT.
+// Returns 0 if every job exited with status 0, -1 otherwise.
+int run_parallel(size_t max_jobs, const char* path, char* const* args);
+
+#endif // OS_LABS_RSHELL_PARALLEL_H_
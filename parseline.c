@@ -4,12 +4,15 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/resource.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "affinity.h"
 #include "command.h"
+#include "pipes.h"
 #include "redirection.h"
 #include "util/config.h"
 #include "util/pperror.h"
@@ -20,6 +23,12 @@
 #define DELIMETERS      "|&<>; \f\n\r\t\v"
 #define FILE_OPEN_MODE  0664
 #define NUM_BASE        10
+#define TIME_KEYWORD    "time"
+#define CPUS_KEYWORD    "cpus"
+#define PIPESIZE_KEYWORD    "pipesize"
+
+// Reads lines of heredocs or NULL
+static int (*heredoc_reader)(struct vec_char_t* line);
 
 enum REDIRECTION_INSERT_STRATEGY {
     REDIRECTION_INSERT_FIRST,
@@ -30,23 +39,42 @@ enum REDIRECTION_INSERT_STRATEGY {
 // to the end of line character.
 static char* replace_whitespaces(char* str, char c);
 
-// Tries to open file with passed flags.
-// Does not print any errors.
-static int try_open_file(const char* file_name, int flags);
+// Returns the limit of file descriptors. It's requested only once.
+static rlim_t get_fd_limit();
 
-// Adds redirection to the cmd.
+// Adds redirection to the cmd. Outputs of the already redirected descriptor
+// are added to its fanout allocated in the arena.
 // If any error met, prints it.
 static int add_redirection(struct command* cmd, struct redirection* redirection,
-                           enum REDIRECTION_INSERT_STRATEGY strategy);
+                           enum REDIRECTION_INSERT_STRATEGY strategy, 
+                           struct arena* arena);
+
+// Parses the heredoc (<<) or the here-string (<<<) after the '<' symbols and
+// moves *s after its word. Lines of the heredoc are read until the one equal
+// to the delimiter.
+static int parse_memory_redirection(struct command* cmd, char** s, int fd, 
+                                    bool here_string, struct arena* arena);
+
+// Writes lines of the heredoc to its memfd until the delimiter
+static int read_heredoc(const struct redirection* redirection);
 
 // Resets cmd and if there was pipe to output, sets pipe for input.
-static void reset_cmd_and_pipes(struct command* cmd);
+static void reset_cmd_and_pipes(struct command* cmd, struct arena* arena);
+
+// Returns true iff the token at s is the word
+static bool is_token(const char* s, const char* word);
+
+// Parses the list of CPUs after cpus keyword at *s and moves *s after it
+static int parse_cpus(struct command* cmd, char** s, struct arena* arena);
+
+// Parses the size after pipesize keyword at *s and moves *s after it
+static int parse_pipesize(struct command* cmd, char** s);
 
 // *s remains unchanged
 // If the last argument is a valid number, pops it back and returns number.
 static int get_fd(const struct command* cmd, char* s);
 
-int parse_line(char* line, struct vec_command_t* commands)
+int parse_line(char* line, struct vec_command_t* commands, struct arena* arena)
 {
     _shell_assert(line);
     _shell_assert(commands);
@@ -64,7 +92,7 @@ int parse_line(char* line, struct vec_command_t* commands)
     bool argument_just_pushed = false;
 
     struct command cmd = {0};
-    reset_cmd(&cmd);
+    reset_cmd(&cmd, arena);
 
     // s may become NULL after strpbrk() call because there is no delimeters 
     // after token
@@ -84,7 +112,7 @@ int parse_line(char* line, struct vec_command_t* commands)
         // The next value of argument_just_pushed
         bool argument_pushed = false;
         // Buffer for redirection
-        struct redirection* redirection = NULL;
+        struct redirection redirection;
         switch (*s) {
         // Redirects input or both input and output
         case '<':
@@ -93,6 +121,16 @@ int parse_line(char* line, struct vec_command_t* commands)
             if (argument_just_pushed)
                 fd = get_fd(&cmd, s);
             *s++ = '\0';
+            // Processes << and <<< cases
+            if (*s == '<') {
+                *s++ = '\0';
+                bool here_string = *s == '<';
+                if (here_string)
+                    *s++ = '\0';
+                if (parse_memory_redirection(&cmd, &s, fd, here_string, arena) == FAIL)
+                    goto ERROR_HANDLER;
+                break;
+            }
             // Process <> case
             // TODO: make it valid in redirection section
             bool rwfile = false;
@@ -117,19 +155,14 @@ int parse_line(char* line, struct vec_command_t* commands)
                 *s = '\0';
             }
 
-            // Checks that file is valid. Checking is hapenning for every file
-            // even if there is no need in that.
+            // Files are opened right before the command is executed
             // TODO: support <>
             open_flags = O_RDONLY;
-            if (try_open_file(file_name, open_flags) == FAIL) {
-                _shell_pperror(file_name);
-                goto ERROR_HANDLER;
-            }
             // Input file is only the first one met.
-            redirection = make_redirection(fd == FAIL ? STDIN_FILENO : fd, 
-                                           file_name, open_flags, FILE_OPEN_MODE);
-            if (add_redirection(&cmd, redirection, REDIRECTION_INSERT_FIRST) == FAIL) {
-                free_redirection(redirection);
+            redirection = make_redirection(fd == FAIL ? STDIN_FILENO : fd, file_name, 
+                                           open_flags, FILE_OPEN_MODE);
+            if (add_redirection(&cmd, &redirection, REDIRECTION_INSERT_FIRST, arena) == FAIL) {
+                free_redirection(&redirection);
                 goto ERROR_HANDLER;
             }
             // TODO: do something if it's <> case
@@ -169,14 +202,10 @@ int parse_line(char* line, struct vec_command_t* commands)
                 *s = '\0';
             }
             open_flags = O_CREAT | O_WRONLY | (append ? O_APPEND : O_TRUNC);
-            if (try_open_file(file_name, open_flags) == FAIL) {
-                _shell_pperror(file_name);
-                goto ERROR_HANDLER;
-            }
-            redirection = make_redirection(fd == FAIL ? STDOUT_FILENO : fd, 
-                                           file_name, open_flags, FILE_OPEN_MODE);
-            if (add_redirection(&cmd, redirection, REDIRECTION_INSERT_LAST) == FAIL) {
-                free_redirection(redirection);
+            redirection = make_redirection(fd == FAIL ? STDOUT_FILENO : fd, file_name, 
+                                           open_flags, FILE_OPEN_MODE);
+            if (add_redirection(&cmd, &redirection, REDIRECTION_INSERT_LAST, arena) == FAIL) {
+                free_redirection(&redirection);
                 goto ERROR_HANDLER;
             }
             if (s)
@@ -200,7 +229,7 @@ int parse_line(char* line, struct vec_command_t* commands)
                 cmd.flags.pipe_out = true;
             }
             push_cmd(&cmd, commands);
-            reset_cmd_and_pipes(&cmd);
+            reset_cmd_and_pipes(&cmd, arena);
             break;
         case ';':
             *s++ = '\0';
@@ -210,7 +239,7 @@ int parse_line(char* line, struct vec_command_t* commands)
                 goto ERROR_HANDLER;
             }
             push_cmd(&cmd, commands);
-            reset_cmd_and_pipes(&cmd);
+            reset_cmd_and_pipes(&cmd, arena);
             break;
         case '&':
             *s++ = '\0';
@@ -225,11 +254,36 @@ int parse_line(char* line, struct vec_command_t* commands)
             }
             else {
                 cmd.flags.bkgrnd = true;
+                // The whole pipeline is in the background, so its first 
+                // command knows whether the job may be started
+                for (size_t i = vec_size(commands); i > 0 
+                     && vec_at(commands, i - 1).flags.pipe_out; --i) {
+                    vec_at_ptr(commands, i - 1)->flags.bkgrnd = true;
+                }
             }
             push_cmd(&cmd, commands);
-            reset_cmd_and_pipes(&cmd);
+            reset_cmd_and_pipes(&cmd, arena);
             break;
         default:
+            // time is a keyword only before the first command of a pipeline
+            if (vec_empty(cmd.args) && !cmd.flags.pipe_in && !cmd.flags.timed
+                && is_token(s, TIME_KEYWORD)) {
+                cmd.flags.timed = true;
+                s += strlen(TIME_KEYWORD);
+                break;
+            }
+            // cpus is a keyword before every command of a pipeline
+            if (vec_empty(cmd.args) && is_token(s, CPUS_KEYWORD)) {
+                if (parse_cpus(&cmd, &s, arena) == FAIL)
+                    goto ERROR_HANDLER;
+                break;
+            }
+            // So is pipesize
+            if (vec_empty(cmd.args) && is_token(s, PIPESIZE_KEYWORD)) {
+                if (parse_pipesize(&cmd, &s) == FAIL)
+                    goto ERROR_HANDLER;
+                break;
+            }
             // default case is some token -- program or it's argument
             argument_pushed = true;
             vec_string_push_back(cmd.args, s);
@@ -252,6 +306,11 @@ ERROR_HANDLER:
     return FAIL;
 }
 
+void set_heredoc_reader(int (*reader)(struct vec_char_t* line))
+{
+    heredoc_reader = reader;
+}
+
 static char* replace_whitespaces(char* str, char c)
 {
     _shell_assert(str);
@@ -264,34 +323,33 @@ static char* replace_whitespaces(char* str, char c)
     return str;
 }
 
-static int try_open_file(const char* file_name, int flags)
+static rlim_t get_fd_limit()
 {
-    _shell_assert(file_name);
+    static rlim_t fd_limit = 0;
 
-    int fd = open(file_name, flags, FILE_OPEN_MODE);
-    if (fd == FAIL) {
-        return FAIL;
+    if (!fd_limit) {
+        struct rlimit rl = {0};
+        if (getrlimit(RLIMIT_NOFILE, &rl) == FAIL)
+            return 0;
+        fd_limit = rl.rlim_cur;
     }
-    // File will be opened later, right now there is no need to keep
-    // files open.
-    close(fd);
-
-    return SUCCESS;
+    return fd_limit;
 }
 
 static int add_redirection(struct command* cmd, struct redirection* redirection,
-                           enum REDIRECTION_INSERT_STRATEGY strategy)
+                           enum REDIRECTION_INSERT_STRATEGY strategy, 
+                           struct arena* arena)
 {
     _shell_assert(cmd);
     _shell_assert(redirection);
 
     // Checks that fd is valid
-    struct rlimit rl = {0};
-    if (getrlimit(RLIMIT_NOFILE, &rl) == FAIL) {
+    rlim_t fd_limit = get_fd_limit();
+    if (!fd_limit) {
         perror(SHELL);
         return FAIL;
     }
-    if (redirection->fd >= rl.rlim_cur) {
+    if ((rlim_t)redirection->fd >= fd_limit) {
         errno = EBADF;
         _shell_pperrorf("%d", redirection->fd);
         return FAIL;
@@ -302,28 +360,192 @@ static int add_redirection(struct command* cmd, struct redirection* redirection,
     // TODO: print error if it was inserted previously in writing mode
     // TODO: name strategy as READ/WRITE
     if (strategy == REDIRECTION_INSERT_FIRST && 
-        fm_redirection_find(cmd->redirections, redirection->fd, NULL)) {
+        fm_redirection_find(&cmd->redirections, redirection->fd, NULL)) {
+        free_redirection(redirection);
+        return SUCCESS;
+    }
+    // Output goes to every file it's redirected to
+    struct redirection first;
+    if (strategy == REDIRECTION_INSERT_LAST 
+        && fm_redirection_find(&cmd->redirections, redirection->fd, &first)
+        && first.type == REDIRECTION_FILE_NAME && (first.flags & O_WRONLY)) {
+        if ((!cmd->fanout && !(cmd->fanout = vec_redirection_new_in(arena)))
+            || vec_redirection_push_back(cmd->fanout, *redirection) == FAIL) {
+            perror(SHELL);
+            return FAIL;
+        }
         return SUCCESS;
     }
     
     // TODO: print error if it was inserted previously with incompatible
     // strategy (READ and WRITE simultaneously)
-    if (!fm_redirection_insert(cmd->redirections, redirection->fd, redirection)) {
+    if (!fm_redirection_insert(&cmd->redirections, redirection->fd, *redirection)) {
         perror(SHELL);
         return FAIL;
     }
     return SUCCESS;
 }
 
-static void reset_cmd_and_pipes(struct command* cmd)
+static int parse_memory_redirection(struct command* cmd, char** s, int fd, 
+                                    bool here_string, struct arena* arena)
 {
     _shell_assert(cmd);
+    _shell_assert(s && *s);
 
-    bool pipe_out = cmd->flags.pipe_out;
-    reset_cmd(cmd);
+    char* word = replace_whitespaces(*s, '\0');
+    if (!*word || strchr(DELIMETERS, *word)) {
+        _shell_flush_fputs("syntax error: Unspecified redirection\n");
+        return FAIL;
+    }
+    // The delimiter after the word is put back and replaced with '\0' later
+    *s = strpbrk(word, DELIMETERS);
+    char buff = *s ? **s : '\0';
+    if (*s)
+        **s = '\0';
+
+    int retval = SUCCESS;
+    struct redirection redirection = make_memory_redirection(fd == FAIL ? STDIN_FILENO : fd,
+                                                             word, here_string);
+    if (redirection.opened_fd == FAIL) {
+        _shell_pperror(word);
+        retval = FAIL;
+        goto RELEASE_RESOURCES;
+    }
+    // The heredoc is read even if the input is already redirected, so its 
+    // lines are not executed
+    if (here_string) {
+        size_t len = strlen(word);
+        word[len] = '\n';
+        retval = write_memory_redirection(&redirection, word, len + 1);
+        word[len] = '\0';
+    }
+    else {
+        retval = read_heredoc(&redirection);
+    }
+    if (retval == FAIL || seal_memory_redirection(&redirection) == FAIL) {
+        // The heredoc is interrupted by SIGINT quietly like the prompt
+        if (errno != EINTR)
+            _shell_pperror(word);
+        retval = FAIL;
+        goto RELEASE_RESOURCES;
+    }
+    retval = add_redirection(cmd, &redirection, REDIRECTION_INSERT_FIRST, arena);
+
+RELEASE_RESOURCES:
+    if (retval == FAIL)
+        free_redirection(&redirection);
+    if (*s)
+        **s = buff;
+    return retval;
+}
+
+static int read_heredoc(const struct redirection* redirection)
+{
+    _shell_assert(redirection);
 
-    if (pipe_out)
+    if (!heredoc_reader)
+        return SUCCESS;
+
+    struct vec_char_t* line = vec_char_new();
+    if (!line)
+        return FAIL;
+
+    int retval = SUCCESS;
+    int readval;
+    // The end of input ends the heredoc too
+    while ((readval = heredoc_reader(line)) == SUCCESS
+           && strcmp(vec_data(line), redirection->file_name) != 0) {
+        // The line is written with its newline in place of the '\0'
+        vec_char_put(line, vec_size(line) - 1, '\n');
+        if (write_memory_redirection(redirection, vec_data(line), vec_size(line)) == FAIL) {
+            retval = FAIL;
+            break;
+        }
+    }
+    if (readval == FAIL)
+        retval = FAIL;
+
+    vec_char_delete(line);
+    return retval;
+}
+
+static void reset_cmd_and_pipes(struct command* cmd, struct arena* arena)
+{
+    _shell_assert(cmd);
+
+    bool pipe_out = cmd->flags.pipe_out;
+    bool timed = cmd->flags.timed;
+    const struct cpu_list* cpus = cmd->cpus;
+    size_t pipe_size = cmd->pipe_size;
+    reset_cmd(cmd, arena);
+
+    // Every command of a timed pipeline is timed. CPUs and the pipe size are
+    // the same until another stage sets its own.
+    if (pipe_out) {
         cmd->flags.pipe_in = true;
+        cmd->flags.timed = timed;
+        cmd->cpus = cpus;
+        cmd->pipe_size = pipe_size;
+    }
+}
+
+static bool is_token(const char* s, const char* word)
+{
+    _shell_assert(s);
+    _shell_assert(word);
+
+    size_t len = strlen(word);
+    return strncmp(s, word, len) == 0 && (!s[len] || strchr(DELIMETERS, s[len]));
+}
+
+static int parse_cpus(struct command* cmd, char** s, struct arena* arena)
+{
+    _shell_assert(cmd);
+    _shell_assert(s && *s);
+
+    char* list = replace_whitespaces(*s + strlen(CPUS_KEYWORD), '\0');
+    if (!*list || strchr(DELIMETERS, *list)) {
+        _shell_flush_fputs("syntax error: No CPU list after cpus\n");
+        return FAIL;
+    }
+    // The list is terminated only for the time of parsing
+    *s = strpbrk(list, DELIMETERS);
+    char buff = *s ? **s : '\0';
+    if (*s)
+        **s = '\0';
+    struct cpu_list* cpus = parse_cpu_list(list, arena);
+    if (!cpus && errno == EINVAL)
+        _shell_flush_fprintf("syntax error: Invalid CPU list '%s'\n", list);
+    else if (!cpus)
+        _shell_pperror(CPUS_KEYWORD);
+    if (*s)
+        **s = buff;
+
+    cmd->cpus = cpus;
+    return cpus ? SUCCESS : FAIL;
+}
+
+static int parse_pipesize(struct command* cmd, char** s)
+{
+    _shell_assert(cmd);
+    _shell_assert(s && *s);
+
+    char* size = replace_whitespaces(*s + strlen(PIPESIZE_KEYWORD), '\0');
+    if (!*size || strchr(DELIMETERS, *size)) {
+        _shell_flush_fputs("syntax error: No size after pipesize\n");
+        return FAIL;
+    }
+    // The size is terminated only for the time of parsing
+    *s = strpbrk(size, DELIMETERS);
+    char buff = *s ? **s : '\0';
+    if (*s)
+        **s = '\0';
+    int retval = parse_pipe_size(size, &cmd->pipe_size);
+    if (retval == FAIL)
+        _shell_flush_fprintf("syntax error: Invalid pipe size '%s'\n", size);
+    if (*s)
+        **s = buff;
+    return retval;
 }
 
 static int get_fd(const struct command* cmd, char* s)
@@ -3,12 +3,19 @@
 
 #include <stddef.h>
 
+struct arena;
+struct vec_char_t;
 struct vec_command_t; 
 
 // Returns 0 on success or -1 on error and prints error to stderr.
 // If line is empty, returns 0.
 // Line may be edited and must live as long as commands.
 // Command's args will be NULL-terminated according to exec(3) format.
-int parse_line(char* line, struct vec_command_t* commands);
+// Args and redirections of the commands are allocated in the arena.
+int parse_line(char* line, struct vec_command_t* commands, struct arena* arena);
+
+// Sets the function that reads lines of heredocs while the line is parsed,
+// like prompt_raw_line(). Heredocs are empty without it.
+void set_heredoc_reader(int (*reader)(struct vec_char_t* line));
 
 #endif // OS_LABS_RSHELL_PARSELINE_H_
@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+#include "pipes.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "command.h"
+#include "events.h"
+#include "jobs.h"
+#include "util/config.h"
+#include "util/trace.h"
+
+#define FAIL            -1
+#define SUCCESS         0
+#define NUMBASE         10
+#define AUTO_MODE       "auto"
+#define KB              1024
+#define MAX_SIZE_FILE   "/proc/sys/fs/pipe-max-size"
+// The same as the kernel's default
+#define DEFAULT_MAX_SIZE    (1024 * 1024)
+#define PROC_FD_LEN     64
+// Pipes are sampled once in this period
+#define SAMPLE_MS       100
+// The pipe is grown after it's full in this number of samples in a row
+#define FULL_SAMPLES    3
+#define MS_IN_SEC       1000
+#define NS_IN_MS        1000000
+
+// Capacity of pipes or 0 for the kernel's default
+static size_t shell_pipe_size;
+// Pipes are grown when they are full
+static bool adaptive;
+// Time of the last sample
+static struct timespec last_sample;
+
+// Returns the maximal size of pipes. It's requested only once.
+static size_t get_max_size();
+
+// Returns true iff the pipe after the command of the job is grown in the
+// automatic mode
+static bool is_adaptive_pipe(const struct job* job, size_t i);
+
+// Samples the pipe between the writer and the reader and grows it if it's
+// full long enough
+static void sample_pipe(struct command* writer, const struct command* reader);
+
+// Returns milliseconds since the last sample
+static long get_ms_since_sample();
+
+int init_pipe_size(const char* name)
+{
+    _shell_assert(name);
+
+    const char* value = getenv(name);
+    if (!value || !*value)
+        return SUCCESS;
+    if (strcmp(value, AUTO_MODE) == 0) {
+        adaptive = true;
+        return SUCCESS;
+    }
+    if (parse_pipe_size(value, &shell_pipe_size) == FAIL) {
+        _shell_flush_fprintf("%s: invalid value '%s'\n", name, value);
+        return FAIL;
+    }
+    return SUCCESS;
+}
+
+int parse_pipe_size(const char* str, size_t* size)
+{
+    _shell_assert(str);
+    _shell_assert(size);
+
+    if (!isdigit(*str))
+        return FAIL;
+    char* end;
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, NUMBASE);
+    size_t unit = 1;
+    if (*end == 'K' || *end == 'k')
+        unit = KB;
+    else if (*end == 'M' || *end == 'm')
+        unit = KB * KB;
+    if (unit != 1)
+        ++end;
+    if (*end || errno || !value || value > SIZE_MAX / unit)
+        return FAIL;
+    *size = value * unit;
+    return SUCCESS;
+}
+
+int make_pipe(int fds[2], size_t size)
+{
+    if (pipe(fds) == FAIL)
+        return FAIL;
+
+    if (!size)
+        size = shell_pipe_size;
+    if (size) {
+        size_t max_size = get_max_size();
+        fcntl(fds[1], F_SETPIPE_SZ, (int)(size < max_size ? size : max_size));
+    }
+    return SUCCESS;
+}
+
+int get_pipe_sample_timeout(const struct job* job)
+{
+    _shell_assert(job);
+
+    if (!adaptive)
+        return EVENTS_NO_TIMEOUT;
+    for (size_t i = 0; i < vec_size(job->pipeline); ++i) {
+        if (!is_adaptive_pipe(job, i))
+            continue;
+        long elapsed = get_ms_since_sample();
+        return elapsed < SAMPLE_MS ? SAMPLE_MS - elapsed : 0;
+    }
+    return EVENTS_NO_TIMEOUT;
+}
+
+void sample_pipes(struct job* job)
+{
+    _shell_assert(job);
+
+    // Samples are counted only if they are far enough from each other
+    if (!adaptive || get_ms_since_sample() < SAMPLE_MS)
+        return;
+    clock_gettime(CLOCK_MONOTONIC, &last_sample);
+
+    for (size_t i = 0; i < vec_size(job->pipeline); ++i) {
+        if (is_adaptive_pipe(job, i))
+            sample_pipe(vec_at_ptr(job->pipeline, i), vec_at_ptr(job->pipeline, i + 1));
+    }
+}
+
+static size_t get_max_size()
+{
+    static size_t max_size = 0;
+    if (max_size)
+        return max_size;
+
+    max_size = DEFAULT_MAX_SIZE;
+    FILE* file = fopen(MAX_SIZE_FILE, "re");
+    if (!file)
+        return max_size;
+    size_t value;
+    if (fscanf(file, "%zu", &value) == 1 && value && value <= INT_MAX)
+        max_size = value;
+    fclose(file);
+    return max_size;
+}
+
+static bool is_adaptive_pipe(const struct job* job, size_t i)
+{
+    _shell_assert(job);
+
+    // Pipes with the size of the pipeline are not changed
+    const struct command* writer = vec_at_ptr(job->pipeline, i);
+    if (!writer->flags.pipe_out || writer->pipe_size || i + 1 == vec_size(job->pipeline))
+        return false;
+    const struct command* reader = vec_at_ptr(job->pipeline, i + 1);
+    return writer->pid > 0 && writer->status == CLD_CONTINUED
+           && reader->pid > 0 && reader->status == CLD_CONTINUED;
+}
+
+static void sample_pipe(struct command* writer, const struct command* reader)
+{
+    _shell_assert(writer);
+    _shell_assert(reader);
+
+    // The shell has closed its ends of the pipe, so it's opened again through
+    // /proc. Redirected commands may not use the pipe, so the writer's output
+    // must be the reader's input.
+    char path[PROC_FD_LEN];
+    snprintf(path, sizeof(path), "/proc/%d/fd/%d", (int)reader->pid, STDIN_FILENO);
+    struct stat reader_st;
+    if (stat(path, &reader_st) == FAIL || !S_ISFIFO(reader_st.st_mode))
+        return;
+    snprintf(path, sizeof(path), "/proc/%d/fd/%d", (int)writer->pid, STDOUT_FILENO);
+    int fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd == FAIL)
+        return;
+    struct stat writer_st;
+    if (fstat(fd, &writer_st) == FAIL || writer_st.st_dev != reader_st.st_dev
+        || writer_st.st_ino != reader_st.st_ino) {
+        close(fd);
+        return;
+    }
+
+    // The last page may be partly filled, so the pipe is full if less than
+    // one atomic write fits
+    int capacity = fcntl(fd, F_GETPIPE_SZ);
+    int count;
+    if (capacity == FAIL || ioctl(fd, FIONREAD, &count) == FAIL) {
+        close(fd);
+        return;
+    }
+    if (count + PIPE_BUF < capacity) {
+        writer->full_samples = 0;
+    }
+    else if (++writer->full_samples >= FULL_SAMPLES && (size_t)capacity < get_max_size()) {
+        size_t size = (size_t)capacity * 2;
+        if (size > get_max_size())
+            size = get_max_size();
+        int new_capacity = fcntl(fd, F_SETPIPE_SZ, (int)size);
+        if (new_capacity != FAIL)
+            trace_instant("pipe_grow", "size", new_capacity);
+        writer->full_samples = 0;
+    }
+    close(fd);
+}
+
+static long get_ms_since_sample()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - last_sample.tv_sec) * MS_IN_SEC
+           + (now.tv_nsec - last_sample.tv_nsec) / NS_IN_MS;
+}
@@ -0,0 +1,35 @@
+#ifndef OS_LABS_RSHELL_PIPES_H_
+#define OS_LABS_RSHELL_PIPES_H_
+
+#include <stddef.h>
+
+// Capacity of pipes between commands of pipelines. Sizes are written in
+// bytes with an optional K or M suffix: "256K". The kernel rounds them up to
+// a power of two pages and doesn't allow more than /proc/sys/fs/pipe-max-size,
+// bigger sizes are cut to it. In the automatic mode pipes start with the
+// default size and the pipe that is full in several samples in a row is
+// doubled. Only pipes of the foreground job are sampled.
+
+struct job;
+
+// Reads the size or "auto" from the environment variable name.
+// Returns 0 if it's set or not given, -1 if the value is invalid.
+int init_pipe_size(const char* name);
+
+// Parses the size. Returns -1 if it's invalid.
+int parse_pipe_size(const char* str, size_t* size);
+
+// Creates the pipe like pipe(2) and sets its capacity. 0 is the size of the
+// shell. Errors of setting the capacity are ignored, the pipe just keeps the
+// default one.
+int make_pipe(int fds[2], size_t size);
+
+// Returns milliseconds until the next sample of the job's pipes or -1 if
+// they are not sampled
+int get_pipe_sample_timeout(const struct job* job);
+
+// Grows pipes of the job that are full too long. Does nothing if it's too
+// early for the next sample.
+void sample_pipes(struct job* job);
+
+#endif // OS_LABS_RSHELL_PIPES_H_
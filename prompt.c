@@ -1,6 +1,8 @@
 #include "prompt.h"
 
 #include <pwd.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
@@ -19,44 +21,78 @@
 
 #define FAIL                    -1
 #define SUCCESS                 0
+#define USERNAME_MAXLEN         256
 #define HOSTNAME_MAXLEN         256
 #define CWD_MAXLEN              1024
+#define PROMPT_MAXLEN           (USERNAME_MAXLEN + HOSTNAME_MAXLEN + CWD_MAXLEN + 8)
 
-void print_pretty_prompt()
+// Parts of the prompt
+static uid_t uid;
+static char username[USERNAME_MAXLEN];
+static char home[CWD_MAXLEN];
+static char hostname[HOSTNAME_MAXLEN];
+static char cwd[CWD_MAXLEN];
+// False if the user or the host is unknown
+static bool identity_valid;
+// False if the current directory is unknown
+static bool cwd_valid;
+// Prompt built from the parts above
+static char prompt[PROMPT_MAXLEN];
+// True iff any part has changed since the prompt was built
+static bool prompt_outdated = true;
+
+// Builds prompt from its parts
+static void build_prompt();
+
+void init_prompt()
 {
-    uid_t uid = getuid();
+    uid = getuid();
     struct passwd* passwd = getpwuid(uid);
-    if (!passwd)
-        goto ERROR;
-    char hostname[HOSTNAME_MAXLEN];
-    if (gethostname(hostname, HOSTNAME_MAXLEN) == FAIL)
-        goto ERROR;
-    char cwd[CWD_MAXLEN];
-    if (getcwd(cwd, CWD_MAXLEN) == NULL)
-        goto ERROR;
-    
-    char* home = passwd->pw_dir;
-    if (home) {
-        size_t homelen = strlen(home);
-        if (!homelen || homelen >= CWD_MAXLEN)
-            goto BREAK;
-        char tmp = cwd[homelen];
-        cwd[homelen] = '\0';
-        if (strcmp(home, cwd) == 0) {
-            cwd[0] = HOME_SYMBOL;
-            cwd[homelen] = tmp;
-            memmove(cwd + 1, cwd + homelen, strlen(cwd + homelen) + 1);
-        }
-        else {
-            cwd[homelen] = tmp;
-        }
+    identity_valid = passwd && passwd->pw_name 
+                     && strlen(passwd->pw_name) < USERNAME_MAXLEN
+                     && gethostname(hostname, HOSTNAME_MAXLEN) != FAIL;
+    if (identity_valid) {
+        strcpy(username, passwd->pw_name);
+        // Home that does not fit is never a prefix of cwd
+        if (passwd->pw_dir && strlen(passwd->pw_dir) < CWD_MAXLEN)
+            strcpy(home, passwd->pw_dir);
+        else
+            home[0] = '\0';
+    }
+    update_prompt_cwd();
+}
+
+void update_prompt_cwd()
+{
+    cwd_valid = getcwd(cwd, CWD_MAXLEN) != NULL;
+    prompt_outdated = true;
+}
+
+void print_pretty_prompt()
+{
+    if (prompt_outdated) {
+        build_prompt();
+        prompt_outdated = false;
     }
-BREAK:
-
-    fprintf(shell_outstream, "%s%s%s%s%s%s ", passwd->pw_name, USER_HOST_DELIMETER,
-            hostname, HOST_PATH_DELIMETER, cwd, uid ? USER_PROMPT_END : ROOT_PROMPT_END);
-    return;
-    
-ERROR:
-    fprintf(shell_outstream, "%s ", uid ? USER_SIMPLE_PROMPT : ROOT_SIMPLE_PROMPT);
+    fputs(prompt, shell_outstream);
+}
+
+static void build_prompt()
+{
+    if (!identity_valid || !cwd_valid) {
+        snprintf(prompt, PROMPT_MAXLEN, "%s ", uid ? USER_SIMPLE_PROMPT : ROOT_SIMPLE_PROMPT);
+        return;
+    }
+
+    // Replaces home at the beginning of cwd with HOME_SYMBOL
+    char path[CWD_MAXLEN];
+    strcpy(path, cwd);
+    size_t homelen = strlen(home);
+    if (homelen && strncmp(home, path, homelen) == 0) {
+        path[0] = HOME_SYMBOL;
+        memmove(path + 1, path + homelen, strlen(path + homelen) + 1);
+    }
+
+    snprintf(prompt, PROMPT_MAXLEN, "%s%s%s%s%s%s ", username, USER_HOST_DELIMETER,
+             hostname, HOST_PATH_DELIMETER, path, uid ? USER_PROMPT_END : ROOT_PROMPT_END);
 }
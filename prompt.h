@@ -1,9 +1,17 @@
 #ifndef OS_LABS_RSHELL_PROMPTE_H_
 #define OS_LABS_RSHELL_PROMPTE_H_
 
+// Remembers user, hostname and current working directory for the prompt, so 
+// they are not asked every time.
+void init_prompt();
+
+// Remembers new current working directory. Must be called after it changes.
+void update_prompt_cwd();
+
 // Prints pretty prompt if it can:
 // username@hostname:path[$, #]
 // Otherwise prints just rshell [$, #]
+// The prompt is rebuilt only if its parts were changed.
 void print_pretty_prompt();
 
 #endif // OS_LABS_RSHELL_PROMPTE_H_
@@ -6,10 +6,13 @@
 #include <unistd.h>
 #include <signal.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
+#include "events.h"
+#include "execute_cmd.h"
 #include "prompt.h"
 #include "sig.h"
 #include "util/config.h"
@@ -22,17 +25,42 @@
 #define WHITESPACES     " \f\n\r\t\v"
 #define CMD_DELIMETERS  "&|;"
 #define COMMENT_SYMBOLS "#"
+#define INVALID_FD      -1
+
+// Buffered shell input. Bytes that were read after the newline are kept for 
+// the next line instead of being lost.
+static struct {
+    // Source of lines or INVALID_FD if lines are read from the string
+    int fd;
+    // True iff fd is shared with children and may be rewound to the first 
+    // unused byte, so they will read the input from the right place.
+    bool seekable;
+    // True iff fd is shared with children but can't be rewound, e.g. it is a
+    // pipe. It is read byte by byte like sh(1) does, so no byte after the
+    // newline is taken from children.
+    bool bytewise;
+    // Unused bytes are [pos, len)
+    const char* data;
+    size_t pos;
+    size_t len;
+    char buf[DEFAULT_IOLEN];
+} input = {.fd = STDIN_FILENO};
 
 // Prints prompt to out stream.
 // Return 0 os success and -1 on fail.
 static void print_prompt(const char* prompt);
 
-// Reads whole line from in fd until newline symbol.
+// Reads whole line from the input until newline symbol.
 // Appends read string to vector.
 // Newline symbol will be replaced with null symbol so the line will be 
 // well-formatted.
-// Returns -1 on error and 0 on success.
-static int read_until_newline(int in, struct vec_char_t* line);
+// Returns -1 on error, PROMPT_EOF on the end of input and 0 on success.
+static int read_until_newline(struct vec_char_t* line);
+
+// Reads next chunk of input to the buffer. Must be called only when all bytes
+// of the buffer were used.
+// Returns -1 on error, PROMPT_EOF on the end of input and 0 on success.
+static int fill_input();
 
 // Returns true iff the str has pipe symbol ('|') at the end, maybe followed
 // by whitespaces.
@@ -63,12 +91,16 @@ int prompt_line(struct vec_char_t* line)
 {
     _shell_assert(line);
 
-    // Clears line
+    // Clears line. Usual line fits without reallocations.
     vec_char_clear(line);
+    if (vec_char_reserve(line, DEFAULT_IOLEN) == FAIL) {
+        _shell_pperror("Failed to resize prompt");
+        return FAIL;
+    }
 
     struct sigaction nact = {.sa_handler = print_newline, .sa_flags = 0};
     struct sigaction oact;
-    if (sigaction(SIGINT, &nact, &oact) == FAIL) {
+    if (shell_interactive && sigaction(SIGINT, &nact, &oact) == FAIL) {
         _shell_pperror("failed to set signals for prompt");
         return FAIL;
     }
@@ -93,7 +125,7 @@ int prompt_line(struct vec_char_t* line)
         // could easily understand that it's the shell input, not some program's
         prompt = DEFAULT_PROMPT;
 
-        int readval = read_until_newline(STDIN_FILENO, line);
+        int readval = read_until_newline(line);
         if (readval != SUCCESS) {
             retval = readval;
             goto RESET_SIGNALS;
@@ -118,22 +150,70 @@ int prompt_line(struct vec_char_t* line)
     }
 
 RESET_SIGNALS:
-    if (sigaction(SIGINT, &oact, NULL) == FAIL) {
+    if (shell_interactive && sigaction(SIGINT, &oact, NULL) == FAIL) {
         _shell_pperror("failed to reset signals after prompt");
     }
 
     return retval;
 }
 
+int prompt_raw_line(struct vec_char_t* line)
+{
+    _shell_assert(line);
+
+    vec_char_clear(line);
+
+    struct sigaction nact = {.sa_handler = print_newline, .sa_flags = 0};
+    struct sigaction oact;
+    if (shell_interactive && sigaction(SIGINT, &nact, &oact) == FAIL) {
+        _shell_pperror("failed to set signals for prompt");
+        return FAIL;
+    }
+
+    print_prompt(DEFAULT_PROMPT);
+    int retval = read_until_newline(line);
+
+    if (shell_interactive && sigaction(SIGINT, &oact, NULL) == FAIL) {
+        _shell_pperror("failed to reset signals after prompt");
+    }
+    return retval;
+}
+
+void set_prompt_input_fd(int fd)
+{
+    input.fd = fd;
+    input.seekable = fd == STDIN_FILENO && lseek(fd, 0, SEEK_CUR) != FAIL;
+    // A terminal returns one line per read(2) anyway
+    input.bytewise = fd == STDIN_FILENO && !input.seekable && isatty(fd) != 1;
+    input.data = NULL;
+    input.pos = 0;
+    input.len = 0;
+}
+
+void set_prompt_input_string(const char* str)
+{
+    _shell_assert(str);
+
+    input.fd = INVALID_FD;
+    input.seekable = false;
+    input.bytewise = false;
+    input.data = str;
+    input.pos = 0;
+    input.len = strlen(str);
+}
+
 static void print_prompt(const char* prompt)
 {
+    // Nobody will see it
+    if (!shell_interactive)
+        return;
     if (!prompt)
         print_pretty_prompt();
     else
         fprintf(shell_outstream, "%s ", prompt);
 }
 
-static int read_until_newline(int in, struct vec_char_t* line)
+static int read_until_newline(struct vec_char_t* line)
 {
     _shell_assert(line);
 
@@ -146,42 +226,98 @@ static int read_until_newline(int in, struct vec_char_t* line)
     if (readcount) {
         vec_char_put(line, readcount - 1, ' ');
     }
+    // True iff any byte of this line was read
+    bool line_started = false;
 
     while (true) {
-        if (vec_char_resize(line, readcount + DEFAULT_IOLEN) == FAIL) {
-            _shell_pperror("Failed to resize prompt");
-            return FAIL;
-        }
-
-        ssize_t readcountdiff = 0;
-        if ((readcountdiff = read(in, vec_data(line) + readcount, DEFAULT_IOLEN)) == FAIL) {
-            if (errno == EINTR) {
+        if (input.pos == input.len) {
+            int fillval = fill_input();
+            if (fillval == FAIL)
                 return FAIL;
+            // The last line of a file or a string may have no newline
+            if (fillval == PROMPT_EOF) {
+                if (!line_started)
+                    return PROMPT_EOF;
+                if (vec_char_resize(line, readcount + 1) == FAIL) {
+                    _shell_pperror("Failed to resize prompt");
+                    return FAIL;
+                }
+                vec_char_put(line, readcount, '\0');
+                return SUCCESS;
             }
-            _shell_pperror("Failed to read prompt response");
-            return FAIL;
         }
-        if (!readcountdiff) {
-            return PROMPT_EOF;
+
+        // Copies everything until newline including it or the whole buffer
+        const char* begin = input.data + input.pos;
+        const char* newline = memchr(begin, '\n', input.len - input.pos);
+        size_t count = newline ? (size_t)(newline - begin) + 1 : input.len - input.pos;
+
+        if (vec_char_resize(line, readcount + count) == FAIL) {
+            _shell_pperror("Failed to resize prompt");
+            return FAIL;
         }
+        memcpy(vec_data(line) + readcount, begin, count);
+        readcount += count;
+        input.pos += count;
+        line_started = true;
 
-        readcount += readcountdiff;
+        if (!newline)
+            continue;
+
+        // Returns unused bytes back to the file so children will read them
+        if (input.seekable && input.pos < input.len
+            && lseek(input.fd, (off_t)input.pos - (off_t)input.len, SEEK_CUR) != FAIL) {
+            input.pos = input.len;
+        }
 
         // On endline removes endline symbol(s) and places '\0' at the end to 
         // make valid c-string.
-        if (readcount && vec_at(line, readcount - 1) == '\n') {
-            if (readcount > 1 && vec_at(line, readcount - 2) == '\r') {
-                readcount--;
-            }
-            vec_char_resize(line, readcount); // shrinks unused characters
-            vec_char_put(line, readcount - 1, '\0');
-            return SUCCESS;
+        if (readcount > 1 && vec_at(line, readcount - 2) == '\r') {
+            readcount--;
         }
+        vec_char_resize(line, readcount); // shrinks unused characters
+        vec_char_put(line, readcount - 1, '\0');
+        return SUCCESS;
     }
 
     return FAIL;
 }
 
+static int fill_input()
+{
+    if (input.fd == INVALID_FD)
+        return PROMPT_EOF;
+
+    // Children are reaped and queued jobs are started while the user types,
+    // nothing is printed until the line is executed
+    if (shell_interactive) {
+        int event;
+        while ((event = wait_events(true, get_queue_timeout())) == EVENT_CHILD
+               || event == EVENT_TIMEOUT) {
+            start_queued_jobs();
+        }
+        if (event == FAIL) {
+            if (errno != EINTR)
+                _shell_pperror("Failed to wait for prompt response");
+            return FAIL;
+        }
+    }
+
+    ssize_t count = read(input.fd, input.buf, input.bytewise ? 1 : DEFAULT_IOLEN);
+    if (count == FAIL) {
+        if (errno != EINTR)
+            _shell_pperror("Failed to read prompt response");
+        return FAIL;
+    }
+    if (!count)
+        return PROMPT_EOF;
+
+    input.data = input.buf;
+    input.pos = 0;
+    input.len = count;
+    return SUCCESS;
+}
+
 static bool must_have_next_command(const char* str, size_t size)
 {
     _shell_assert(str);
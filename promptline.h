@@ -17,4 +17,17 @@ struct vec_char_t;
 // If the reading will be inerrupted by SIGINT, returns FAIL.
 int prompt_line(struct vec_char_t* line);
 
+// Prompts one more line of the input as it is, like a line of a heredoc.
+// There is no continuation, comments and syntax checks. Returns 0 on success,
+// PROMPT_EOF on the end of input or -1 on error or SIGINT.
+int prompt_raw_line(struct vec_char_t* line);
+
+// Sets file descriptor from which lines are read. STDIN_FILENO by default.
+// The fd is not closed by the shell.
+void set_prompt_input_fd(int fd);
+
+// Makes lines be read from the str instead of any file. str must live as long
+// as lines are prompted. After the whole str is read, PROMPT_EOF is returned.
+void set_prompt_input_string(const char* str);
+
 #endif // OS_LABS_RSHELL_PROMPTLINE_H_
@@ -0,0 +1,272 @@
+#define _GNU_SOURCE
+#include "qos.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "command.h"
+#include "jobs.h"
+#include "util/config.h"
+
+#define FAIL            -1
+#define SUCCESS         0
+#define NUMBASE         10
+#define NICE_ENV        "RSHELL_BG_NICE"
+#define SCHED_ENV       "RSHELL_BG_SCHED"
+#define IOPRIO_ENV      "RSHELL_BG_IOPRIO"
+#define OOM_ENV         "RSHELL_BG_OOM"
+#define BOOST_ENV       "RSHELL_BG_BOOST"
+#define NICE_MAX        19
+#define OOM_ADJ_MIN     -1000
+#define OOM_ADJ_MAX     1000
+#define OOM_FILE_LEN    64
+// The same as in linux/ioprio.h
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_CLASS_BE     2
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_BE_MAX       7
+#define IOPRIO_WHO_PROCESS  1
+#define IOPRIO_WHO_PGRP     2
+#define IOPRIO_BE_PREFIX    "be:"
+// Value of the priority that is not changed
+#define UNSET           INT_MIN
+
+// Priorities of a process
+struct priorities {
+    int nice;
+    int sched;
+    int ioprio;
+    int oom;
+};
+
+// Priorities of background jobs
+static struct priorities bg_priorities = {UNSET, UNSET, UNSET, UNSET};
+// Priorities of the shell for the values background jobs change
+static struct priorities boost_priorities = {UNSET, UNSET, UNSET, UNSET};
+// fg gives priorities of the shell back
+static bool boost;
+
+// Reads integer from min to max from the environment variable.
+// Returns UNSET if it's not set or invalid, the latter is reported.
+static int get_int_env(const char* name, int min, int max);
+
+// Reads scheduling policy from the environment or returns UNSET
+static int get_sched_env();
+
+// Reads I/O priority from the environment or returns UNSET
+static int get_ioprio_env();
+
+// Sets priorities of the process or process group who. which is PRIO_PROCESS
+// or PRIO_PGRP, only nice and I/O priority are set for process groups.
+// Processes that are already gone are skipped, so are boosts that are not
+// permitted.
+static int set_priorities(int which, pid_t who, const struct priorities* priorities,
+                          bool boosting);
+
+// Prints error of setting the priority unless the process is gone or the 
+// boost is not permitted. Returns -1 if the error was printed.
+static int report_error(const char* what, bool boosting);
+
+// Writes oom_score_adj of the process, 0 is the calling one
+static int set_oom_score_adj(pid_t pid, int value);
+
+// Reads oom_score_adj of the shell or returns UNSET
+static int get_oom_score_adj();
+
+void init_qos()
+{
+    int increment = get_int_env(NICE_ENV, 0, NICE_MAX);
+    bg_priorities.sched = get_sched_env();
+    bg_priorities.ioprio = get_ioprio_env();
+    bg_priorities.oom = get_int_env(OOM_ENV, OOM_ADJ_MIN, OOM_ADJ_MAX);
+    const char* boost_value = getenv(BOOST_ENV);
+    boost = boost_value && strcmp(boost_value, "1") == 0;
+
+    // Nice is relative to the shell's one
+    errno = 0;
+    int nice = getpriority(PRIO_PROCESS, 0);
+    if (increment != UNSET && !errno) {
+        bg_priorities.nice = nice + increment > NICE_MAX ? NICE_MAX : nice + increment;
+        boost_priorities.nice = nice;
+    }
+    // Values that can't be read are not boosted
+    int sched = sched_getscheduler(0);
+    if (bg_priorities.sched != UNSET && sched != FAIL)
+        boost_priorities.sched = sched;
+    int ioprio = syscall(SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0);
+    if (bg_priorities.ioprio != UNSET && ioprio != FAIL)
+        boost_priorities.ioprio = ioprio;
+    if (bg_priorities.oom != UNSET)
+        boost_priorities.oom = get_oom_score_adj();
+}
+
+bool has_bg_qos()
+{
+    return bg_priorities.nice != UNSET || bg_priorities.sched != UNSET
+           || bg_priorities.ioprio != UNSET || bg_priorities.oom != UNSET;
+}
+
+int apply_bg_qos()
+{
+    return set_priorities(PRIO_PROCESS, 0, &bg_priorities, false);
+}
+
+void demote_job(const struct job* job)
+{
+    _shell_assert(job);
+
+    if (!has_bg_qos())
+        return;
+    // Processes the job has started are in its group. Jobs in the shell's
+    // group must not touch the shell.
+    if (job->pgid != shell_pgrp)
+        set_priorities(PRIO_PGRP, job->pgid, &bg_priorities, false);
+    for (size_t i = 0; i < vec_size(job->pipeline); ++i) {
+        const struct command* cmd = vec_at_ptr(job->pipeline, i);
+        if (cmd->status == CLD_CONTINUED || cmd->status == CLD_STOPPED)
+            set_priorities(PRIO_PROCESS, cmd->pid, &bg_priorities, false);
+    }
+}
+
+void boost_job(const struct job* job)
+{
+    _shell_assert(job);
+
+    if (!boost || !has_bg_qos())
+        return;
+    if (job->pgid != shell_pgrp)
+        set_priorities(PRIO_PGRP, job->pgid, &boost_priorities, true);
+    for (size_t i = 0; i < vec_size(job->pipeline); ++i) {
+        const struct command* cmd = vec_at_ptr(job->pipeline, i);
+        if (cmd->status == CLD_CONTINUED || cmd->status == CLD_STOPPED)
+            set_priorities(PRIO_PROCESS, cmd->pid, &boost_priorities, true);
+    }
+}
+
+static int get_int_env(const char* name, int min, int max)
+{
+    _shell_assert(name);
+
+    const char* value = getenv(name);
+    if (!value || !*value)
+        return UNSET;
+
+    char* endptr;
+    long number = strtol(value, &endptr, NUMBASE);
+    if (*endptr || number < min || number > max) {
+        _shell_flush_fprintf("%s: invalid value '%s'\n", name, value);
+        return UNSET;
+    }
+    return number;
+}
+
+static int get_sched_env()
+{
+    const char* value = getenv(SCHED_ENV);
+    if (!value || !*value)
+        return UNSET;
+
+    if (strcmp(value, "batch") == 0)
+        return SCHED_BATCH;
+    if (strcmp(value, "idle") == 0)
+        return SCHED_IDLE;
+    if (strcmp(value, "other") == 0)
+        return SCHED_OTHER;
+    _shell_flush_fprintf("%s: invalid value '%s'\n", SCHED_ENV, value);
+    return UNSET;
+}
+
+static int get_ioprio_env()
+{
+    const char* value = getenv(IOPRIO_ENV);
+    if (!value || !*value)
+        return UNSET;
+
+    if (strcmp(value, "idle") == 0)
+        return IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT;
+    // Best effort class with the level
+    size_t prefix_len = strlen(IOPRIO_BE_PREFIX);
+    if (strncmp(value, IOPRIO_BE_PREFIX, prefix_len) == 0) {
+        const char* level = value + prefix_len;
+        if (level[0] >= '0' && level[0] <= '0' + IOPRIO_BE_MAX && !level[1])
+            return IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT | (level[0] - '0');
+    }
+    _shell_flush_fprintf("%s: invalid value '%s'\n", IOPRIO_ENV, value);
+    return UNSET;
+}
+
+static int set_priorities(int which, pid_t who, const struct priorities* priorities,
+                          bool boosting)
+{
+    _shell_assert(priorities);
+
+    // Every priority is set even if the previous one failed
+    int retval = SUCCESS;
+    if (priorities->nice != UNSET && setpriority(which, who, priorities->nice) == FAIL)
+        retval |= report_error("setpriority", boosting);
+
+    int ioprio_who = which == PRIO_PGRP ? IOPRIO_WHO_PGRP : IOPRIO_WHO_PROCESS;
+    if (priorities->ioprio != UNSET 
+        && syscall(SYS_ioprio_set, ioprio_who, who, priorities->ioprio) == FAIL) {
+        retval |= report_error("ioprio_set", boosting);
+    }
+    if (which == PRIO_PGRP)
+        return retval;
+
+    struct sched_param param = {.sched_priority = 0};
+    if (priorities->sched != UNSET 
+        && sched_setscheduler(who, priorities->sched, &param) == FAIL) {
+        retval |= report_error("sched_setscheduler", boosting);
+    }
+    if (priorities->oom != UNSET && set_oom_score_adj(who, priorities->oom) == FAIL)
+        retval |= report_error("oom_score_adj", boosting);
+    return retval;
+}
+
+static int report_error(const char* what, bool boosting)
+{
+    _shell_assert(what);
+
+    if (errno == ESRCH || (boosting && (errno == EPERM || errno == EACCES)))
+        return SUCCESS;
+    _shell_pperror(what);
+    return FAIL;
+}
+
+static int set_oom_score_adj(pid_t pid, int value)
+{
+    char name[OOM_FILE_LEN];
+    if (pid)
+        snprintf(name, sizeof(name), "/proc/%d/oom_score_adj", (int)pid);
+    else
+        snprintf(name, sizeof(name), "/proc/self/oom_score_adj");
+
+    int fd = open(name, O_WRONLY | O_CLOEXEC);
+    if (fd == FAIL)
+        return FAIL;
+    int retval = dprintf(fd, "%d", value) < 0 ? FAIL : SUCCESS;
+    close(fd);
+    return retval;
+}
+
+static int get_oom_score_adj()
+{
+    FILE* file = fopen("/proc/self/oom_score_adj", "re");
+    if (!file)
+        return UNSET;
+    int value;
+    if (fscanf(file, "%d", &value) != 1)
+        value = UNSET;
+    fclose(file);
+    return value;
+}
@@ -0,0 +1,37 @@
+#ifndef OS_LABS_RSHELL_QOS_H_
+#define OS_LABS_RSHELL_QOS_H_
+
+#include <stdbool.h>
+
+// Priorities of background jobs, so they don't slow down the foreground job
+// and the prompt. The policy is read from the environment:
+// RSHELL_BG_NICE=N       --- nice(2) increment from 0 to 19
+// RSHELL_BG_SCHED=P      --- scheduling policy: batch, idle or other
+// RSHELL_BG_IOPRIO=C     --- I/O priority: idle or be:N with level 0 to 7
+// RSHELL_BG_OOM=N        --- oom_score_adj from -1000 to 1000
+// RSHELL_BG_BOOST=1      --- fg gives the job priorities of the shell back
+// Lowering nice, leaving SCHED_IDLE and oom_score_adj usually need
+// privileges, such boosts are silently skipped.
+
+struct job;
+
+// Reads the policy and saves priorities of the shell. Invalid values are
+// reported and ignored.
+void init_qos();
+
+// Returns true iff background jobs have a policy
+bool has_bg_qos();
+
+// Applies the policy to the calling process. It's called by a forked child
+// before exec(3). Prints errors.
+int apply_bg_qos();
+
+// Applies the policy to all processes of the job that is moved to the
+// background
+void demote_job(const struct job* job);
+
+// Gives the job moved to the foreground priorities of the shell if boost is
+// enabled
+void boost_job(const struct job* job);
+
+#endif // OS_LABS_RSHELL_QOS_H_
@@ -1,8 +1,11 @@
+#define _GNU_SOURCE
 #define FM_SOURCE
 #include "redirection.h"
 #undef FM_SOURCE
 
+#include <errno.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
@@ -11,24 +14,67 @@
 
 #define FAIL    -1
 #define SUCCESS 0
+// Names of memfds, they are seen only in /proc
+#define HEREDOC_NAME        "heredoc"
+#define HERE_STRING_NAME    "here-string"
+#define MEMORY_SEALS    (F_SEAL_SEAL | F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE)
 
-struct redirection* make_redirection(int fd, const char* file_name, int flags, mode_t mode)
+struct redirection make_redirection(int fd, const char* file_name, int flags, mode_t mode)
 {
-    struct redirection* redirection = (struct redirection*)malloc(sizeof(struct redirection));
-    if (!redirection)
-        return NULL;
-    *redirection = (struct redirection) {.type = REDIRECTION_FILE_NAME,
-                                         .fd = fd,
-                                         .file_name = file_name,
-                                         .flags = flags,
-                                         .mode = mode};
+    return (struct redirection) {.type = REDIRECTION_FILE_NAME,
+                                 .fd = fd,
+                                 .file_name = file_name,
+                                 .flags = flags,
+                                 .mode = mode,
+                                 .opened_fd = FAIL};
+}
+
+struct redirection make_memory_redirection(int fd, const char* word, bool here_string)
+{
+    return (struct redirection) {.type = REDIRECTION_MEMORY,
+                                 .fd = fd,
+                                 .file_name = word,
+                                 .flags = O_RDONLY,
+                                 .opened_fd = memfd_create(here_string ? HERE_STRING_NAME : HEREDOC_NAME,
+                                                           MFD_CLOEXEC | MFD_ALLOW_SEALING),
+                                 .here_string = here_string};
+}
+
+int write_memory_redirection(const struct redirection* redirection, const char* data,
+                             size_t size)
+{
+    _shell_assert(redirection);
+    _shell_assert(redirection->type == REDIRECTION_MEMORY);
+
+    while (size) {
+        ssize_t count = write(redirection->opened_fd, data, size);
+        if (count == FAIL) {
+            if (errno == EINTR)
+                continue;
+            return FAIL;
+        }
+        data += count;
+        size -= count;
+    }
+    return SUCCESS;
+}
+
+int seal_memory_redirection(const struct redirection* redirection)
+{
+    _shell_assert(redirection);
+    _shell_assert(redirection->type == REDIRECTION_MEMORY);
 
-    return redirection;
+    if (fcntl(redirection->opened_fd, F_ADD_SEALS, MEMORY_SEALS) == FAIL
+        || lseek(redirection->opened_fd, 0, SEEK_SET) == FAIL) {
+        return FAIL;
+    }
+    return SUCCESS;
 }
 
 void free_redirection(struct redirection* self)
 {
-    free(self);
+    if (self)
+        close_redirection(self);
 }
 
 int redirect(const struct redirection* redirection)
@@ -37,12 +83,21 @@ int redirect(const struct redirection* redirection)
 
     switch (redirection->type) {
     case REDIRECTION_FILE_NAME:;
+        if (redirection->opened_fd != FAIL) {
+            if (dup2(redirection->opened_fd, redirection->fd) == FAIL)
+                return FAIL;
+            break;
+        }
         int oldfd = open(redirection->file_name, redirection->flags, redirection->mode);
         if (oldfd == FAIL || dup2(oldfd, redirection->fd) == FAIL) {
             return FAIL;
         }
         close(oldfd);
         break;
+    case REDIRECTION_MEMORY:
+        if (dup2(redirection->opened_fd, redirection->fd) == FAIL)
+            return FAIL;
+        break;
     case REDIRECTION_FD:
         if (dup2(redirection->file_fd, redirection->fd) == FAIL) {
             return FAIL;
@@ -54,3 +109,76 @@ int redirect(const struct redirection* redirection)
 
     return SUCCESS;
 }
+
+int add_spawn_redirection(posix_spawn_file_actions_t* actions, 
+                          const struct redirection* redirection)
+{
+    _shell_assert(actions);
+    _shell_assert(redirection);
+
+    switch (redirection->type) {
+    case REDIRECTION_FILE_NAME:
+        if (redirection->opened_fd != FAIL) {
+            if (posix_spawn_file_actions_adddup2(actions, redirection->opened_fd, 
+                                                 redirection->fd)) {
+                return FAIL;
+            }
+            break;
+        }
+        if (posix_spawn_file_actions_addopen(actions, redirection->fd, redirection->file_name,
+                                             redirection->flags, redirection->mode)) {
+            return FAIL;
+        }
+        break;
+    case REDIRECTION_MEMORY:
+        if (posix_spawn_file_actions_adddup2(actions, redirection->opened_fd, 
+                                             redirection->fd)) {
+            return FAIL;
+        }
+        break;
+    case REDIRECTION_FD:
+        if (posix_spawn_file_actions_adddup2(actions, redirection->file_fd, redirection->fd)) {
+            return FAIL;
+        }
+        break;
+    default:
+        return FAIL;
+    }
+
+    return SUCCESS;
+}
+
+int open_redirection(struct redirection* redirection)
+{
+    _shell_assert(redirection);
+
+    if (redirection->type != REDIRECTION_FILE_NAME || redirection->opened_fd != FAIL)
+        return SUCCESS;
+
+    redirection->opened_fd = open(redirection->file_name, 
+                                  redirection->flags | O_CLOEXEC, redirection->mode);
+    return redirection->opened_fd == FAIL ? FAIL : SUCCESS;
+}
+
+int move_redirection(struct redirection* redirection, int min_fd)
+{
+    _shell_assert(redirection);
+    _shell_assert(redirection->opened_fd != FAIL);
+
+    int fd = fcntl(redirection->opened_fd, F_DUPFD_CLOEXEC, min_fd);
+    if (fd == FAIL)
+        return FAIL;
+    close(redirection->opened_fd);
+    redirection->opened_fd = fd;
+    return SUCCESS;
+}
+
+void close_redirection(struct redirection* redirection)
+{
+    _shell_assert(redirection);
+
+    if (redirection->type == REDIRECTION_FD || redirection->opened_fd == FAIL)
+        return;
+    close(redirection->opened_fd);
+    redirection->opened_fd = FAIL;
+}
@@ -1,6 +1,9 @@
 #ifndef OS_LABS_RSHELL_REDIRECT_H_
 #define OS_LABS_RSHELL_REDIRECT_H_
 
+#include <spawn.h>
+#include <stdbool.h>
+#include <stddef.h>
 #include <sys/types.h>
 
 #include "util/utils.h"
@@ -8,6 +11,9 @@
 enum REDIRECTION_TYPE {
     REDIRECTION_FILE_NAME,
     REDIRECTION_FD,
+    // Heredoc or here-string. The text is kept in a sealed memfd, so the
+    // child only duplicates it without temporary files.
+    REDIRECTION_MEMORY,
 };
 
 struct redirection {
@@ -16,21 +22,58 @@ struct redirection {
     // File descriptor that will be set
     int fd;
     union {
+        // File name, delimiter of the heredoc or the here-string
         const char* file_name;
         int file_fd;
     };
     int flags; // flags for open
     mode_t mode; // mode for open
+    // Descriptor of the file opened by open_redirection() or the memfd
+    // of the text or -1
+    int opened_fd;
+    // True iff the text is the here-string, not the heredoc
+    bool here_string;
 };
 
-// Allocates memory for a redirection with passed parameters.
-// The returned redirection must be freed with free_redirection().
-struct redirection* make_redirection(int fd, const char* file_name, int flags, mode_t mode);
+// Returns a redirection with passed parameters. It must be released with
+// free_redirection().
+struct redirection make_redirection(int fd, const char* file_name, int flags, mode_t mode);
+
+// Returns a redirection of fd to the empty memfd named by word, the delimiter
+// of the heredoc or the here-string. Its opened_fd is -1 on error.
+// It must be released with free_redirection().
+struct redirection make_memory_redirection(int fd, const char* word, bool here_string);
+
+// Appends size bytes of data to the text of the memory redirection
+int write_memory_redirection(const struct redirection* redirection, const char* data,
+                             size_t size);
+
+// Seals the text of the memory redirection, so nobody can change it, and
+// rewinds it to the beginning
+int seal_memory_redirection(const struct redirection* redirection);
 
 // Redirects file tpecified in the redirection structure.
+// If the file is already opened, only duplicates its descriptor.
 int redirect(const struct redirection* redirection);
 
-// Frees redirection.
+// Adds the redirection to the file actions of posix_spawn(3) so it will be 
+// made in the spawned child.
+int add_spawn_redirection(posix_spawn_file_actions_t* actions, 
+                          const struct redirection* redirection);
+
+// Opens the file of the redirection with O_CLOEXEC, so the child only needs
+// to duplicate the descriptor. Does nothing for descriptor redirections and
+// already opened files. Does not print any errors.
+int open_redirection(struct redirection* redirection);
+
+// Moves the opened descriptor to the lowest free one not less than min_fd.
+int move_redirection(struct redirection* redirection, int min_fd);
+
+// Closes the file opened by open_redirection() or the memfd. Works if it's
+// not opened.
+void close_redirection(struct redirection* redirection);
+
+// Closes the opened file of the redirection.
 // Works with NULL.
 void free_redirection(struct redirection* self);
 
@@ -40,8 +83,10 @@ void free_redirection(struct redirection* self);
 #define fm_key_t        int
 #define fm_free_key     free_int
 #define fm_key_cmp      int_cmp
-#define fm_data_t       struct redirection*
+#define fm_data_t       struct redirection
 #define fm_free_data    free_redirection
+// Almost every command has at most 3 redirections
+#define fm_inline_size  3
 #include "util/flatmap.h"
 
 #undef FM_UNDEF
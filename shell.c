@@ -1,27 +1,67 @@
 #include "shell.h"
 
 #include <fcntl.h>
+#include <math.h>
 #include <signal.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <termios.h>
 
+#include "affinity.h"
+#include "builtins.h"
+#include "cmdhash.h"
 #include "command.h"
+#include "events.h"
 #include "execute_cmd.h"
+#include "history.h"
 #include "jobs.h"
 #include "parseline.h"
+#include "pipes.h"
+#include "prompt.h"
 #include "promptline.h"
+#include "qos.h"
 #include "redirection.h"
 #include "sig.h"
 #include "util/config.h"
+#include "util/line.h"
+#include "util/trace.h"
 #include "util/vec_string.h"
 
 #define FAIL        -1
 #define SUCCESS     0
+#define EXIT_USAGE  2
+// Environment variable to choose launch engine: "spawn" (default) or "fork"
+#define LAUNCH_ENV  "RSHELL_LAUNCH"
+// Environment variable with the file for the execution trace
+#define TRACE_ENV   "RSHELL_TRACE"
+// Environment variable with the history file
+#define HISTORY_ENV "RSHELL_HISTORY"
+// Environment variables with limits of running background jobs: number of
+// jobs, one-minute load average and MemAvailable in MiB
+#define BG_JOBS_ENV "RSHELL_BG_JOBS"
+#define BG_LOAD_ENV "RSHELL_BG_LOAD"
+#define BG_MEM_ENV  "RSHELL_BG_MEM"
+#define KB_IN_MB    1024
+// Environment variable that enables automatic placement of pipelines
+#define AFFINITY_ENV    "RSHELL_AFFINITY"
+// Environment variable with the size of pipes or "auto"
+#define PIPE_SIZE_ENV   "RSHELL_PIPE_SIZE"
+// Environment variable that disables fast builtins if it's "off"
+#define BUILTINS_ENV    "RSHELL_BUILTINS"
+// Jobs table keeps this capacity, bigger one is returned when it's mostly 
+// unused
+#define JOBS_KEEP_CAPACITY  16
+#define JOBS_SHRINK_RATIO   4
+
+// File descriptor of the script or STDIN_FILENO
+static int input_fd = STDIN_FILENO;
 
 // Prints all cmds to shell_outstream
 __attribute__((__unused__))
@@ -30,6 +70,15 @@ static void print_cmds(struct vec_command_t* cmds);
 // Print one redirection. This function will be passed to flatmap.
 static void print_redirection(int fd, struct redirection* redirection, void* arg);
 
+// Sets the source of commands and interactivity of the shell according to the
+// program arguments. Prints usage on error.
+static int parse_arguments(int argc, char** argv);
+
+// Moves fd to the first free descriptor not lower than SHELL_FD_MIN with 
+// FD_CLOEXEC flag. Closes fd on success.
+// Returns new descriptor or -1 on error.
+static int move_shell_fd(int fd);
+
 // Initialize shell's global variables
 static int init_shell();
 
@@ -42,52 +91,75 @@ static int reset_parsing_line();
 // Prints changes in jobs and removes jobs from the end
 static void process_jobs();
 
-void start_shell(int argc, char** argv)
+// Reads limits of background jobs from the environment
+static void init_bg_limits();
+
+// Returns non-negative value of the environment variable that is not greater 
+// than max. Returns 0 if it's not set or invalid, the latter is reported.
+static double get_limit_env(const char* name, double max);
+
+int start_shell(int argc, char** argv)
 {
-    (void)argc;
-    (void)argv;
-    if (argc > 1) {
-        _shell_flush_fputs("The program parameters are not supported.\n");
-    }
+    if (parse_arguments(argc, argv) == FAIL)
+        return EXIT_USAGE;
 
     if (init_shell() == FAIL)
-        return;
+        return EXIT_FAILURE;
 
+    // Exit status of the forked child that executed an internal command
+    int exit_status = EXIT_SUCCESS;
     struct vec_command_t* cmds = vec_command_new();
 
 START:
     while (true) {
+        // Commands of the previous line are in its arena, so they are 
+        // released before the arena is reused
+        vec_command_foreach(cmds, release_cmd);
+        vec_command_clear(cmds);
         if (reset_parsing_line() == FAIL) {
             goto RESOURCE_MANAGER;
         }
-        int promptval = prompt_line(sp_string_get(parsing_line));
+        struct line* line = sp_line_get(parsing_line);
+        int promptval = prompt_line(line->text);
         if (promptval == FAIL) {
             goto PROCESS_JOBS;
         }
-        // on EOF goes to exit
+        // On EOF goes to exit, there is nobody to warn without terminal
         else if (promptval == PROMPT_EOF) {
+            if (!shell_interactive)
+                goto RESOURCE_MANAGER;
             fprintf(shell_outstream, "\n");
             goto PRETTY_EXIT;
         }
 
-        if (parse_line(vec_data(sp_string_get(parsing_line)), cmds) == FAIL) {
+        // Only lines typed by the user are remembered
+        if (shell_interactive) {
+            if (expand_history(line->text) == FAIL)
+                goto PROCESS_JOBS;
+            add_history(vec_data(line->text));
+        }
+
+        uint64_t parse_start = trace_begin();
+        int parsed = parse_line(vec_data(line->text), cmds, line->arena);
+        trace_complete("parse_line", parse_start, "commands", vec_size(cmds));
+        if (parsed == FAIL) {
             goto PROCESS_JOBS;
         }
         _shell_log_call(print_cmds(cmds));
 
         for (size_t i = 0; i < vec_size(cmds); ++i) {
-            if (execute_cmd(vec_at_ptr(cmds, i)) == FAIL) {
+            int retval = execute_cmd(vec_at_ptr(cmds, i));
+            // Must finish correctly if it was the internal command that forked
+            if (internal_executing) {
+                exit_status = retval == FAIL ? EXIT_FAILURE : EXIT_SUCCESS;
                 goto RESOURCE_MANAGER;
             }
-            // Must finish correctly if it was the internal command that forked
-            if (internal_executing)
+            if (retval == FAIL) {
                 goto RESOURCE_MANAGER;
+            }
         }
         PROCESS_JOBS:;
-        sigset_t nvar, ovar;
-        BLOCK_CHILD(nvar, ovar);
         process_jobs();
-        UNBLOCK_CHILD(ovar);
     }
 
 PRETTY_EXIT:
@@ -97,14 +169,13 @@ PRETTY_EXIT:
 
 RESOURCE_MANAGER:;
 
-    sigset_t nvar, ovar;
-    BLOCK_CHILD(nvar, ovar);
-
     if (end_execution(false) == FAIL)
         end_execution(false);
     vec_command_foreach(cmds, release_cmd);
     vec_command_delete(cmds);
     release_shell();
+
+    return internal_executing ? exit_status : get_last_status();
 }
 
 static void print_cmds(struct vec_command_t* cmds)
@@ -125,9 +196,11 @@ static void print_cmds(struct vec_command_t* cmds)
             fprintf(shell_outstream, "pipe_out");
         if (vec_at(cmds, i).flags.skip_next_on_success) 
             fprintf(shell_outstream, "skip_next_on_success ");
+        if (vec_at(cmds, i).flags.timed) 
+            fprintf(shell_outstream, "timed ");
         fprintf(shell_outstream, "\n");
 
-        fm_redirection_foreach(vec_at(cmds, i).redirections, print_redirection, &i);
+        fm_redirection_foreach(&vec_at(cmds, i).redirections, print_redirection, &i);
     }
 }
 
@@ -139,6 +212,44 @@ static void print_redirection(int fd, struct redirection* redirection, void* arg
     fprintf(shell_outstream, "cmd[%d] redirects fd %d to \"%s\"\n", *(int*)arg, fd, redirection->file_name);
 }
 
+static int parse_arguments(int argc, char** argv)
+{
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "Usage: %s [-c string | file]\n", argv[0]);
+            return FAIL;
+        }
+        set_prompt_input_string(argv[2]);
+        shell_interactive = false;
+        return SUCCESS;
+    }
+    if (argc > 1) {
+        if (argv[1][0] == '-') {
+            fprintf(stderr, "Usage: %s [-c string | file]\n", argv[0]);
+            return FAIL;
+        }
+        // Script must not be inherited by children
+        if ((input_fd = open(argv[1], O_RDONLY | O_CLOEXEC)) == FAIL) {
+            _shell_pperror(argv[1]);
+            return FAIL;
+        }
+        set_prompt_input_fd(input_fd);
+        shell_interactive = false;
+        return SUCCESS;
+    }
+
+    set_prompt_input_fd(STDIN_FILENO);
+    shell_interactive = isatty(STDIN_FILENO) == 1;
+    return SUCCESS;
+}
+
+static int move_shell_fd(int fd)
+{
+    int newfd = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_MIN);
+    close(fd);
+    return newfd;
+}
+
 static int init_shell()
 {
     if (!(jobs = vec_job_new())) {
@@ -147,27 +258,47 @@ static int init_shell()
     shell_pgrp = getpgrp();
     shell_outfd = STDERR_FILENO;
     shell_outstream = stderr;
+    shell_tty = FAIL;
 
-    // Shell must be interactive so it opens terminal anyway
-    shell_tty = isatty(shell_outfd) == 1 ? dup(shell_outfd) : open("/dev/tty", O_RDWR|O_NONBLOCK);
-    if (shell_tty == FAIL) {
-        _shell_pperror("Failed to set tty");
+    if (init_trace(TRACE_ENV) == FAIL)
         return FAIL;
-    }
-    if (tcgetattr(shell_tty, &prev_attr) == FAIL
-        || tcgetattr(shell_tty, &shell_attr)) {
-        _shell_pperror("tcgetattr: Failed to get terminal attributes");
-        return FAIL;
-    }
-    if (pipe(waiting_pipe) == FAIL) {
-        _shell_pperror("pipe2");
-        return FAIL;
-    }
 
+    const char* engine = getenv(LAUNCH_ENV);
+    shell_launch_engine = engine && strcmp(engine, "fork") == 0 ? LAUNCH_FORK : LAUNCH_SPAWN;
+    init_bg_limits();
+    // Pipelines are placed by the scheduler if the mode is invalid
+    init_affinity(AFFINITY_ENV);
+    init_qos();
+    // Pipes keep the default size if the value is invalid
+    init_pipe_size(PIPE_SIZE_ENV);
+    init_builtins(BUILTINS_ENV);
+    // Heredocs continue the shell's input
+    set_heredoc_reader(prompt_raw_line);
+
+    // Interactive shell opens terminal anyway
+    if (shell_interactive) {
+        shell_tty = isatty(shell_outfd) == 1 ? dup(shell_outfd) : open("/dev/tty", O_RDWR|O_NONBLOCK);
+        if (shell_tty == FAIL || (shell_tty = move_shell_fd(shell_tty)) == FAIL) {
+            _shell_pperror("Failed to set tty");
+            return FAIL;
+        }
+        if (tcgetattr(shell_tty, &prev_attr) == FAIL
+            || tcgetattr(shell_tty, &shell_attr)) {
+            _shell_pperror("tcgetattr: Failed to get terminal attributes");
+            return FAIL;
+        }
+        init_prompt();
+        // The shell works without history if it can't be opened
+        init_history(HISTORY_ENV);
+    }
     set_shell_signal_handlers();
+    // The terminal is watched so children are reaped while the user types
+    if (init_events(shell_interactive ? STDIN_FILENO : FAIL) == FAIL)
+        return FAIL;
     
 #ifdef SHELL_VERSION
-    fprintf(shell_outstream, "Rshell version " SHELL_VERSION "\n");
+    if (shell_interactive)
+        fprintf(shell_outstream, "Rshell version " SHELL_VERSION "\n");
 #endif
     return SUCCESS;
 }
@@ -176,25 +307,33 @@ static void release_shell()
 {
     vec_job_foreach(jobs, release_job);
     vec_job_delete(jobs);
-    sp_string_delete(parsing_line);
-    tcsetattr(shell_tty, TCSANOW, &prev_attr);
-    close(waiting_pipe[0]);
-    close(waiting_pipe[1]);
+    release_job_pids();
+    sp_line_delete(parsing_line);
+    release_command_cache();
+    if (shell_interactive)
+        tcsetattr(shell_tty, TCSANOW, &prev_attr);
+    if (input_fd != STDIN_FILENO)
+        close(input_fd);
+    release_events();
+    release_history();
+    release_affinity();
+    release_trace();
 }
 
 static int reset_parsing_line()
 {
-    // Releases global variable link
+    // Releases global variable link. If no job holds the line, its arena
+    // is reused.
     if (parsing_line) {
-        if (sp_string_count(parsing_line) == 1)
-            return SUCCESS;
-        sp_string_release(parsing_line);  
+        if (sp_line_count(parsing_line) == 1)
+            return line_reset(sp_line_get(parsing_line));
+        sp_line_release(parsing_line);  
     }
     // Creates new link carefully. If fails to allocate structure, frees
-    // vector.
-    struct vec_char_t* vec = vec_char_new();
-    if (!vec || !(parsing_line = sp_string_new(vec))) {
-        vec_char_delete(vec);
+    // line.
+    struct line* line = line_new();
+    if (!line || !(parsing_line = sp_line_new(line))) {
+        line_delete(line);
         return FAIL;
     }
     return SUCCESS;
@@ -204,17 +343,28 @@ static void process_jobs()
 {
     _shell_assert(jobs);
 
+    // Foreground jobs are already released, so scripts usually have nothing
+    // to reap
+    if (vec_empty(jobs))
+        return;
+    reap_children();
+    start_queued_jobs();
+
     vec_size_t new_size = 0;
 
     for (vec_size_t i = 0; i < vec_size(jobs); ++i) {
         struct job* job = vec_at_ptr(jobs, i);
         if (job->state == JOB_INVALID)
             continue;
-        // Prints information only if the status of program has changed
+        // Prints information only if the status of program has changed.
+        // Scripts do not report their jobs.
         if (job->notify_status) {
-            fprintf(shell_outstream, "[%zu] \t", i + 1);
-            print_job_with_status(job);
-            fprintf(shell_outstream, "\n");
+            trace_instant(get_job_status_msg(job), "job", i + 1);
+            if (shell_interactive) {
+                fprintf(shell_outstream, "[%zu] \t", i + 1);
+                print_job_with_status(job);
+                fprintf(shell_outstream, "\n");
+            }
             job->notify_status = false;
         }
         int job_status = get_job_status(job);
@@ -223,6 +373,7 @@ static void process_jobs()
         // It either ended in foreground or its terminated status just printed,
         // so it's better to release resources. 
         if (job_status == JOB_TERMINATED) {
+            print_job_times(job);
             release_job(job);
         }
         else {
@@ -232,4 +383,31 @@ static void process_jobs()
     fflush(shell_outstream);
     // Shrinks jobs to hold only jobs that are here.
     vec_job_resize(jobs, new_size);
+    if (vec_capacity(jobs) > JOBS_KEEP_CAPACITY 
+        && vec_capacity(jobs) > JOBS_SHRINK_RATIO * new_size) {
+        vec_job_shrink_to_fit(jobs);
+    }
+}
+
+static void init_bg_limits()
+{
+    shell_bg_limits.jobs = get_limit_env(BG_JOBS_ENV, SIZE_MAX);
+    shell_bg_limits.load = get_limit_env(BG_LOAD_ENV, HUGE_VAL);
+    shell_bg_limits.mem_kb = get_limit_env(BG_MEM_ENV, SIZE_MAX / KB_IN_MB) * KB_IN_MB;
+}
+
+static double get_limit_env(const char* name, double max)
+{
+    const char* value = getenv(name);
+    if (!value || !*value)
+        return 0;
+
+    char* endptr;
+    double limit = strtod(value, &endptr);
+    // NaN is not in the range either
+    if (*endptr || !(limit >= 0 && limit <= max)) {
+        _shell_flush_fprintf("%s: invalid limit '%s'\n", name, value);
+        return 0;
+    }
+    return limit;
 }
@@ -1,7 +1,11 @@
 #ifndef OS_LABS_RSHELL_SHELL_H_
 #define OS_LABS_RSHELL_SHELL_H_
 
-// Starts CLI shell
-void start_shell(int argc, char** argv);
+// Starts CLI shell. 
+// Without arguments reads commands from stdin, interactively if it's a 
+// terminal. "-c string" executes the string, any other argument is treated as a
+// script file.
+// Returns exit status of the shell.
+int start_shell(int argc, char** argv);
 
 #endif // OS_LABS_RSHELL_SHELL_H_
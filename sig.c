@@ -2,34 +2,31 @@
 #include "sig.h"
 #undef VEC_SOURCE
 
-#include <errno.h>
 #include <signal.h>
 #include <stdio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
-#include "command.h"
-#include "jobs.h"
 #include "util/config.h"
 
 #define FAIL    -1
 #define SUCCESS 0
 
-#ifndef WAIT_ANY
-#   define WAIT_ANY -1
-#endif
-
-// SIGCHLD handler. Resets values in jobs to the given status.
-static void sigchld_handler(int signum);
+// Signals whose handlers are changed by the shell and must be restored in 
+// children
+static const int child_signals[] = {SIGINT, SIGQUIT, SIGTERM, 
+                                    SIGTSTP, SIGTTIN, SIGTTOU};
 
 void set_shell_signal_handlers()
 {
-    struct sigaction nact = {.sa_handler = sigchld_handler, .sa_flags = SA_RESTART};
-    sigemptyset(&nact.sa_mask);
-    sigaction(SIGCHLD, &nact, NULL);
+    // SIGCHLD is not handled, it's read by the event loop.
+    // Without job control the shell may be interrupted or stopped like any 
+    // other program.
+    if (!shell_interactive)
+        return;
 
-    nact.sa_handler = SIG_IGN;
-    nact.sa_flags = 0;
+    struct sigaction nact = {.sa_handler = SIG_IGN, .sa_flags = 0};
+    sigemptyset(&nact.sa_mask);
     sigaction(SIGINT, &nact, NULL);
     sigaction(SIGQUIT, &nact, NULL);
     sigaction(SIGQUIT, &nact, NULL);
@@ -44,70 +41,17 @@ void set_child_signals()
     struct sigaction nact = {.sa_handler = SIG_DFL};
     sigemptyset(&nact.sa_mask);
 
-    sigaction(SIGCHLD, &nact, NULL);
-    sigaction(SIGINT, &nact, NULL);
-    sigaction(SIGQUIT, &nact, NULL);
-    sigaction(SIGTERM, &nact, NULL);
-    sigaction(SIGTSTP, &nact, NULL);
-    sigaction(SIGTTIN, &nact, NULL);
-    sigaction(SIGTTOU, &nact, NULL);
+    for (size_t i = 0; i < sizeof(child_signals) / sizeof(*child_signals); ++i) {
+        sigaction(child_signals[i], &nact, NULL);
+    }
 }
 
-static void sigchld_handler(int signum)
-{    
-    // Protects from data races
-    int oerrno = errno;
-
-    int status = 0;
-    int pid = 0;
-    int cld_code = CLD_CONTINUED;
-    // Protects from resending status if the process updates again, because the
-    // shell expects exactly one status passed for each wait.
-    bool waited_pid_met = false;
-
-    while ((pid = waitpid(WAIT_ANY, &status, WNOHANG | WUNTRACED | WCONTINUED)) != FAIL && pid != 0) {
-        // If it's process that is being waited for, passes status to the pipe and 
-        // continues.
-        if (!waited_pid_met && pid == waited_pid && !WIFCONTINUED(status)) {
-            write(waiting_pipe[1], &status, sizeof(status));
-            waited_pid_met = true;
-            continue;
-        }
-
-        // Checks that status represents interesting state to us
-        if ((cld_code = transform_status(status)) == FAIL)
-            continue;
-
-        struct job* job = find_job(pid, jobs);
-        struct command* cmd = find_cmd(pid, job);
-
-        if (!cmd)
-            continue;
-
-        int job_status = get_job_status(job);
-        // It's important to update cmd's status after status of job was asked
-        cmd->status = cld_code;
-
-        switch (cld_code) {
-        case CLD_CONTINUED:
-            goto CONTINUE;
-        case CLD_STOPPED:
-            if (job_status != JOB_STOPPED)
-                job->notify_status = true; 
-            break;
-        default: 
-            if (job_status != JOB_TERMINATED)
-                job->notify_status = true; 
-            break;
-        }
-        job->forced_running = false;
-        if (job->pid == pid)
-            job->status = status;
-
-        CONTINUE:;
+void get_child_signals(sigset_t* set)
+{
+    sigemptyset(set);
+    for (size_t i = 0; i < sizeof(child_signals) / sizeof(*child_signals); ++i) {
+        sigaddset(set, child_signals[i]);
     }
-
-    errno = oerrno;
 }
 
 int transform_status(int status)
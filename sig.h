@@ -3,25 +3,16 @@
 
 #include <signal.h>
 
-#define BLOCK_SIGNAL(sig, nvar, ovar) \
-do { \
-    sigemptyset(&nvar); \
-    sigaddset(&nvar, sig); \
-    sigemptyset(&ovar); \
-    sigprocmask(SIG_BLOCK, &nvar, &ovar); \
-} while (0)
-
-#define UNBLOCK_SIGNAL(ovar) sigprocmask (SIG_SETMASK, &ovar, (sigset_t*) NULL)
-
-#define BLOCK_CHILD(nvar, ovar) BLOCK_SIGNAL (SIGCHLD, nvar, ovar)
-#define UNBLOCK_CHILD(ovar) UNBLOCK_SIGNAL(ovar)
-
 // Sets shell-specific signal handlers.
 void set_shell_signal_handlers();
 
 // Restores shell signal handlers for a child.
 void set_child_signals();
 
+// Fills set with signals that set_child_signals() restores. It's used to 
+// restore them in a spawned child.
+void get_child_signals(sigset_t* set);
+
 // Transforms status from waitpid(2) format to waitid(2) si_code format
 int transform_status(int status);
 
@@ -0,0 +1,85 @@
+// Counts heap allocations the rshell makes per line of several kinds of
+// lines. Every script is run with count and 2 * count lines, so allocations
+// of the shell's start and exit are subtracted.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "run_rshell.h"
+
+#define FAIL            -1
+#define DEFAULT_COUNT   1000
+
+static const char* lines[] = {
+    "cd .",
+    "cd . > /dev/null 2>> /dev/null",
+    "cd . | cd .",
+    "/bin/true",
+    "/bin/true < /dev/null > /dev/null",
+    "/bin/true | /bin/true",
+};
+
+// Runs rshell with count copies of the line and malloc_count preloaded.
+// Returns number of allocations of the rshell or -1.
+static long run_lines(const char* rshell, const char* preload, const char* line, int count)
+{
+    size_t len = strlen(line) + 1;
+    char* script = malloc(len * count + 1);
+    if (!script) {
+        perror("malloc");
+        return FAIL;
+    }
+    for (int i = 0; i < count; ++i) {
+        memcpy(script + i * len, line, len - 1);
+        script[i * len + len - 1] = '\n';
+    }
+    script[len * count] = '\0';
+
+    char env_preload[4096];
+    snprintf(env_preload, sizeof(env_preload), "LD_PRELOAD=%s", preload);
+    char* env[] = {env_preload, "PATH=/usr/bin:/bin", NULL};
+    char* argv[] = {(char*)rshell, "-c", script, NULL};
+
+    // malloc_count reports to stderr
+    long result = FAIL;
+    struct rshell_run run = {.output_fd = STDERR_FILENO, .quiet = true};
+    if (run_rshell(argv, env, &run) == FAIL)
+        goto ERROR_HANDLER;
+
+    // Only the line of the spawned rshell is taken, forked children may
+    // print their own
+    for (char* report = strtok(run.output, "\n"); report; report = strtok(NULL, "\n")) {
+        int count_pid;
+        long count;
+        if (sscanf(report, "malloc_count %d %ld", &count_pid, &count) == 2 && count_pid == run.pid)
+            result = count;
+    }
+    free(run.output);
+    if (result == FAIL)
+        fprintf(stderr, "%s did not report allocations\n", rshell);
+
+ERROR_HANDLER:
+    free(script);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s rshell malloc_count.so [count]\n", argv[0]);
+        return -1;
+    }
+    int count = argc > 3 ? atoi(argv[3]) : DEFAULT_COUNT;
+    if (count <= 0) {
+        fprintf(stderr, "count must be positive\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < sizeof(lines) / sizeof(*lines); ++i) {
+        long once = run_lines(argv[1], argv[2], lines[i], count);
+        long twice = run_lines(argv[1], argv[2], lines[i], 2 * count);
+        if (once == FAIL || twice == FAIL)
+            return -1;
+        printf("%-36s %6.2f allocations per line\n", lines[i], (double)(twice - once) / count);
+    }
+}
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "run_rshell.h"
+
+#define FAIL                -1
+#define DEFAULT_ITERATIONS  1000
+
+// Body of the loop, every line is counted as the number of its commands
+struct line {
+    const char* text;
+    int commands;
+};
+
+static const struct line body[] = {
+    {"true", 1},
+    {"false || true", 2},
+    {"echo some words > /dev/null", 1},
+    {"printf %s-%d\\n a 1 > /dev/null", 1},
+    {"test -d / && [ 1 -lt 2 ]", 2},
+    {"pwd > /dev/null", 1},
+    {"sleep 0", 1},
+};
+
+// Shell settings of the run
+struct run {
+    const char* name;
+    const char* env;
+};
+
+static const struct run runs[] = {
+    {"builtins", NULL},
+    {"programs", "RSHELL_BUILTINS=off"},
+};
+
+// Writes the unrolled loop to the temporary file. rshell has no loops, so the
+// body is repeated. Returns the number of commands or -1.
+static long write_script(char* path, long iterations)
+{
+    int fd = mkstemp(path);
+    FILE* file = fd == FAIL ? NULL : fdopen(fd, "w");
+    if (!file) {
+        perror("script");
+        return FAIL;
+    }
+    long commands = 0;
+    for (long i = 0; i < iterations; ++i) {
+        for (size_t j = 0; j < sizeof(body) / sizeof(*body); ++j) {
+            fprintf(file, "%s\n", body[j].text);
+            commands += body[j].commands;
+        }
+    }
+    if (fclose(file) == EOF) {
+        perror("script");
+        return FAIL;
+    }
+    return commands;
+}
+
+// Runs rshell with the script. Returns elapsed seconds or -1.
+static double run_script(const char* rshell, const char* script, const char* env_builtins)
+{
+    char* env[] = {"PATH=/usr/bin:/bin", (char*)env_builtins, NULL};
+    char* argv[] = {(char*)rshell, (char*)script, NULL};
+    struct rshell_run run = {0};
+    return run_rshell(argv, env, &run) == FAIL ? FAIL : run.elapsed;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s rshell [iterations]\n", argv[0]);
+        return -1;
+    }
+    long iterations = argc > 2 ? atol(argv[2]) : DEFAULT_ITERATIONS;
+    if (iterations <= 0) {
+        fprintf(stderr, "Iterations must be positive\n");
+        return -1;
+    }
+
+    char script[] = "/tmp/builtin_bench_XXXXXX";
+    long commands = write_script(script, iterations);
+    if (commands == FAIL)
+        return -1;
+
+    int retval = 0;
+    for (size_t i = 0; i < sizeof(runs) / sizeof(*runs); ++i) {
+        double elapsed = run_script(argv[1], script, runs[i].env);
+        if (elapsed < 0) {
+            retval = -1;
+            break;
+        }
+        printf("%-8s %ld commands in %.3f s, %.0f commands/s\n",
+               runs[i].name, commands, elapsed, commands / elapsed);
+    }
+    unlink(script);
+    return retval;
+}
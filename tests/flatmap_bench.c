@@ -0,0 +1,188 @@
+// Compares the heap flatmap with pointers to separately allocated data (as
+// redirections were stored) and the inline flatmap with data by value. Every
+// phase (insert, find, foreach) runs over many small maps, like commands of
+// a script, and prints time per operation.
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../util/utils.h"
+
+#define DEFAULT_COUNT   100000
+#define MAX_SIZE        6
+
+// The same size as struct redirection
+struct payload {
+    int type;
+    int fd;
+    const char* file_name;
+    int flags;
+    int mode;
+    int opened_fd;
+};
+
+static void free_payload(struct payload* payload)
+{
+    (void)payload;
+}
+
+#define FM_SOURCE
+
+#define fm_name         heap
+#define fm_key_t        int
+#define fm_free_key     free_int
+#define fm_key_cmp      int_cmp
+#define fm_data_t       struct payload*
+#define fm_free_data    free
+#include "../util/flatmap.h"
+
+#define fm_name         small
+#define fm_key_t        int
+#define fm_free_key     free_int
+#define fm_key_cmp      int_cmp
+#define fm_data_t       struct payload
+#define fm_free_data    free_payload
+#define fm_inline_size  3
+#include "../util/flatmap.h"
+
+#undef FM_SOURCE
+
+#define FAIL            -1
+
+// Keys are inserted not in order like fds of 2>err >out <in
+static const int keys[MAX_SIZE] = {2, 1, 0, 5, 4, 3};
+
+static struct timespec now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time;
+}
+
+static double elapsed_ns(struct timespec begin)
+{
+    struct timespec end = now();
+    return (end.tv_sec - begin.tv_sec) * 1e9 + (end.tv_nsec - begin.tv_nsec);
+}
+
+static void sum_heap(const int key, struct payload* payload, void* arg)
+{
+    *(long*)arg += key + payload->fd;
+}
+
+static void sum_inline(const int key, struct payload* payload, void* arg)
+{
+    *(long*)arg += key + payload->fd;
+}
+
+// Returns -1 if something failed
+static int bench_heap(int count, int size, long* checksum)
+{
+    struct fm_heap_t** maps = malloc(count * sizeof(*maps));
+    if (!maps)
+        return FAIL;
+
+    struct timespec begin = now();
+    for (int i = 0; i < count; ++i) {
+        if (!(maps[i] = fm_heap_new()))
+            return FAIL;
+        for (int j = 0; j < size; ++j) {
+            struct payload* payload = malloc(sizeof(*payload));
+            if (!payload)
+                return FAIL;
+            *payload = (struct payload){.fd = keys[j], .opened_fd = FAIL};
+            if (!fm_heap_insert(maps[i], keys[j], payload))
+                return FAIL;
+        }
+    }
+    double insert = elapsed_ns(begin);
+
+    begin = now();
+    for (int i = 0; i < count; ++i) {
+        for (int j = 0; j < size; ++j) {
+            struct payload* payload;
+            if (fm_heap_find(maps[i], keys[j], &payload))
+                *checksum += payload->fd;
+        }
+    }
+    double find = elapsed_ns(begin);
+
+    begin = now();
+    for (int i = 0; i < count; ++i)
+        fm_heap_foreach(maps[i], sum_heap, checksum);
+    double foreach = elapsed_ns(begin);
+
+    begin = now();
+    for (int i = 0; i < count; ++i)
+        fm_heap_delete(maps[i]);
+    double release = elapsed_ns(begin);
+    free(maps);
+
+    printf("heap   %d: insert %6.1f ns, find %5.1f ns, foreach %5.1f ns, delete %6.1f ns\n",
+           size, insert / count, find / count, foreach / count, release / count);
+    return 0;
+}
+
+static int bench_inline(int count, int size, long* checksum)
+{
+    struct fm_small_t* maps = malloc(count * sizeof(*maps));
+    if (!maps)
+        return FAIL;
+
+    struct timespec begin = now();
+    for (int i = 0; i < count; ++i) {
+        fm_small_init(&maps[i]);
+        for (int j = 0; j < size; ++j) {
+            struct payload payload = {.fd = keys[j], .opened_fd = FAIL};
+            if (!fm_small_insert(&maps[i], keys[j], payload))
+                return FAIL;
+        }
+    }
+    double insert = elapsed_ns(begin);
+
+    begin = now();
+    for (int i = 0; i < count; ++i) {
+        for (int j = 0; j < size; ++j) {
+            struct payload payload;
+            if (fm_small_find(&maps[i], keys[j], &payload))
+                *checksum += payload.fd;
+        }
+    }
+    double find = elapsed_ns(begin);
+
+    begin = now();
+    for (int i = 0; i < count; ++i)
+        fm_small_foreach(&maps[i], sum_inline, checksum);
+    double foreach = elapsed_ns(begin);
+
+    begin = now();
+    for (int i = 0; i < count; ++i)
+        fm_small_release(&maps[i]);
+    double release = elapsed_ns(begin);
+    free(maps);
+
+    printf("inline %d: insert %6.1f ns, find %5.1f ns, foreach %5.1f ns, delete %6.1f ns\n",
+           size, insert / count, find / count, foreach / count, release / count);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_COUNT;
+    if (count <= 0) {
+        fprintf(stderr, "Usage: %s [count]\n", argv[0]);
+        return -1;
+    }
+
+    // Times are per map of the given size
+    long heap_checksum = 0;
+    long inline_checksum = 0;
+    for (int size = 0; size <= MAX_SIZE; ++size) {
+        if (bench_heap(count, size, &heap_checksum) == FAIL
+            || bench_inline(count, size, &inline_checksum) == FAIL) {
+            perror("bench");
+            return -1;
+        }
+    }
+    return heap_checksum == inline_checksum ? 0 : -1;
+}
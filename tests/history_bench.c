@@ -0,0 +1,240 @@
+// Fills a history file with a million lines (may be changed with the first
+// argument) and measures indexing, recall and search with the rshell's
+// history. Results of the searches are checked with a plain scan. In the end
+// two processes append to the same file at once and every line must stay
+// whole.
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../history.h"
+#include "../util/config.h"
+
+#define FAIL            -1
+#define DEFAULT_COUNT   1000000
+#define QUERIES         1000
+// Slow queries are repeated only for this time
+#define QUERIES_TIME_US 200000
+#define APPENDS         2000
+#define HISTORY_ENV     "RSHELL_HISTORY"
+#define LINE_MAX_LEN    128
+
+static const char* commands[] = {
+    "ls -la", "cd ..", "git status", "git commit -m fix", "make -j8",
+    "grep -rn TODO src", "vim main.c", "cat /etc/hosts | grep local",
+    "ssh build", "./rshell tests/script.rsh > out 2>> err", "ps o pid,cmd",
+    "docker run --rm image", "find . -name *.c | wc -l", "echo done",
+};
+#define COMMANDS_COUNT (sizeof(commands) / sizeof(*commands))
+
+static struct timespec now()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time;
+}
+
+static double elapsed_us(struct timespec begin)
+{
+    struct timespec end = now();
+    return (end.tv_sec - begin.tv_sec) * 1e6 + (end.tv_nsec - begin.tv_nsec) / 1e3;
+}
+
+// The same as find_history_prefix(), but checks every entry
+static size_t scan_prefix(const char* prefix)
+{
+    size_t len = strlen(prefix);
+    for (size_t i = history_size(); i > 0; --i) {
+        size_t entry_len;
+        const char* entry = get_history_entry(i, &entry_len);
+        if (entry_len >= len && memcmp(entry, prefix, len) == 0)
+            return i;
+    }
+    return 0;
+}
+
+// The same as find_history_substring(), but checks every entry
+static size_t scan_substring(const char* str)
+{
+    size_t len = strlen(str);
+    for (size_t i = history_size(); i > 0; --i) {
+        size_t entry_len;
+        const char* entry = get_history_entry(i, &entry_len);
+        if (memmem(entry, entry_len, str, len))
+            return i;
+    }
+    return 0;
+}
+
+static void format_line(char* line, size_t i)
+{
+    snprintf(line, LINE_MAX_LEN, "%s %zu", commands[i % COMMANDS_COUNT], i * 7919 % 100003);
+}
+
+static int fill_file(const char* name, size_t count)
+{
+    FILE* file = fopen(name, "w");
+    if (!file)
+        return FAIL;
+    char line[LINE_MAX_LEN];
+    for (size_t i = 0; i < count; ++i) {
+        format_line(line, i);
+        fprintf(file, "%s\n", line);
+    }
+    return fclose(file);
+}
+
+// Measures queries of the prefixes and checks them. Returns false on mismatch.
+static bool bench_prefix(const char* what, const char** prefixes, size_t count)
+{
+    struct timespec begin = now();
+    size_t i = 0;
+    for (; i < QUERIES && elapsed_us(begin) < QUERIES_TIME_US; ++i) {
+        find_history_prefix(prefixes[i % count], strlen(prefixes[i % count]));
+    }
+    printf("prefix %-24s %10.2f us\n", what, elapsed_us(begin) / i);
+    for (i = 0; i < count; ++i) {
+        if (find_history_prefix(prefixes[i], strlen(prefixes[i])) != scan_prefix(prefixes[i])) {
+            fprintf(stderr, "prefix %s: wrong entry\n", prefixes[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// The same as bench_prefix() for substrings
+static bool bench_substring(const char* what, const char** strs, size_t count)
+{
+    struct timespec begin = now();
+    size_t i = 0;
+    for (; i < QUERIES && elapsed_us(begin) < QUERIES_TIME_US; ++i) {
+        find_history_substring(strs[i % count], strlen(strs[i % count]));
+    }
+    printf("substring %-21s %10.2f us\n", what, elapsed_us(begin) / i);
+    for (i = 0; i < count; ++i) {
+        if (find_history_substring(strs[i], strlen(strs[i])) != scan_substring(strs[i])) {
+            fprintf(stderr, "substring %s: wrong entry\n", strs[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+// Appends APPENDS lines marked with the tag
+static void append_lines(char tag)
+{
+    char line[LINE_MAX_LEN];
+    for (size_t i = 0; i < APPENDS; ++i) {
+        snprintf(line, LINE_MAX_LEN, "concurrent %c %zu %s", tag, i, commands[i % COMMANDS_COUNT]);
+        add_history(line);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    long count = argc > 1 ? atol(argv[1]) : DEFAULT_COUNT;
+    if (count <= 0) {
+        fprintf(stderr, "Usage: %s [count]\n", argv[0]);
+        return -1;
+    }
+    shell_outstream = stderr;
+
+    char name[] = "/tmp/rshell_historyXXXXXX";
+    int fd = mkstemp(name);
+    if (fd == FAIL || fill_file(name, count) == FAIL) {
+        perror("history file");
+        return -1;
+    }
+    close(fd);
+    setenv(HISTORY_ENV, name, 1);
+
+    int retval = -1;
+    struct timespec begin = now();
+    if (init_history(HISTORY_ENV) == FAIL)
+        goto CLEANUP;
+    printf("index %zu entries %19.2f ms\n", history_size(), elapsed_us(begin) / 1e3);
+
+    begin = now();
+    size_t entry = find_history_prefix("ls", 2);
+    printf("first prefix search %13.2f ms\n", elapsed_us(begin) / 1e3);
+    if (entry != scan_prefix("ls"))
+        goto CLEANUP;
+
+    // Recall by number
+    size_t sum = 0;
+    begin = now();
+    for (size_t i = 0; i < QUERIES; ++i) {
+        size_t len;
+        if (get_history_entry((i * 7919) % history_size() + 1, &len))
+            sum += len;
+    }
+    printf("recall by number %19.2f us\n", elapsed_us(begin) / QUERIES);
+
+    const char* recent[] = {"echo", "git", "make", "ls -la 1"};
+    const char* rare[] = {"vim main.c 99991", "ssh build 4", "cd .. 10"};
+    const char* missing[] = {"xyz", "git push", "lsblk"};
+    const char* substrings[] = {"grep", "commit", "local", "out 2>>"};
+    const char* rare_substrings[] = {"main.c 99991", "build 4 "};
+    const char* missing_substrings[] = {"not in history", "qqq"};
+    if (!bench_prefix("recent", recent, sizeof(recent) / sizeof(*recent))
+        || !bench_prefix("rare", rare, sizeof(rare) / sizeof(*rare))
+        || !bench_prefix("missing", missing, sizeof(missing) / sizeof(*missing))
+        || !bench_substring("recent", substrings, sizeof(substrings) / sizeof(*substrings))
+        || !bench_substring("rare", rare_substrings, 1)
+        || !bench_substring("missing", missing_substrings, 2)) {
+        goto CLEANUP;
+    }
+
+    // Every appended line is found after it's added, so it's indexed and
+    // sorted on the way
+    begin = now();
+    char line[LINE_MAX_LEN];
+    for (size_t i = 0; i < QUERIES; ++i) {
+        snprintf(line, LINE_MAX_LEN, "appended %zu", i);
+        add_history(line);
+        if (find_history_prefix(line, strlen(line)) != history_size()) {
+            fprintf(stderr, "%s: not found after append\n", line);
+            goto CLEANUP;
+        }
+    }
+    printf("append and find %20.2f us\n", elapsed_us(begin) / QUERIES);
+
+    // Two shells append at once
+    size_t size = history_size();
+    pid_t pid = fork();
+    if (pid == FAIL) {
+        perror("fork");
+        goto CLEANUP;
+    }
+    append_lines(pid ? 'p' : 'c');
+    if (!pid)
+        _exit(EXIT_SUCCESS);
+    waitpid(pid, NULL, 0);
+    if (history_size() != size + 2 * APPENDS) {
+        fprintf(stderr, "concurrent appends: %zu entries instead of %zu\n",
+                history_size() - size, (size_t)2 * APPENDS);
+        goto CLEANUP;
+    }
+    for (size_t i = size + 1; i <= history_size(); ++i) {
+        size_t len;
+        const char* entry = get_history_entry(i, &len);
+        if (len < sizeof("concurrent") || memcmp(entry, "concurrent", sizeof("concurrent") - 1)) {
+            fprintf(stderr, "concurrent appends: entry %zu is broken\n", i);
+            goto CLEANUP;
+        }
+    }
+    printf("concurrent appends: ok\n");
+    retval = sum ? 0 : -1;
+
+CLEANUP:
+    if (retval)
+        fprintf(stderr, "history_bench failed\n");
+    release_history();
+    unlink(name);
+    return retval;
+}
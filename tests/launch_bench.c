@@ -0,0 +1,60 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "run_rshell.h"
+
+#define FAIL            -1
+#define DEFAULT_COUNT   1000
+#define DEFAULT_COMMAND "/bin/true"
+
+static const char* engines[] = {"fork", "spawn"};
+
+// Runs rshell with the script and the engine. Returns elapsed seconds or -1.
+static double run_script(const char* rshell, const char* script, const char* engine)
+{
+    char env_engine[64];
+    snprintf(env_engine, sizeof(env_engine), "RSHELL_LAUNCH=%s", engine);
+    char* env[] = {env_engine, "PATH=/usr/bin:/bin", NULL};
+    char* argv[] = {(char*)rshell, "-c", (char*)script, NULL};
+    struct rshell_run run = {0};
+    return run_rshell(argv, env, &run) == FAIL ? FAIL : run.elapsed;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s rshell [count [command]]\n", argv[0]);
+        return -1;
+    }
+    int count = argc > 2 ? atoi(argv[2]) : DEFAULT_COUNT;
+    if (count <= 0) {
+        fprintf(stderr, "count must be positive\n");
+        return -1;
+    }
+    const char* command = argc > 3 ? argv[3] : DEFAULT_COMMAND;
+
+    // Script of count commands, one per line
+    size_t len = strlen(command) + 1;
+    char* script = malloc(len * count + 1);
+    if (!script) {
+        perror("malloc");
+        return -1;
+    }
+    for (int i = 0; i < count; ++i) {
+        memcpy(script + i * len, command, len - 1);
+        script[i * len + len - 1] = '\n';
+    }
+    script[len * count] = '\0';
+
+    for (size_t i = 0; i < sizeof(engines) / sizeof(*engines); ++i) {
+        double elapsed = run_script(argv[1], script, engines[i]);
+        if (elapsed < 0) {
+            free(script);
+            return -1;
+        }
+        printf("%-6s %d commands in %.3f s, %.0f commands/s\n",
+               engines[i], count, elapsed, count / elapsed);
+    }
+    free(script);
+}
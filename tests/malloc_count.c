@@ -0,0 +1,46 @@
+// Preloaded library that counts malloc(3), calloc(3) and realloc(3) calls of
+// the rshell and prints "malloc_count <pid> <count>" to stderr at exit.
+// Other programs the rshell starts inherit LD_PRELOAD, so they are skipped
+// by name.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t count, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+
+static unsigned long count = 0;
+
+void* malloc(size_t size)
+{
+    ++count;
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n, size_t size)
+{
+    ++count;
+    return __libc_calloc(n, size);
+}
+
+void* realloc(void* ptr, size_t size)
+{
+    ++count;
+    return __libc_realloc(ptr, size);
+}
+
+__attribute__((destructor))
+static void print_count()
+{
+    if (strcmp(program_invocation_short_name, "rshell"))
+        return;
+    // No stdio, it may allocate
+    char buf[64];
+    int len = snprintf(buf, sizeof(buf), "malloc_count %d %lu\n", getpid(), count);
+    if (write(STDERR_FILENO, buf, len) != len)
+        return;
+}
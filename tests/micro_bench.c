@@ -0,0 +1,397 @@
+// Microbenchmarks of the parser and the core data structures. Every
+// benchmark runs a fixed number of iterations several times and the results
+// are printed as JSON to stdout or to the file passed as the first argument,
+// so runs of different versions may be compared.
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../command.h"
+#include "../jobs.h"
+#include "../parseline.h"
+#include "../redirection.h"
+#include "../util/arena.h"
+#include "../util/config.h"
+#include "../util/line.h"
+#include "../util/vec_string.h"
+
+#define FAIL            -1
+#define SUCCESS         0
+#define REPETITIONS     7
+#define MAX_LINE        (1 << 17)
+
+// Result is added here so the compiler does not throw the work away
+static volatile long sink;
+
+struct benchmark {
+    const char* name;
+    // Number of operations in one run
+    long iterations;
+    // Runs iterations operations. Returns -1 on error.
+    int (*run)(const void* arg, long iterations);
+    const void* arg;
+};
+
+// Parsing
+
+struct parse_state {
+    struct vec_command_t* cmds;
+    struct arena* arena;
+    char* buff;
+};
+
+static struct parse_state parse_state;
+
+// Builds line of count copies of the word separated by the delimeter
+static char* repeat(const char* first, const char* word, const char* delim, int count)
+{
+    char* line = malloc(MAX_LINE);
+    if (!line)
+        return NULL;
+    size_t len = strlen(first);
+    memcpy(line, first, len);
+    for (int i = 0; i < count; ++i) {
+        len += snprintf(line + len, MAX_LINE - len, "%s", delim);
+        len += snprintf(line + len, MAX_LINE - len, word, i);
+    }
+    line[len] = '\0';
+    return line;
+}
+
+// Parses the line the same way the shell does: line is copied because the
+// parser changes it, commands are released and the arena is reset
+static int run_parse_line(const void* arg, long iterations)
+{
+    const char* line = arg;
+    size_t len = strlen(line) + 1;
+    for (long i = 0; i < iterations; ++i) {
+        memcpy(parse_state.buff, line, len);
+        if (parse_line(parse_state.buff, parse_state.cmds, parse_state.arena) == FAIL)
+            return FAIL;
+        sink += vec_size(parse_state.cmds);
+        vec_command_foreach(parse_state.cmds, release_cmd);
+        vec_command_clear(parse_state.cmds);
+        arena_reset(parse_state.arena);
+    }
+    return SUCCESS;
+}
+
+// Flatmap
+
+// Inserts size redirections in the shuffled order and then finds or erases
+// all of them
+enum FM_OPERATION {
+    FM_INSERT,
+    FM_FIND,
+    FM_ERASE,
+};
+
+struct fm_arg {
+    int size;
+    int operation;
+};
+
+static int fm_keys[1024];
+
+static int run_flatmap(const void* arg, long iterations)
+{
+    const struct fm_arg* fm_arg = arg;
+    struct fm_redirection_t map;
+    fm_redirection_init(&map);
+    for (long i = 0; i < iterations; ++i) {
+        for (int j = 0; j < fm_arg->size; ++j) {
+            struct redirection redirection = make_redirection(fm_keys[j], NULL, 0, 0);
+            if (!fm_redirection_insert(&map, fm_keys[j], redirection))
+                return FAIL;
+        }
+        if (fm_arg->operation == FM_FIND) {
+            for (int j = 0; j < fm_arg->size; ++j)
+                sink += fm_redirection_find(&map, fm_keys[j], NULL);
+        }
+        else if (fm_arg->operation == FM_ERASE) {
+            for (int j = 0; j < fm_arg->size; ++j)
+                fm_redirection_erase(&map, fm_keys[j]);
+        }
+        sink += fm_redirection_size(&map);
+        fm_redirection_clear(&map);
+    }
+    fm_redirection_release(&map);
+    return SUCCESS;
+}
+
+// Vector
+
+enum VEC_STORAGE {
+    VEC_HEAP,
+    VEC_HEAP_RESERVED,
+    VEC_ARENA,
+};
+
+struct vec_arg {
+    int size;
+    int storage;
+};
+
+// Creates vector and pushes size elements to it
+static int run_vector(const void* arg, long iterations)
+{
+    const struct vec_arg* vec_arg = arg;
+    struct arena* arena = vec_arg->storage == VEC_ARENA ? arena_new() : NULL;
+    if (vec_arg->storage == VEC_ARENA && !arena)
+        return FAIL;
+
+    for (long i = 0; i < iterations; ++i) {
+        struct vec_string_t* vec = vec_string_new_in(arena);
+        if (!vec)
+            return FAIL;
+        if (vec_arg->storage == VEC_HEAP_RESERVED && vec_string_reserve(vec, vec_arg->size) == FAIL)
+            return FAIL;
+        for (int j = 0; j < vec_arg->size; ++j) {
+            if (vec_string_push_back(vec, NULL) == FAIL)
+                return FAIL;
+        }
+        sink += vec_size(vec);
+        vec_string_delete(vec);
+        arena_reset(arena);
+    }
+    arena_delete(arena);
+    return SUCCESS;
+}
+
+// Line shared pointer
+
+// Adds and releases links like jobs of the line do
+static int run_sp_line(const void* arg, long iterations)
+{
+    struct line* line = line_new();
+    struct sp_line_t* sp = line ? sp_line_new(line) : NULL;
+    if (!sp) {
+        line_delete(line);
+        return FAIL;
+    }
+    for (long i = 0; i < iterations; ++i) {
+        struct sp_line_t* link = sp_line_add_link(sp);
+        sink += sp_line_count(link);
+        sp_line_release(link);
+    }
+    sp_line_delete(sp);
+    return SUCCESS;
+}
+
+// Jobs
+
+enum JOBS_OPERATION {
+    JOBS_STATUS_SCAN,
+    JOBS_PID_LOOKUP,
+};
+
+#define JOBS_PID_BASE   100000
+#define JOBS_PIPELINE   2
+
+// Fills jobs with count jobs of JOBS_PIPELINE commands with fake pids
+static int fill_jobs(int count)
+{
+    if (!(jobs = vec_job_new()))
+        return FAIL;
+    for (int i = 0; i < count; ++i) {
+        struct job* job = vec_job_emplace_back(jobs);
+        if (!job)
+            return FAIL;
+        clear_job(job);
+        if (!(job->pipeline = vec_command_new()))
+            return FAIL;
+        for (int j = 0; j < JOBS_PIPELINE; ++j) {
+            pid_t pid = JOBS_PID_BASE + i * JOBS_PIPELINE + j;
+            struct command cmd = {.pid = pid, .status = CLD_CONTINUED};
+            if (vec_command_push_back(job->pipeline, cmd) == FAIL
+                || add_job_pid(pid, i, j) == FAIL) {
+                return FAIL;
+            }
+        }
+        job->pgid = JOBS_PID_BASE + i * JOBS_PIPELINE;
+        job->pid = job->pgid + JOBS_PIPELINE - 1;
+        job->state = JOB_VALID;
+    }
+    return SUCCESS;
+}
+
+static void release_jobs()
+{
+    if (jobs) {
+        vec_job_foreach(jobs, release_job);
+        vec_job_delete(jobs);
+    }
+    jobs = NULL;
+    release_job_pids();
+}
+
+// Scans the whole table like the shell does after every line, or finds
+// every command by its pid like the reaper does
+static int run_jobs(const void* arg, long iterations)
+{
+    int operation = *(const int*)arg;
+    for (long i = 0; i < iterations; ++i) {
+        if (operation == JOBS_STATUS_SCAN) {
+            for (vec_size_t j = 0; j < vec_size(jobs); ++j)
+                sink += get_job_status(vec_at_ptr(jobs, j));
+        }
+        else {
+            pid_t end = JOBS_PID_BASE + vec_size(jobs) * JOBS_PIPELINE;
+            for (pid_t pid = JOBS_PID_BASE; pid < end; ++pid) {
+                struct job* job;
+                sink += find_job_cmd(pid, &job) != NULL;
+            }
+        }
+    }
+    return SUCCESS;
+}
+
+// Harness
+
+static double now_ns()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static int double_cmp(const void* lhs, const void* rhs)
+{
+    double a = *(const double*)lhs;
+    double b = *(const double*)rhs;
+    return (a > b) - (a < b);
+}
+
+// Runs the benchmark once to warm up and REPETITIONS times to measure.
+// Prints its JSON object.
+static int run_benchmark(FILE* out, const struct benchmark* bench, bool last)
+{
+    if (bench->run(bench->arg, bench->iterations) == FAIL) {
+        fprintf(stderr, "%s failed\n", bench->name);
+        return FAIL;
+    }
+    double ns[REPETITIONS];
+    for (int i = 0; i < REPETITIONS; ++i) {
+        double begin = now_ns();
+        if (bench->run(bench->arg, bench->iterations) == FAIL) {
+            fprintf(stderr, "%s failed\n", bench->name);
+            return FAIL;
+        }
+        ns[i] = (now_ns() - begin) / bench->iterations;
+    }
+    qsort(ns, REPETITIONS, sizeof(double), double_cmp);
+
+    fprintf(out, "    {\"name\": \"%s\", \"iterations\": %ld, \"repetitions\": %d, "
+            "\"ns_per_op_median\": %.2f, \"ns_per_op_min\": %.2f, \"ns_per_op_max\": %.2f}%s\n",
+            bench->name, bench->iterations, REPETITIONS, ns[REPETITIONS / 2], ns[0],
+            ns[REPETITIONS - 1], last ? "" : ",");
+    fprintf(stderr, "%-32s %12.2f ns/op\n", bench->name, ns[REPETITIONS / 2]);
+    return SUCCESS;
+}
+
+int main(int argc, char** argv)
+{
+    FILE* out = argc > 1 ? fopen(argv[1], "w") : stdout;
+    if (!out) {
+        perror(argv[1]);
+        return -1;
+    }
+    shell_outstream = stderr;
+
+    // Keys are shuffled with a fixed seed so every run is the same
+    srand(1);
+    for (int i = 0; i < 1024; ++i)
+        fm_keys[i] = i;
+    for (int i = 1023; i > 0; --i) {
+        int j = rand() % (i + 1);
+        int key = fm_keys[i];
+        fm_keys[i] = fm_keys[j];
+        fm_keys[j] = key;
+    }
+
+    char* long_args = repeat("echo", "arg%d", " ", 4096);
+    char* long_pipeline = repeat("true", "true", " | ", 256);
+    char* many_redirections = repeat("cmd", "%d> /dev/null", " ", 60);
+    char* long_word = repeat("echo ", "w", "", 65536);
+    char* many_commands = repeat("true", "true", " ; ", 256);
+    parse_state.cmds = vec_command_new();
+    parse_state.arena = arena_new();
+    parse_state.buff = malloc(MAX_LINE);
+    if (!long_args || !long_pipeline || !many_redirections || !long_word || !many_commands
+        || !parse_state.cmds || !parse_state.arena || !parse_state.buff) {
+        perror("micro_bench");
+        return -1;
+    }
+
+    static const struct fm_arg fm_args[] = {
+        {2, FM_INSERT}, {2, FM_FIND}, {2, FM_ERASE},
+        {16, FM_INSERT}, {16, FM_FIND}, {16, FM_ERASE},
+        {256, FM_INSERT}, {256, FM_FIND}, {256, FM_ERASE},
+    };
+    static const struct vec_arg vec_args[] = {
+        {8, VEC_HEAP}, {1024, VEC_HEAP}, {1024, VEC_HEAP_RESERVED}, {1024, VEC_ARENA},
+    };
+    static const int jobs_args[] = {JOBS_STATUS_SCAN, JOBS_PID_LOOKUP};
+
+    const struct benchmark benchmarks[] = {
+        {"parse_line/simple", 200000, run_parse_line, "ls -la /tmp"},
+        {"parse_line/pipeline", 100000, run_parse_line,
+            "cat < input.txt | grep -v foo | sort -u | uniq -c > out.txt 2>> err.log"},
+        {"parse_line/list", 100000, run_parse_line,
+            "make -j4 && ./run --fast || echo failed ; sleep 1 &"},
+        {"parse_line/redirections", 100000, run_parse_line,
+            "cmd 0< a 1> b 2>> c 3> d 4> e 5> f"},
+        {"parse_line/whitespace", 100000, run_parse_line,
+            "   echo \t\t a     b \t   c      d   "},
+        {"parse_line/long_args", 100, run_parse_line, long_args},
+        {"parse_line/long_pipeline", 1000, run_parse_line, long_pipeline},
+        {"parse_line/many_redirections", 10000, run_parse_line, many_redirections},
+        {"parse_line/long_word", 1000, run_parse_line, long_word},
+        {"parse_line/many_commands", 1000, run_parse_line, many_commands},
+        {"flatmap/insert/2", 1000000, run_flatmap, &fm_args[0]},
+        {"flatmap/find/2", 1000000, run_flatmap, &fm_args[1]},
+        {"flatmap/erase/2", 1000000, run_flatmap, &fm_args[2]},
+        {"flatmap/insert/16", 100000, run_flatmap, &fm_args[3]},
+        {"flatmap/find/16", 100000, run_flatmap, &fm_args[4]},
+        {"flatmap/erase/16", 100000, run_flatmap, &fm_args[5]},
+        {"flatmap/insert/256", 1000, run_flatmap, &fm_args[6]},
+        {"flatmap/find/256", 1000, run_flatmap, &fm_args[7]},
+        {"flatmap/erase/256", 1000, run_flatmap, &fm_args[8]},
+        {"vector/push/8", 1000000, run_vector, &vec_args[0]},
+        {"vector/push/1024", 10000, run_vector, &vec_args[1]},
+        {"vector/push_reserved/1024", 10000, run_vector, &vec_args[2]},
+        {"vector/push_arena/1024", 10000, run_vector, &vec_args[3]},
+        {"sp_line/add_release", 10000000, run_sp_line, NULL},
+        {"jobs/status_scan/1024", 1000, run_jobs, &jobs_args[0]},
+        {"jobs/pid_lookup/1024", 1000, run_jobs, &jobs_args[1]},
+    };
+    size_t count = sizeof(benchmarks) / sizeof(*benchmarks);
+
+    int result = SUCCESS;
+    if (fill_jobs(1024) == FAIL) {
+        perror("fill_jobs");
+        result = FAIL;
+        goto RESOURCE_MANAGER;
+    }
+    fprintf(out, "{\n  \"benchmarks\": [\n");
+    for (size_t i = 0; i < count && result == SUCCESS; ++i)
+        result = run_benchmark(out, &benchmarks[i], i + 1 == count);
+    fprintf(out, "  ]\n}\n");
+
+RESOURCE_MANAGER:
+    release_jobs();
+    vec_command_foreach(parse_state.cmds, release_cmd);
+    vec_command_delete(parse_state.cmds);
+    arena_delete(parse_state.arena);
+    free(parse_state.buff);
+    free(long_args);
+    free(long_pipeline);
+    free(many_redirections);
+    free(long_word);
+    free(many_commands);
+    if (out != stdout)
+        fclose(out);
+    return result == SUCCESS ? 0 : -1;
+}
@@ -0,0 +1,79 @@
+// Runs thousands of lines through parallel builtin of the shell and checks that
+// memory of the shell doesn't grow with the number of jobs it has started.
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "run_rshell.h"
+
+#define FAIL            -1
+#define DEFAULT_LINES   5000
+// The first run is this times shorter than the second one
+#define RATIO           10
+// Growth of the maximum resident set size that is allowed
+#define MAX_GROWTH_KB   512
+#define SCRIPT_LEN      (2 * PATH_MAX)
+
+// Writes lines lines to the temporary file
+static int write_lines(char* path, long lines)
+{
+    int fd = mkstemp(path);
+    FILE* file = fd == FAIL ? NULL : fdopen(fd, "w");
+    if (!file) {
+        perror("lines");
+        return FAIL;
+    }
+    for (long i = 0; i < lines; ++i)
+        fprintf(file, "%ld\n", i);
+    if (fclose(file) == EOF) {
+        perror("lines");
+        return FAIL;
+    }
+    return 0;
+}
+
+// Runs parallel in rshell for the lines of the file. Returns the maximum
+// resident set size in kB or -1.
+static long run_parallel(const char* rshell, const char* path)
+{
+    char script[SCRIPT_LEN];
+    snprintf(script, sizeof(script), "parallel -j 4 true < %s\n", path);
+    char* env[] = {"PATH=/usr/bin:/bin", NULL};
+    char* argv[] = {(char*)rshell, "-c", script, NULL};
+    struct rshell_run run = {0};
+    return run_rshell(argv, env, &run) == FAIL ? FAIL : run.usage.ru_maxrss;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s rshell [lines]\n", argv[0]);
+        return -1;
+    }
+    long lines = argc > 2 ? atol(argv[2]) : DEFAULT_LINES;
+    if (lines < RATIO) {
+        fprintf(stderr, "At least %d lines are needed\n", RATIO);
+        return -1;
+    }
+
+    char few[] = "/tmp/parallel_stress_XXXXXX";
+    char many[] = "/tmp/parallel_stress_XXXXXX";
+    if (write_lines(few, lines / RATIO) == FAIL || write_lines(many, lines) == FAIL)
+        return -1;
+
+    long few_rss = run_parallel(argv[1], few);
+    long many_rss = few_rss == FAIL ? FAIL : run_parallel(argv[1], many);
+    unlink(few);
+    unlink(many);
+    if (many_rss == FAIL)
+        return -1;
+
+    printf("%ld lines: %ld kB, %ld lines: %ld kB\n", lines / RATIO, few_rss, lines, many_rss);
+    if (many_rss - few_rss > MAX_GROWTH_KB) {
+        printf("FAILED: memory grows with the number of jobs\n");
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
@@ -0,0 +1,118 @@
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "run_rshell.h"
+
+#define FAIL            -1
+#define DEFAULT_MIB     512
+#define MIB             (1024 * 1024)
+// Writer writes big blocks, reader reads them like stdio does
+#define WRITE_BLOCK     (64 * 1024)
+#define READ_BLOCK      4096
+#define SCRIPT_LEN      (3 * PATH_MAX)
+
+// Pipe size of the run: keyword of the pipeline or the shell's setting
+struct run {
+    const char* name;
+    const char* prefix;
+    const char* env;
+};
+
+static const struct run runs[] = {
+    {"default", "", NULL},
+    {"256K", "pipesize 256K ", NULL},
+    {"1M", "pipesize 1M ", NULL},
+    {"auto", "", "RSHELL_PIPE_SIZE=auto"},
+};
+
+// Sum of the read data, so the reading loop is not optimized out
+volatile unsigned read_sum;
+
+// Writes mib MiB to the standard output
+static int write_data(long mib)
+{
+    static char block[WRITE_BLOCK];
+    memset(block, 'x', sizeof(block));
+    for (long long left = mib * MIB; left > 0; left -= sizeof(block)) {
+        for (size_t written = 0; written < sizeof(block); ) {
+            ssize_t count = write(STDOUT_FILENO, block + written, sizeof(block) - written);
+            if (count == FAIL) {
+                perror("write");
+                return FAIL;
+            }
+            written += count;
+        }
+    }
+    return 0;
+}
+
+// Reads the standard input and sums it, so the reader does some work
+static int read_data()
+{
+    char block[READ_BLOCK];
+    unsigned sum = 0;
+    ssize_t count;
+    while ((count = read(STDIN_FILENO, block, sizeof(block))) > 0) {
+        for (ssize_t i = 0; i < count; ++i)
+            sum += block[i];
+    }
+    if (count == FAIL) {
+        perror("read");
+        return FAIL;
+    }
+    read_sum = sum;
+    return 0;
+}
+
+// Runs rshell with the script. Returns elapsed seconds and context switches
+// of the pipeline or -1.
+static double run_pipeline(const char* rshell, const char* script, const char* env_size,
+                         long* switches)
+{
+    char* env[] = {"PATH=/usr/bin:/bin", (char*)env_size, NULL};
+    char* argv[] = {(char*)rshell, "-c", (char*)script, NULL};
+    struct rshell_run run = {0};
+    if (run_rshell(argv, env, &run) == FAIL)
+        return FAIL;
+    *switches = run.usage.ru_nvcsw + run.usage.ru_nivcsw;
+    return run.elapsed;
+}
+
+int main(int argc, char** argv)
+{
+    // The bench runs itself as both ends of the pipeline
+    if (argc == 3 && strcmp(argv[1], "--write") == 0)
+        return write_data(atol(argv[2])) == FAIL;
+    if (argc == 2 && strcmp(argv[1], "--read") == 0)
+        return read_data() == FAIL;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s rshell [MiB]\n", argv[0]);
+        return -1;
+    }
+    long mib = argc > 2 ? atol(argv[2]) : DEFAULT_MIB;
+    if (mib <= 0) {
+        fprintf(stderr, "MiB must be positive\n");
+        return -1;
+    }
+    char self[PATH_MAX];
+    if (!realpath(argv[0], self)) {
+        perror("realpath");
+        return -1;
+    }
+
+    for (size_t i = 0; i < sizeof(runs) / sizeof(*runs); ++i) {
+        char script[SCRIPT_LEN];
+        snprintf(script, sizeof(script), "%s%s --write %ld | %s --read\n",
+                 runs[i].prefix, self, mib, self);
+        long switches;
+        double elapsed = run_pipeline(argv[1], script, runs[i].env, &switches);
+        if (elapsed < 0)
+            return -1;
+        printf("%-8s %ld MiB in %.3f s, %.0f MiB/s, %ld context switches\n",
+               runs[i].name, mib, elapsed, mib / elapsed, switches);
+    }
+}
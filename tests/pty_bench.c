@@ -0,0 +1,406 @@
+// Runs an interactive shell under a pseudo-terminal, types scripted scenarios
+// into it and prints latency percentiles of every scenario. The same
+// scenarios are run in /bin/sh for comparison.
+// The program is also its own test command: with --exec it prints the time
+// it was started, with --stop it waits for signals and prints the time of
+// every SIGCONT.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FAIL            -1
+#define SUCCESS         0
+#define DEFAULT_COUNT   200
+#define COMPARED_SHELL  "/bin/sh"
+#define SH_PROMPT       "pty_bench$ "
+// Output stops for this long after the first prompt
+#define QUIET_MS        300
+#define TIMEOUT_MS      5000
+#define BUFF_SIZE       (1 << 16)
+// Shells may send SIGCONT before the terminal is given to the job, so keys
+// are typed to the continued job only after this pause
+#define SETTLE_US       10000
+
+#define STAMP           "STAMP:"
+#define CONT            "CONT:"
+#define READY           "READY"
+#define CTRL_Z          "\x1a"
+#define CTRL_C          "\x03"
+
+static double now_us()
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec * 1e6 + time.tv_nsec / 1e3;
+}
+
+// Test command
+
+static void print_cont(int signo)
+{
+    (void)signo;
+    char buf[64];
+    int len = snprintf(buf, sizeof(buf), CONT "%.3f\n", now_us());
+    if (write(STDOUT_FILENO, buf, len) != len)
+        _exit(EXIT_FAILURE);
+}
+
+static int run_test_command(const char* mode)
+{
+    if (!strcmp(mode, "--exec")) {
+        printf(STAMP "%.3f\n", now_us());
+        return 0;
+    }
+    struct sigaction act = {.sa_handler = print_cont};
+    sigaction(SIGCONT, &act, NULL);
+    printf(READY "\n");
+    fflush(stdout);
+    while (true)
+        pause();
+}
+
+// Terminal
+
+struct session {
+    int master;
+    pid_t pid;
+    // Everything the shell printed and the position of the first unread byte
+    char* buff;
+    size_t len;
+    size_t pos;
+    // Prompt learnt at start
+    char prompt[PATH_MAX + 256];
+};
+
+// Reads available output waiting at most timeout ms. Returns number of read
+// bytes, 0 on timeout or -1 on error.
+static ssize_t read_output(struct session* session, int timeout)
+{
+    struct pollfd pfd = {.fd = session->master, .events = POLLIN};
+    int ready = poll(&pfd, 1, timeout);
+    if (ready <= 0)
+        return ready;
+    if (session->len + 1 >= BUFF_SIZE) {
+        // Keeps only the unread part
+        memmove(session->buff, session->buff + session->pos, session->len - session->pos);
+        session->len -= session->pos;
+        session->pos = 0;
+    }
+    ssize_t count = read(session->master, session->buff + session->len,
+                         BUFF_SIZE - 1 - session->len);
+    if (count <= 0)
+        return FAIL;
+    session->len += count;
+    session->buff[session->len] = '\0';
+    return count;
+}
+
+// Waits until the pattern is printed. Sets time when it was read and moves
+// the unread position after it.
+static int expect(struct session* session, const char* pattern, double* at)
+{
+    double deadline = now_us() + TIMEOUT_MS * 1e3;
+    while (true) {
+        char* found = strstr(session->buff + session->pos, pattern);
+        if (found) {
+            if (at)
+                *at = now_us();
+            session->pos = found - session->buff + strlen(pattern);
+            return SUCCESS;
+        }
+        double left = deadline - now_us();
+        if (left <= 0 || read_output(session, (int)(left / 1e3) + 1) == FAIL) {
+            fprintf(stderr, "pty_bench: '%s' was not printed\n", pattern);
+            return FAIL;
+        }
+    }
+}
+
+// Waits for the line "prefix<time>" with time not less than after and sets
+// the time
+static int expect_stamp(struct session* session, const char* prefix, double after,
+                        double* stamp)
+{
+    while (true) {
+        if (expect(session, prefix, NULL) == FAIL || expect(session, "\n", NULL) == FAIL)
+            return FAIL;
+        const char* line = session->buff + session->pos - 1;
+        while (line > session->buff && line[-1] != ':')
+            --line;
+        *stamp = strtod(line, NULL);
+        if (*stamp >= after)
+            return SUCCESS;
+    }
+}
+
+static int type(struct session* session, const char* text, double* at)
+{
+    *at = now_us();
+    size_t len = strlen(text);
+    return write(session->master, text, len) == (ssize_t)len ? SUCCESS : FAIL;
+}
+
+// Starts the shell on a new terminal and learns its prompt
+static int start_session(struct session* session, char* const argv[], const char* dir)
+{
+    const char* shell = argv[0];
+    *session = (struct session){.master = FAIL, .pid = FAIL};
+    if (!(session->buff = malloc(BUFF_SIZE)))
+        return FAIL;
+    session->buff[0] = '\0';
+
+    session->master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+    if (session->master == FAIL || grantpt(session->master) == FAIL
+        || unlockpt(session->master) == FAIL) {
+        perror("pty_bench: posix_openpt");
+        return FAIL;
+    }
+    const char* slave_name = ptsname(session->master);
+
+    if ((session->pid = fork()) == FAIL) {
+        perror("pty_bench: fork");
+        return FAIL;
+    }
+    if (session->pid == 0) {
+        int slave = FAIL;
+        if (setsid() == FAIL || (slave = open(slave_name, O_RDWR)) == FAIL
+            || ioctl(slave, TIOCSCTTY, 0) == FAIL || chdir(dir) == FAIL) {
+            _exit(EXIT_FAILURE);
+        }
+        dup2(slave, STDIN_FILENO);
+        dup2(slave, STDOUT_FILENO);
+        dup2(slave, STDERR_FILENO);
+        if (slave > STDERR_FILENO)
+            close(slave);
+        // Typed lines are not written to any history file
+        char* env[] = {"PATH=/usr/bin:/bin", "TERM=dumb", "PS1=" SH_PROMPT,
+                       "HOME=/", "RSHELL_HISTORY=", NULL};
+        execve(shell, argv, env);
+        _exit(EXIT_FAILURE);
+    }
+
+    // The first prompt is everything printed until the shell is quiet
+    if (read_output(session, TIMEOUT_MS) <= 0)
+        return FAIL;
+    while (read_output(session, QUIET_MS) > 0)
+        ;
+    const char* line = strrchr(session->buff, '\n');
+    line = line ? line + 1 : session->buff;
+    if (!*line || strlen(line) >= sizeof(session->prompt)) {
+        fprintf(stderr, "pty_bench: %s printed no prompt\n", shell);
+        return FAIL;
+    }
+    strcpy(session->prompt, line);
+    session->pos = session->len;
+    return SUCCESS;
+}
+
+static void stop_session(struct session* session)
+{
+    if (session->pid > 0) {
+        kill(session->pid, SIGKILL);
+        waitpid(session->pid, NULL, 0);
+    }
+    if (session->master != FAIL)
+        close(session->master);
+    free(session->buff);
+}
+
+// Scenarios
+
+struct sample {
+    const char* name;
+    double* values;
+    int count;
+};
+
+// Types the line and measures time until the next prompt
+static int run_line(struct session* session, const char* line, struct sample* sample)
+{
+    double begin, end;
+    if (type(session, line, &begin) == FAIL || expect(session, session->prompt, &end) == FAIL)
+        return FAIL;
+    sample->values[sample->count++] = end - begin;
+    return SUCCESS;
+}
+
+// Measures time from the line until the test command starts and from its
+// start until the next prompt
+static int run_exec(struct session* session, const char* line, struct sample* start,
+                    struct sample* reap)
+{
+    double begin, stamp, end;
+    if (type(session, line, &begin) == FAIL
+        || expect_stamp(session, STAMP, begin, &stamp) == FAIL
+        || expect(session, session->prompt, &end) == FAIL) {
+        return FAIL;
+    }
+    start->values[start->count++] = stamp - begin;
+    reap->values[reap->count++] = end - stamp;
+    return SUCCESS;
+}
+
+// Stops the foreground test command, continues it in the background and
+// brings it back to the foreground
+static int run_job_control(struct session* session, struct sample* stop, struct sample* bg,
+                           struct sample* fg)
+{
+    double begin, end, stamp;
+    usleep(SETTLE_US);
+    if (type(session, CTRL_Z, &begin) == FAIL || expect(session, session->prompt, &end) == FAIL)
+        return FAIL;
+    stop->values[stop->count++] = end - begin;
+    if (type(session, "bg\n", &begin) == FAIL || expect(session, session->prompt, &end) == FAIL)
+        return FAIL;
+    bg->values[bg->count++] = end - begin;
+    if (type(session, "fg\n", &begin) == FAIL
+        || expect_stamp(session, CONT, begin, &stamp) == FAIL) {
+        return FAIL;
+    }
+    fg->values[fg->count++] = stamp - begin;
+    return SUCCESS;
+}
+
+static int double_cmp(const void* lhs, const void* rhs)
+{
+    double a = *(const double*)lhs;
+    double b = *(const double*)rhs;
+    return (a > b) - (a < b);
+}
+
+static void print_sample(const char* shell, struct sample* sample)
+{
+    const char* name = strrchr(shell, '/');
+    name = name ? name + 1 : shell;
+    qsort(sample->values, sample->count, sizeof(double), double_cmp);
+    double* v = sample->values;
+    int n = sample->count;
+    printf("%-12s %-14s %6d %9.1f %9.1f %9.1f %9.1f\n", name, sample->name, n,
+           v[n * 50 / 100], v[n * 90 / 100], v[n * 99 / 100], v[n - 1]);
+}
+
+enum SAMPLE {
+    SAMPLE_EMPTY,
+    SAMPLE_TRUE,
+    SAMPLE_PIPELINE,
+    SAMPLE_REDIRECT,
+    SAMPLE_EXEC_START,
+    SAMPLE_EXEC_REAP,
+    SAMPLE_STOP,
+    SAMPLE_BG,
+    SAMPLE_FG,
+    SAMPLE_COUNT,
+};
+
+static const char* sample_names[SAMPLE_COUNT] = {
+    "empty_line", "true", "pipeline", "redirections",
+    "line_to_exec", "exit_to_prompt", "ctrl_z", "bg", "fg",
+};
+
+static int bench_shell(char* const argv[], const char* self, const char* dir, int count)
+{
+    const char* shell = argv[0];
+    struct sample samples[SAMPLE_COUNT];
+    for (int i = 0; i < SAMPLE_COUNT; ++i) {
+        samples[i] = (struct sample){.name = sample_names[i], .count = 0,
+                                     .values = malloc(count * sizeof(double))};
+        if (!samples[i].values) {
+            perror("pty_bench: malloc");
+            return FAIL;
+        }
+    }
+    char exec_line[PATH_MAX + 16];
+    char stop_line[PATH_MAX + 16];
+    snprintf(exec_line, sizeof(exec_line), "%s --exec\n", self);
+    snprintf(stop_line, sizeof(stop_line), "%s --stop\n", self);
+
+    struct session session;
+    int result = start_session(&session, argv, dir);
+    for (int i = 0; i < count && result == SUCCESS; ++i) {
+        if (run_line(&session, "\n", &samples[SAMPLE_EMPTY]) == FAIL
+            || run_line(&session, "/bin/true\n", &samples[SAMPLE_TRUE]) == FAIL
+            || run_line(&session, "/bin/true | /bin/true | /bin/true\n",
+                        &samples[SAMPLE_PIPELINE]) == FAIL
+            || run_line(&session, "/bin/true < /dev/null > /dev/null 2>> /dev/null\n",
+                        &samples[SAMPLE_REDIRECT]) == FAIL
+            || run_exec(&session, exec_line, &samples[SAMPLE_EXEC_START],
+                        &samples[SAMPLE_EXEC_REAP]) == FAIL) {
+            result = FAIL;
+        }
+    }
+    // The same test command is stopped and continued count times
+    double begin;
+    if (result == SUCCESS && (type(&session, stop_line, &begin) == FAIL
+                              || expect(&session, READY, NULL) == FAIL)) {
+        result = FAIL;
+    }
+    for (int i = 0; i < count && result == SUCCESS; ++i) {
+        result = run_job_control(&session, &samples[SAMPLE_STOP], &samples[SAMPLE_BG],
+                                 &samples[SAMPLE_FG]);
+    }
+    double end;
+    if (result == SUCCESS && (type(&session, CTRL_C, &begin) == FAIL
+                              || expect(&session, session.prompt, &end) == FAIL)) {
+        result = FAIL;
+    }
+    stop_session(&session);
+
+    for (int i = 0; i < SAMPLE_COUNT; ++i) {
+        if (result == SUCCESS)
+            print_sample(shell, &samples[i]);
+        free(samples[i].values);
+    }
+    if (result == FAIL)
+        fprintf(stderr, "pty_bench: %s failed\n", shell);
+    return result;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc == 2 && (!strcmp(argv[1], "--exec") || !strcmp(argv[1], "--stop")))
+        return run_test_command(argv[1]);
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s rshell [count]\n", argv[0]);
+        return -1;
+    }
+    int count = argc > 2 ? atoi(argv[2]) : DEFAULT_COUNT;
+    if (count <= 0) {
+        fprintf(stderr, "count must be positive\n");
+        return -1;
+    }
+    char rshell[PATH_MAX];
+    char self[PATH_MAX];
+    if (!realpath(argv[1], rshell) || !realpath("/proc/self/exe", self)) {
+        perror("pty_bench: realpath");
+        return -1;
+    }
+    // Both shells run in the same directory, so prompts are the same length
+    char dir[] = "/tmp/pty_benchXXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("pty_bench: mkdtemp");
+        return -1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("%-12s %-14s %6s %9s %9s %9s %9s\n", "shell", "scenario", "count",
+           "p50 us", "p90 us", "p99 us", "max us");
+    char* rshell_argv[] = {rshell, NULL};
+    char* sh_argv[] = {COMPARED_SHELL, "-i", NULL};
+    int result = bench_shell(rshell_argv, self, dir, count);
+    if (result == SUCCESS)
+        result = bench_shell(sh_argv, self, dir, count);
+    rmdir(dir);
+    return result == SUCCESS ? 0 : -1;
+}
@@ -0,0 +1,112 @@
+// Reaps many children with the shell's reaper and reports time spent in it. Every child is a separate background job, so all of them
+// stay in jobs like in the shell that runs lots of background jobs.
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../command.h"
+#include "../events.h"
+#include "../jobs.h"
+#include "../util/config.h"
+
+#define FAIL            -1
+#define DEFAULT_COUNT   10000
+#define BATCH           500
+
+static double elapsed(const struct timespec* begin, const struct timespec* end)
+{
+    return (end->tv_sec - begin->tv_sec) + (end->tv_nsec - begin->tv_nsec) / 1e9;
+}
+
+// Forks count children that exit when the returned pipe is closed and adds
+// them to jobs. Returns write end of the pipe.
+static int start_batch(int count)
+{
+    int fds[2];
+    if (pipe(fds) == FAIL) {
+        perror("pipe");
+        return FAIL;
+    }
+    for (int i = 0; i < count; ++i) {
+        pid_t pid = fork();
+        if (pid == FAIL) {
+            perror("fork");
+            exit(EXIT_FAILURE);
+        }
+        if (pid == 0) {
+            char c;
+            close(fds[1]);
+            _exit(read(fds[0], &c, 1) == FAIL);
+        }
+
+        vec_size_t jobno = vec_size(jobs);
+        if (vec_job_resize(jobs, jobno + 1) == FAIL) {
+            perror("vec_job_resize");
+            exit(EXIT_FAILURE);
+        }
+        struct job* job = vec_at_ptr(jobs, jobno);
+        clear_job(job);
+        struct command cmd = {.pid = pid, .status = CLD_CONTINUED};
+        if (!(job->pipeline = vec_command_new())
+            || vec_command_push_back(job->pipeline, cmd) == FAIL
+            || add_job_pid(pid, jobno, 0) == FAIL) {
+            perror("job");
+            exit(EXIT_FAILURE);
+        }
+        job->pgid = job->pid = pid;
+        job->state = JOB_VALID;
+    }
+    close(fds[0]);
+    return fds[1];
+}
+
+int main(int argc, char** argv)
+{
+    int count = argc > 1 ? atoi(argv[1]) : DEFAULT_COUNT;
+    if (count <= 0) {
+        fprintf(stderr, "Usage: %s [count]\n", argv[0]);
+        return -1;
+    }
+
+    shell_outstream = stderr;
+    if (!(jobs = vec_job_new())) {
+        perror("vec_job_new");
+        return -1;
+    }
+    double reap_time = 0;
+    for (int started = 0; started < count; started += BATCH) {
+        int batch = count - started < BATCH ? count - started : BATCH;
+        int fd = start_batch(batch);
+        if (fd == FAIL)
+            return -1;
+        close(fd);
+        // Waits until every child of the batch is a zombie without reaping
+        for (vec_size_t i = vec_size(jobs) - batch; i < vec_size(jobs); ++i) {
+            siginfo_t info;
+            waitid(P_PID, vec_at_ptr(jobs, i)->pid, &info, WEXITED | WNOWAIT);
+        }
+
+        struct timespec begin, end;
+        clock_gettime(CLOCK_MONOTONIC, &begin);
+        reap_children();
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        reap_time += elapsed(&begin, &end);
+    }
+
+    int reaped = 0;
+    for (vec_size_t i = 0; i < vec_size(jobs); ++i) {
+        struct job* job = vec_at_ptr(jobs, i);
+        if (job->pipeline && vec_front(job->pipeline).status == CLD_EXITED)
+            ++reaped;
+    }
+    printf("reaped %d of %d children in %.3f ms, %.2f us per child\n",
+           reaped, count, reap_time * 1e3, reap_time * 1e6 / count);
+
+    vec_job_foreach(jobs, release_job);
+    vec_job_delete(jobs);
+    release_job_pids();
+    return reaped == count ? 0 : -1;
+}
@@ -0,0 +1,152 @@
+#ifndef OS_LABS_RSHELL_TESTS_RUN_RSHELL_H_
+#define OS_LABS_RSHELL_TESTS_RUN_RSHELL_H_
+
+// Runs rshell for test and benchmark drivers. Every driver only builds its
+// own arguments and environment.
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RUN_RSHELL_FAIL     -1
+#define RUN_RSHELL_IOLEN    4096
+
+// Options and results of a run of rshell
+struct rshell_run {
+    // Text written to the standard input through a pipe. It must fit the
+    // pipe's buffer. The caller's stdin is kept if NULL.
+    const char* input;
+    // STDOUT_FILENO or STDERR_FILENO of rshell that is read to output,
+    // nothing is read if 0
+    int output_fd;
+    // Sends the standard output to /dev/null unless it is read
+    bool quiet;
+
+    pid_t pid;
+    double elapsed;
+    // Usage of rshell includes children it has reaped
+    struct rusage usage;
+    // Read output, must be freed
+    char* output;
+};
+
+// Writes the whole text to the descriptor
+static int write_all(int fd, const char* text)
+{
+    for (size_t len = strlen(text); len; ) {
+        ssize_t count = write(fd, text, len);
+        if (count == RUN_RSHELL_FAIL) {
+            perror("write");
+            return RUN_RSHELL_FAIL;
+        }
+        text += count;
+        len -= count;
+    }
+    return 0;
+}
+
+// Reads the descriptor until EOF to the allocated string
+static char* read_all(int fd)
+{
+    size_t len = 0, size = RUN_RSHELL_IOLEN;
+    char* data = malloc(size);
+    ssize_t count;
+    while (data && (count = read(fd, data + len, size - len - 1)) > 0) {
+        len += count;
+        if (size - len == 1) {
+            char* bigger = realloc(data, size *= 2);
+            if (!bigger)
+                free(data);
+            data = bigger;
+        }
+    }
+    if (!data) {
+        perror("malloc");
+        return NULL;
+    }
+    data[len] = '\0';
+    return data;
+}
+
+// Runs rshell with the NULL-terminated argv, argv[0] is its path, and env.
+// Returns 0 if rshell exited with 0 and -1 otherwise.
+static int run_rshell(char* const* argv, char* const* env, struct rshell_run* run)
+{
+    int retval = RUN_RSHELL_FAIL;
+    int in[2] = {RUN_RSHELL_FAIL, RUN_RSHELL_FAIL};
+    int out[2] = {RUN_RSHELL_FAIL, RUN_RSHELL_FAIL};
+    run->output = NULL;
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+
+    if (run->input) {
+        if (pipe(in) == RUN_RSHELL_FAIL) {
+            perror("pipe");
+            goto RELEASE_RESOURCES;
+        }
+        if (write_all(in[1], run->input) == RUN_RSHELL_FAIL)
+            goto RELEASE_RESOURCES;
+        close(in[1]);
+        in[1] = RUN_RSHELL_FAIL;
+        posix_spawn_file_actions_adddup2(&actions, in[0], STDIN_FILENO);
+        posix_spawn_file_actions_addclose(&actions, in[0]);
+    }
+    if (run->quiet && run->output_fd != STDOUT_FILENO)
+        posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    if (run->output_fd) {
+        if (pipe(out) == RUN_RSHELL_FAIL) {
+            perror("pipe");
+            goto RELEASE_RESOURCES;
+        }
+        posix_spawn_file_actions_adddup2(&actions, out[1], run->output_fd);
+        posix_spawn_file_actions_addclose(&actions, out[0]);
+        posix_spawn_file_actions_addclose(&actions, out[1]);
+    }
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    int error = posix_spawn(&run->pid, argv[0], &actions, NULL, argv, env);
+    if (error) {
+        fprintf(stderr, "posix_spawn: %s\n", strerror(error));
+        goto RELEASE_RESOURCES;
+    }
+    if (run->output_fd) {
+        close(out[1]);
+        out[1] = RUN_RSHELL_FAIL;
+        run->output = read_all(out[0]);
+    }
+    int status;
+    if (wait4(run->pid, &status, 0, &run->usage) == RUN_RSHELL_FAIL
+        || !WIFEXITED(status) || WEXITSTATUS(status)) {
+        fprintf(stderr, "%s failed\n", argv[0]);
+        goto RELEASE_RESOURCES;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    run->elapsed = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+    if (!run->output_fd || run->output)
+        retval = 0;
+
+RELEASE_RESOURCES:
+    posix_spawn_file_actions_destroy(&actions);
+    for (int i = 0; i < 2; ++i) {
+        if (in[i] != RUN_RSHELL_FAIL)
+            close(in[i]);
+        if (out[i] != RUN_RSHELL_FAIL)
+            close(out[i]);
+    }
+    if (retval == RUN_RSHELL_FAIL) {
+        free(run->output);
+        run->output = NULL;
+    }
+    return retval;
+}
+
+#endif // OS_LABS_RSHELL_TESTS_RUN_RSHELL_H_
@@ -0,0 +1,79 @@
+// Checks that rshell runs executable files without #! by /bin/sh like
+// execvp(3) does, with both launch engines and in a pipeline.
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "run_rshell.h"
+
+#define FAIL            -1
+#define SCRIPT_LEN      (3 * PATH_MAX)
+
+// The script prints its arguments and fails, so || runs the next command
+#define SCRIPT_TEXT     "echo script $1 $2\nexit 3\n"
+#define EXPECTED        "script a b\nfailed\nscript c\n"
+
+// Launch engines of rshell
+static const char* const engines[] = {"RSHELL_LAUNCH=spawn", "RSHELL_LAUNCH=fork"};
+
+// Writes the executable script without #! to the temporary file
+static int write_script(char* path)
+{
+    int fd = mkstemp(path);
+    if (fd == FAIL) {
+        perror("script");
+        return FAIL;
+    }
+    ssize_t len = strlen(SCRIPT_TEXT);
+    if (write(fd, SCRIPT_TEXT, len) != len || fchmod(fd, 0700) == FAIL) {
+        perror("script");
+        close(fd);
+        return FAIL;
+    }
+    close(fd);
+    return 0;
+}
+
+// Runs rshell with the script and the engine. Returns its output or NULL.
+static char* run_script(const char* rshell, const char* script, const char* engine)
+{
+    char* env[] = {"PATH=/usr/bin:/bin", (char*)engine, NULL};
+    char* argv[] = {(char*)rshell, "-c", (char*)script, NULL};
+    struct rshell_run run = {.output_fd = STDOUT_FILENO};
+    return run_rshell(argv, env, &run) == FAIL ? NULL : run.output;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s rshell\n", argv[0]);
+        return -1;
+    }
+
+    char path[] = "/tmp/script_exec_XXXXXX";
+    if (write_script(path) == FAIL)
+        return -1;
+    char script[SCRIPT_LEN];
+    snprintf(script, sizeof(script), "%s a b || echo failed\n%s c | cat\n", path, path);
+
+    int retval = 0;
+    for (size_t i = 0; i < sizeof(engines) / sizeof(*engines); ++i) {
+        char* output = run_script(argv[1], script, engines[i]);
+        if (!output) {
+            retval = -1;
+            break;
+        }
+        int ok = strcmp(output, EXPECTED) == 0;
+        printf("%-20s %s\n", engines[i], ok ? "OK" : "FAILED");
+        if (!ok) {
+            printf("expected:\n%sgot:\n%s", EXPECTED, output);
+            retval = 1;
+        }
+        free(output);
+    }
+    unlink(path);
+    return retval;
+}
@@ -0,0 +1,86 @@
+// Checks that rshell reading commands from its standard input leaves the bytes
+// after the current line to the commands it runs, when stdin is a pipe and
+// when it is a file.
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "run_rshell.h"
+
+#define FAIL            -1
+
+// Input of rshell and what it must print. The commands read the line after
+// them from the same stdin.
+struct check {
+    const char* input;
+    const char* expected;
+};
+
+static const struct check checks[] = {
+    {"echo first\nhead -n1\nline-for-head\n", "first\nline-for-head\n"},
+    {"echo first\nhead -c 14\nline-for-head\necho after\n", "first\nline-for-head\nafter\n"},
+    {"cat | cat\npiped line\n", "piped line\n"},
+};
+
+// Runs rshell with the input through a pipe or from a temporary file.
+// Returns its output or NULL.
+static char* run_input(const char* rshell, const char* input, bool from_file)
+{
+    char* env[] = {"PATH=/usr/bin:/bin", NULL};
+    char* argv[] = {(char*)rshell, NULL};
+    struct rshell_run run = {.output_fd = STDOUT_FILENO};
+    if (!from_file) {
+        run.input = input;
+        return run_rshell(argv, env, &run) == FAIL ? NULL : run.output;
+    }
+
+    // rshell inherits stdin of the test
+    char path[] = "/tmp/stdin_test_XXXXXX";
+    int fd = mkstemp(path);
+    if (fd == FAIL) {
+        perror("input");
+        return NULL;
+    }
+    unlink(path);
+    int saved = dup(STDIN_FILENO);
+    char* output = NULL;
+    if (saved == FAIL || write_all(fd, input) == FAIL || lseek(fd, 0, SEEK_SET) == FAIL
+        || dup2(fd, STDIN_FILENO) == FAIL) {
+        perror("input");
+    }
+    else if (run_rshell(argv, env, &run) != FAIL) {
+        output = run.output;
+    }
+    if (saved != FAIL) {
+        dup2(saved, STDIN_FILENO);
+        close(saved);
+    }
+    close(fd);
+    return output;
+}
+
+int main(int argc, char** argv)
+{
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s rshell\n", argv[0]);
+        return -1;
+    }
+
+    int retval = 0;
+    for (size_t i = 0; i < sizeof(checks) / sizeof(*checks); ++i) {
+        for (int from_file = 0; from_file < 2; ++from_file) {
+            char* output = run_input(argv[1], checks[i].input, from_file);
+            if (!output)
+                return -1;
+            int ok = strcmp(output, checks[i].expected) == 0;
+            printf("%zu %-5s %s\n", i + 1, from_file ? "file" : "pipe", ok ? "OK" : "FAILED");
+            if (!ok) {
+                printf("expected:\n%sgot:\n%s", checks[i].expected, output);
+                retval = 1;
+            }
+            free(output);
+        }
+    }
+    return retval;
+}
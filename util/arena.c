@@ -0,0 +1,129 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Enough for a usual line with a few commands
+#define ARENA_CHUNK_SIZE    4096
+#define ARENA_ALIGN         alignof(max_align_t)
+
+struct arena_chunk {
+    struct arena_chunk* next;
+    size_t size;
+    size_t used;
+    alignas(max_align_t) unsigned char data[];
+};
+
+struct arena {
+    // The current chunk, older chunks follow it
+    struct arena_chunk* head;
+    // The last allocation, it may grow in place
+    void* last;
+};
+
+// Allocates chunk that fits at least size bytes and makes it the current one
+static struct arena_chunk* add_chunk(struct arena* self, size_t size);
+
+// Rounds size up to the alignment
+static size_t align_size(size_t size);
+
+struct arena* arena_new()
+{
+    struct arena* self = (struct arena*)calloc(1, sizeof(struct arena));
+    if (!self)
+        return NULL;
+    if (!add_chunk(self, ARENA_CHUNK_SIZE)) {
+        free(self);
+        return NULL;
+    }
+    return self;
+}
+
+void arena_delete(struct arena* self)
+{
+    if (!self)
+        return;
+    while (self->head) {
+        struct arena_chunk* next = self->head->next;
+        free(self->head);
+        self->head = next;
+    }
+    free(self);
+}
+
+void* arena_alloc(struct arena* self, size_t size)
+{
+    if (!self)
+        return NULL;
+
+    size = align_size(size);
+    struct arena_chunk* chunk = self->head;
+    if (chunk->size - chunk->used < size) {
+        // Big allocations get their own chunk
+        if (!(chunk = add_chunk(self, size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE)))
+            return NULL;
+    }
+    self->last = chunk->data + chunk->used;
+    chunk->used += size;
+    return self->last;
+}
+
+void* arena_realloc(struct arena* self, void* ptr, size_t old_size, size_t size)
+{
+    if (!self)
+        return NULL;
+    if (!ptr)
+        return arena_alloc(self, size);
+
+    // The last allocation of the current chunk is just extended
+    struct arena_chunk* chunk = self->head;
+    if (ptr == self->last) {
+        size_t begin = (unsigned char*)ptr - chunk->data;
+        if (chunk->size - begin >= align_size(size)) {
+            chunk->used = begin + align_size(size);
+            return ptr;
+        }
+    }
+    if (size <= old_size)
+        return ptr;
+
+    void* new_ptr = arena_alloc(self, size);
+    if (new_ptr)
+        memcpy(new_ptr, ptr, old_size);
+    return new_ptr;
+}
+
+void arena_reset(struct arena* self)
+{
+    if (!self)
+        return;
+
+    // The first chunk is the last one in the list
+    while (self->head->next) {
+        struct arena_chunk* next = self->head->next;
+        free(self->head);
+        self->head = next;
+    }
+    self->head->used = 0;
+    self->last = NULL;
+}
+
+static struct arena_chunk* add_chunk(struct arena* self, size_t size)
+{
+    struct arena_chunk* chunk =
+        (struct arena_chunk*)malloc(sizeof(struct arena_chunk) + size);
+    if (!chunk)
+        return NULL;
+    chunk->next = self->head;
+    chunk->size = size;
+    chunk->used = 0;
+    self->head = chunk;
+    return chunk;
+}
+
+static size_t align_size(size_t size)
+{
+    return (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
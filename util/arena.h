@@ -0,0 +1,27 @@
+#ifndef OS_LABS_RSHELL_UTIL_ARENA_H_
+#define OS_LABS_RSHELL_UTIL_ARENA_H_
+
+#include <stddef.h>
+
+// Bump allocator. Memory is taken from big chunks and is never freed one by
+// one, the whole arena is reset or deleted at once.
+struct arena;
+
+// Allocates new arena. It must be freed with arena_delete()
+struct arena* arena_new();
+
+// Frees all memory of the arena. Works with NULL.
+void arena_delete(struct arena* self);
+
+// Returns aligned memory of size bytes or NULL.
+void* arena_alloc(struct arena* self, size_t size);
+
+// Changes size of the memory allocated from the arena. The last allocation
+// grows in place if there is space, otherwise data is copied. ptr may be NULL.
+void* arena_realloc(struct arena* self, void* ptr, size_t old_size, size_t size);
+
+// Forgets every allocation but keeps the first chunk, so the arena may be
+// reused without asking for memory again.
+void arena_reset(struct arena* self);
+
+#endif // OS_LABS_RSHELL_UTIL_ARENA_H_
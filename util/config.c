@@ -1,13 +1,14 @@
 #include "config.h"
 
 bool internal_executing;
+bool shell_interactive;
+int shell_launch_engine;
+struct bg_limits shell_bg_limits;
 struct vec_job_t* jobs;
 pid_t shell_pgrp;
 int shell_tty;
 int shell_outfd;
 FILE* shell_outstream;
-struct sp_string_t* parsing_line;
+struct sp_line_t* parsing_line;
 struct termios shell_attr;
 struct termios prev_attr;
-pid_t waited_pid;
-int waiting_pipe[2];
@@ -33,6 +33,10 @@
 #   define _shell_log_call(x) x
 #endif
 
+// Descriptors of the shell are not lower than this so redirections of the 
+// internal commands executed in the shell won't overwrite them
+#define SHELL_FD_MIN 10
+
 // Output specific defines
 #define SHELL "rshell"
 #define _shell_pperror(str) pperrorf(str, "rshell: %s", str)
@@ -50,14 +54,38 @@
         fflush(shell_outstream); \
     } while (0) 
 
+// Ways to start external programs
+enum LAUNCH_ENGINE {
+    LAUNCH_SPAWN,   // posix_spawn(3), does not copy the shell's memory
+    LAUNCH_FORK,    // fork(2) and exec(3)
+};
+
+// Limits of running background jobs, jobs over them wait in the queue. Zero
+// value means no limit.
+struct bg_limits {
+    size_t jobs;
+    // One-minute load average
+    double load;
+    // MemAvailable from /proc/meminfo in kB
+    size_t mem_kb;
+};
+
 // Forward declarations
 struct vec_job_t;
-struct sp_string_t;
+struct sp_line_t;
 struct termios;
 
 // 0 if it's main shell, 1 if it's not. It's used to exit the child for 
 // internal shell functions or to leave on SIGHUP.
 extern bool internal_executing;
+// True iff the shell reads commands from a terminal and controls jobs. 
+// Scripts, -c strings and piped input run without any terminal handoff.
+extern bool shell_interactive;
+// Engine for external programs, one of LAUNCH_ENGINE. Internal commands are 
+// always forked.
+extern int shell_launch_engine;
+// Limits of background jobs
+extern struct bg_limits shell_bg_limits;
 // Vector of jobs
 extern struct vec_job_t* jobs;
 // Shell's pgid
@@ -70,14 +98,10 @@ extern int shell_outfd;
 extern FILE* shell_outstream;
 // Shared pointer for parsing line. It must be reset every time and released
 // after every job that holds pointer is freed.
-extern struct sp_string_t* parsing_line;
+extern struct sp_line_t* parsing_line;
 // Terminal attributes of the rshell
 extern struct termios shell_attr;
 // Attributes in the terminal that were set before shell was run
 extern struct termios prev_attr;
-// Pid that is being waited for
-extern pid_t waited_pid;
-// Pipe for passing statuses of the process with waited_pid
-extern int waiting_pipe[2];
 
 #endif // OS_LABS_RSHELL_UTIL_CONFIG_H_
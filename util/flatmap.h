@@ -5,7 +5,9 @@
 // fm_key_cmp -- comporator for keys
 
 // fm_data_t -- type of data
-// fm_free_data -- frees data
+// fm_free_data -- frees data, gets pointer to data if fm_inline_size is set
+
+// fm_inline_size -- optional, number of nodes kept inside the structure
 
 #define fm_etcat(a, b, c)   a##_##b##_##c
 #define fm_tcat(a, b, c)    fm_etcat(a, b, c)
@@ -23,16 +25,52 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
 #include "binsearch.h"
 
+#ifdef fm_inline_size
+
+// Inline flatmap holds data by value and keeps the first fm_inline_size nodes
+// inside the structure, so it's embedded into other structures and allocates
+// nothing until it grows bigger. Zeroed structure is an empty flatmap.
+// Copying it moves the nodes, the source must be initialized again.
+struct _fm(node_t) {
+    fm_key_t key;
+    fm_data_t data;
+};
+
+struct _fm(t) {
+    size_t size;
+    // Capacity of heap. Nodes are in heap iff it's not NULL.
+    size_t capacity;
+    struct _fm(node_t)* heap;
+    struct _fm(node_t) nodes[fm_inline_size];
+};
+
+// Makes self an empty flatmap. It must be released with _fm(release)()
+void _fm(init)(struct _fm(t)* self);
+// Frees all memory that is located in the flatmap. It stays empty and may be
+// used again.
+void _fm(release)(struct _fm(t)* self);
+
+#else
+
 struct _fm(node_t);
 struct _fm(t);
 
 // Allocates new flatmap. It must be freed with _fm(delete)()
 struct _fm(t)* _fm(new)();
+// Allocates new flatmap in the arena. _fm(delete)() only frees keys and data,
+// the rest is freed with the arena. If arena is NULL, it's the same as 
+// _fm(new)().
+struct _fm(t)* _fm(new_in)(struct arena* arena);
 // Frees all memory that is located in the flatmap. 
 void _fm(delete)(struct _fm(t)* self);
 
+#endif // fm_inline_size
+
+// Returns number of elements
+size_t _fm(size)(const struct _fm(t)* self);
 // Returns true iff there is data for the passed key.
 // If such element found and data is not NULL, it will be filled with the
 // corresponding data.
@@ -44,14 +82,168 @@ bool _fm(insert)(struct _fm(t)* self, fm_key_t key, fm_data_t data);
 // Cleares all the elements with calling corresponding free functions for key 
 // and data.
 void _fm(clear)(struct _fm(t)* self);
-// Calls func() from every element. 
+// Calls func() from every element. Inline flatmap passes pointer to data.
 // Trying to free memory of key or data will cause double free.
+#ifdef fm_inline_size
+void _fm(foreach)(struct _fm(t)* self, void (*func)(const fm_key_t, fm_data_t*, void*), 
+                  void* arg);
+#else
 void _fm(foreach)(struct _fm(t)* self, void (*func)(const fm_key_t, fm_data_t, void*), 
                   void* arg);
+#endif
 
 #endif // FM_HEADER
 
-#ifdef FM_SOURCE
+#if defined(FM_SOURCE) && defined(fm_inline_size)
+
+// Returns the first node
+static struct _fm(node_t)* _fm(begin)(struct _fm(t)* self)
+{
+    return self->heap ? self->heap : self->nodes;
+}
+
+// Returns the node with the key or the node before which it must be placed
+static struct _fm(node_t)* _fm(lower_bound)(struct _fm(t)* self, const fm_key_t key)
+{
+    struct _fm(node_t)* node = _fm(begin)(self);
+    size_t left = 0;
+    size_t right = self->size;
+    // Usually there are few nodes, so the loop is short
+    while (left < right) {
+        size_t middle = left + (right - left) / 2;
+        if (fm_key_cmp(node[middle].key, key) < 0)
+            left = middle + 1;
+        else
+            right = middle;
+    }
+    return node + left;
+}
+
+// Makes place for one more node. Nodes are moved to the heap when inline ones
+// are over.
+static bool _fm(grow)(struct _fm(t)* self)
+{
+    size_t capacity = self->heap ? self->capacity : fm_inline_size;
+    if (self->size < capacity)
+        return true;
+
+    capacity *= 2;
+    struct _fm(node_t)* heap = (struct _fm(node_t)*)realloc(
+        self->heap, capacity * sizeof(struct _fm(node_t)));
+    if (!heap)
+        return false;
+    if (!self->heap)
+        memcpy(heap, self->nodes, self->size * sizeof(struct _fm(node_t)));
+    self->heap = heap;
+    self->capacity = capacity;
+    return true;
+}
+
+static void _fm(free_node)(struct _fm(node_t)* node)
+{
+    fm_free_key(node->key);
+    fm_free_data(&node->data);
+}
+
+void _fm(init)(struct _fm(t)* self)
+{
+    assert(self);
+
+    self->size = 0;
+    self->capacity = 0;
+    self->heap = NULL;
+}
+
+void _fm(release)(struct _fm(t)* self)
+{
+    if (!self)
+        return;
+
+    _fm(clear)(self);
+    free(self->heap);
+    _fm(init)(self);
+}
+
+size_t _fm(size)(const struct _fm(t)* self)
+{
+    assert(self);
+
+    return self->size;
+}
+
+bool _fm(find)(struct _fm(t)* self, const fm_key_t key, fm_data_t* data)
+{
+    assert(self);
+
+    struct _fm(node_t)* found = _fm(lower_bound)(self, key);
+    // Not found
+    if (found == _fm(begin)(self) + self->size || fm_key_cmp(found->key, key) != 0)
+        return false;
+
+    if (data)
+        *data = found->data;
+    return true;
+}
+
+void _fm(erase)(struct _fm(t)* self, const fm_key_t key)
+{
+    assert(self);
+
+    struct _fm(node_t)* found = _fm(lower_bound)(self, key);
+    struct _fm(node_t)* end = _fm(begin)(self) + self->size;
+    // Not found
+    if (found == end || fm_key_cmp(found->key, key) != 0)
+        return;
+
+    _fm(free_node)(found);
+    memmove(found, found + 1, (end - found - 1) * sizeof(struct _fm(node_t)));
+    --self->size;
+}
+
+bool _fm(insert)(struct _fm(t)* self, fm_key_t key, fm_data_t data)
+{
+    assert(self);
+
+    struct _fm(node_t)* found = _fm(lower_bound)(self, key);
+    // Replaces data in the found node
+    if (found != _fm(begin)(self) + self->size && fm_key_cmp(found->key, key) == 0) {
+        fm_free_data(&found->data);
+        found->data = data;
+        return true;
+    }
+
+    // Remembers relative position because nodes may move to the heap
+    size_t pos = found - _fm(begin)(self);
+    if (!_fm(grow)(self))
+        return false;
+    found = _fm(begin)(self) + pos;
+    memmove(found + 1, found, (self->size - pos) * sizeof(struct _fm(node_t)));
+    *found = (struct _fm(node_t)){.key = key, .data = data};
+    ++self->size;
+    return true;
+}
+
+void _fm(clear)(struct _fm(t)* self)
+{
+    assert(self);
+
+    struct _fm(node_t)* node = _fm(begin)(self);
+    for (size_t i = 0; i < self->size; ++i)
+        _fm(free_node)(node + i);
+    self->size = 0;
+}
+
+void _fm(foreach)(struct _fm(t)* self, void (*func)(const fm_key_t, fm_data_t*, void*), 
+                  void* arg)
+{
+    if (!self || !func)
+        return;
+    struct _fm(node_t)* node = _fm(begin)(self);
+    for (size_t i = 0; i < self->size; ++i)
+        func(node[i].key, &node[i].data, arg);
+}
+
+#elif defined(FM_SOURCE)
 
 struct _fm(node_t) {
     fm_key_t key;
@@ -103,14 +295,34 @@ struct _fm(t)* _fm(new)()
     return self;
 }
 
+struct _fm(t)* _fm(new_in)(struct arena* arena)
+{
+    if (!arena)
+        return _fm(new)();
+
+    struct _fm(t)* self = (struct _fm(t)*)arena_alloc(arena, sizeof(struct _fm(t)));
+    if (!self || !(self->vec = vec_call(new_in)(arena)))
+        return NULL;
+    return self;
+}
+
 void _fm(delete)(struct _fm(t)* self)
 {
     if (!self)
         return;
 
     vec_call(foreach)(self->vec, _fm(free_node));
+    bool in_arena = self->vec->arena;
     vec_call(delete)(self->vec);
-    free(self);
+    if (!in_arena)
+        free(self);
+}
+
+size_t _fm(size)(const struct _fm(t)* self)
+{
+    assert(self);
+
+    return vec_size(self->vec);
 }
 
 bool _fm(find)(struct _fm(t)* self, const fm_key_t key, fm_data_t* data)
@@ -232,7 +444,7 @@ void _fm(foreach)(struct _fm(t)* self, void (*func)(const fm_key_t, fm_data_t, v
 }
 
 #undef vec_call
-#endif // FM_SOURCE
+#endif // FM_SOURCE && fm_inline_size
 
 #if defined(FM_UNDEF) || defined(FM_SOURCE)
 #   undef FM_HEADER
@@ -242,6 +454,7 @@ void _fm(foreach)(struct _fm(t)* self, void (*func)(const fm_key_t, fm_data_t, v
 #   undef fm_key_cmp
 #   undef fm_data_t
 #   undef fm_free_data
+#   undef fm_inline_size
 #endif 
 
 #undef fm_tcat
@@ -0,0 +1,39 @@
+#define SP_SOURCE
+#include "line.h"
+#undef SP_SOURCE
+
+#include <stdlib.h>
+
+#define FAIL    -1
+#define SUCCESS 0
+
+struct line* line_new()
+{
+    struct line* self = (struct line*)malloc(sizeof(struct line));
+    if (!self)
+        return NULL;
+    if (!(self->arena = arena_new()))
+        goto ERROR_HANDLER;
+    if (!(self->text = vec_char_new_in(self->arena)))
+        goto ERROR_HANDLER;
+    return self;
+
+ERROR_HANDLER:
+    arena_delete(self->arena);
+    free(self);
+    return NULL;
+}
+
+void line_delete(struct line* self)
+{
+    if (!self)
+        return;
+    arena_delete(self->arena);
+    free(self);
+}
+
+int line_reset(struct line* self)
+{
+    arena_reset(self->arena);
+    return (self->text = vec_char_new_in(self->arena)) ? SUCCESS : FAIL;
+}
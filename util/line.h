@@ -0,0 +1,30 @@
+#ifndef OS_LABS_RSHELL_UTIL_LINE_H_
+#define OS_LABS_RSHELL_UTIL_LINE_H_
+
+#include "arena.h"
+#include "vec_string.h"
+
+// Parsing line. Its text and everything parsed from it (args, redirections,
+// pipelines) are allocated in the arena, so they are freed at once.
+struct line {
+    struct vec_char_t* text;
+    struct arena* arena;
+};
+
+// Allocates line with empty text. It must be freed with line_delete()
+struct line* line_new();
+
+// Frees the text and the arena. Works with NULL.
+void line_delete(struct line* self);
+
+// Forgets the text and everything parsed from it but keeps memory of the
+// arena. Returns 0 on success or -1 on error.
+int line_reset(struct line* self);
+
+// Shared ptr for the line
+#define sp_name     line
+#define sp_elem_t   struct line
+#define sp_dstr     line_delete
+#include "shared_ptr.h"
+
+#endif // OS_LABS_RSHELL_UTIL_LINE_H_
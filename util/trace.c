@@ -0,0 +1,187 @@
+#include "trace.h"
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+
+#define FAIL            -1
+#define SUCCESS         0
+// Events after this number are counted, but not recorded
+#define TRACE_CAPACITY  (1 << 16)
+#define TRACE_FILE_MODE 0664
+#define NSEC_PER_SEC    1000000000ull
+#define NSEC_PER_USEC   1e3
+
+// Phases of the trace event format
+#define PHASE_COMPLETE  'X'
+#define PHASE_INSTANT   'i'
+
+struct trace_event {
+    const char* name;
+    const char* arg_name;
+    long arg;
+    pid_t pid;
+    char phase;
+    uint64_t start;
+    uint64_t end;
+};
+
+// Buffer shared with forked children, so they may record events before exec
+struct trace_buffer {
+    // Number of reserved events, may be bigger than TRACE_CAPACITY
+    atomic_size_t size;
+    struct trace_event events[TRACE_CAPACITY];
+};
+
+static struct trace_buffer* buffer;
+static int trace_fd = FAIL;
+// The process that writes the trace
+static pid_t trace_pid;
+// Timestamps are written relative to this
+static uint64_t trace_start;
+
+// Returns monotonic time in nanoseconds
+static uint64_t now();
+
+// Reserves event and fills it
+static void record(char phase, const char* name, uint64_t start,
+                   const char* arg_name, long arg);
+
+// Writes one event as JSON object
+static void write_event(FILE* file, const struct trace_event* event);
+
+int init_trace(const char* name)
+{
+    const char* file_name = getenv(name);
+    if (!file_name || !*file_name)
+        return SUCCESS;
+
+    int fd = open(file_name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, TRACE_FILE_MODE);
+    if (fd == FAIL) {
+        _shell_pperror(file_name);
+        return FAIL;
+    }
+    // Redirections of the internal commands won't replace it
+    trace_fd = fcntl(fd, F_DUPFD_CLOEXEC, SHELL_FD_MIN);
+    close(fd);
+    if (trace_fd == FAIL) {
+        _shell_pperror(file_name);
+        return FAIL;
+    }
+
+    // Pages are taken only when events are written to them
+    void* mem = mmap(NULL, sizeof(struct trace_buffer), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_ANONYMOUS, FAIL, 0);
+    if (mem == MAP_FAILED) {
+        _shell_pperror("trace");
+        close(trace_fd);
+        trace_fd = FAIL;
+        return FAIL;
+    }
+    buffer = (struct trace_buffer*)mem;
+    atomic_init(&buffer->size, 0);
+    trace_pid = getpid();
+    trace_start = now();
+    return SUCCESS;
+}
+
+void release_trace()
+{
+    if (!buffer)
+        return;
+
+    if (getpid() == trace_pid) {
+        FILE* file = fdopen(trace_fd, "w");
+        if (!file) {
+            _shell_pperror("trace");
+            close(trace_fd);
+        }
+        else {
+            size_t size = atomic_load(&buffer->size);
+            size_t count = size < TRACE_CAPACITY ? size : TRACE_CAPACITY;
+            fprintf(file, "{\"traceEvents\":[\n");
+            fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%jd,"
+                    "\"args\":{\"name\":\"" SHELL "\"}}", (intmax_t)trace_pid);
+            for (size_t i = 0; i < count; ++i) {
+                // A child could be killed before it filled the reserved event
+                if (!buffer->events[i].name)
+                    continue;
+                fprintf(file, ",\n");
+                write_event(file, buffer->events + i);
+            }
+            fprintf(file, "\n],\"displayTimeUnit\":\"ns\","
+                    "\"otherData\":{\"dropped\":%zu}}\n", size - count);
+            if (fclose(file) == EOF)
+                _shell_pperror("trace");
+        }
+    }
+    else {
+        close(trace_fd);
+    }
+    munmap(buffer, sizeof(struct trace_buffer));
+    buffer = NULL;
+    trace_fd = FAIL;
+}
+
+uint64_t trace_begin()
+{
+    return buffer ? now() : 0;
+}
+
+void trace_complete(const char* name, uint64_t start, const char* arg_name, long arg)
+{
+    if (buffer)
+        record(PHASE_COMPLETE, name, start, arg_name, arg);
+}
+
+void trace_instant(const char* name, const char* arg_name, long arg)
+{
+    if (buffer)
+        record(PHASE_INSTANT, name, 0, arg_name, arg);
+}
+
+static uint64_t now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+static void record(char phase, const char* name, uint64_t start,
+                   const char* arg_name, long arg)
+{
+    uint64_t end = now();
+    // Children may record at the same time
+    size_t i = atomic_fetch_add(&buffer->size, 1);
+    if (i >= TRACE_CAPACITY)
+        return;
+    buffer->events[i] = (struct trace_event){.name = name,
+                                             .arg_name = arg_name,
+                                             .arg = arg,
+                                             .pid = getpid(),
+                                             .phase = phase,
+                                             .start = phase == PHASE_INSTANT ? end : start,
+                                             .end = end};
+}
+
+static void write_event(FILE* file, const struct trace_event* event)
+{
+    fprintf(file, "{\"name\":\"%s\",\"ph\":\"%c\",\"pid\":%jd,\"tid\":%jd,\"ts\":%.3f",
+            event->name, event->phase, (intmax_t)event->pid, (intmax_t)event->pid,
+            (event->start - trace_start) / NSEC_PER_USEC);
+    if (event->phase == PHASE_COMPLETE)
+        fprintf(file, ",\"dur\":%.3f", (event->end - event->start) / NSEC_PER_USEC);
+    // Instant events are drawn on the thread's track
+    else
+        fprintf(file, ",\"s\":\"t\"");
+    if (event->arg_name)
+        fprintf(file, ",\"args\":{\"%s\":%ld}", event->arg_name, event->arg);
+    fprintf(file, "}");
+}
@@ -0,0 +1,29 @@
+#ifndef OS_LABS_RSHELL_UTIL_TRACE_H_
+#define OS_LABS_RSHELL_UTIL_TRACE_H_
+
+#include <stdint.h>
+
+// Timeline of the shell's execution in Chrome trace event format. Events are
+// kept in memory shared with forked children and are written when tracing is
+// released, so tracing does not add writes between commands.
+
+// Starts tracing if the environment variable name holds a file name. The file
+// is created now, so later changes of the directory don't matter.
+// Returns 0 if tracing is started or not requested, -1 on error.
+int init_trace(const char* name);
+
+// Writes all events to the file and stops tracing. Processes forked by the
+// shell only stop tracing.
+void release_trace();
+
+// Returns the start time for trace_complete() or 0 if tracing is off
+uint64_t trace_begin();
+
+// Records event that lasted from start until now. Name and arg_name must be
+// string literals, only pointers are stored. arg_name may be NULL.
+void trace_complete(const char* name, uint64_t start, const char* arg_name, long arg);
+
+// Records event of the current moment. The same as trace_complete().
+void trace_instant(const char* name, const char* arg_name, long arg);
+
+#endif // OS_LABS_RSHELL_UTIL_TRACE_H_
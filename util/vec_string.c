@@ -1,5 +1,3 @@
 #define VEC_SOURCE
-#define SP_SOURCE
 #include "vec_string.h"
-#undef SP_SOURCE
 #undef VEC_SOURCE
@@ -2,6 +2,7 @@
 /**
  * vec_name -- vector name for all functions and structures
  * vec_elem_t -- type of vector element
+ * vec_inline_size -- optional, number of elements kept inside the structure
  */
 
 #define vec_cat(a, b) vec##_##a##_##b
@@ -12,9 +13,12 @@
 #define VEC_HEADER
 
 #include <assert.h>
+#include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "arena.h"
+
 #ifndef VEC_TYPEDEFS
 #define VEC_TYPEDEFS
 
@@ -24,11 +28,19 @@ typedef size_t vec_size_t;
 
 #define VEC_FAIL            -1
 #define VEC_SUCCESS         0
+// The first allocation has at least this capacity
+#define VEC_MIN_CAPACITY    4
 
 struct _vec(t) {
     vec_elem_t* data;
     vec_size_t size;
     vec_size_t capacity;
+    // Arena that owns the memory or NULL if it's allocated with malloc(3)
+    struct arena* arena;
+#ifdef vec_inline_size
+    // Small vectors keep elements here, so the structure must not be copied
+    vec_elem_t buffer[vec_inline_size];
+#endif
 };
 
 #define vec_size(vec)       ( (vec)->size       )
@@ -44,6 +56,9 @@ struct _vec(t) {
 
 // Allocates new vector that must be freed with _vec(delete)()
 struct _vec(t)* _vec(new)();
+// Allocates new vector in the arena. Its memory is freed with the arena, 
+// _vec(delete)() does nothing. If arena is NULL, it's the same as _vec(new)().
+struct _vec(t)* _vec(new_in)(struct arena* arena);
 // Frees memory that was allocated by vector.
 // Does not free any elements inside. To free them use _vec(foreach)()
 // It does not free element to make the vector faster.
@@ -52,10 +67,16 @@ void _vec(delete)(struct _vec(t)* vec);
 // Pushes elem to the end. Increases size, may be resized after that.
 int _vec(push_back)(struct _vec(t)* vec, vec_elem_t elem);
 int _vec(push_back_by_ptr)(struct _vec(t)* vec, vec_elem_t* elem);
+// Adds an element with garbage to the end and returns pointer to it or NULL.
+vec_elem_t* _vec(emplace_back)(struct _vec(t)* vec);
 // Removes last element if there is such.
 void _vec(pop_back)(struct _vec(t)* vec);
 // Shanges size. If the new size is greater than previous, it may contain garbage.
 int _vec(resize)(struct _vec(t)* vec, vec_size_t size);
+// Makes capacity at least the passed one. Does not change size.
+int _vec(reserve)(struct _vec(t)* vec, vec_size_t capacity);
+// Frees unused capacity. Does nothing for vectors in an arena.
+void _vec(shrink_to_fit)(struct _vec(t)* vec);
 // Cleares the vector. Does not free any memory. Be advised to use _vec(foreach)()
 void _vec(clear)(struct _vec(t)* vec);
 // Calls func() to every element in the vector. It's safe to change them
@@ -67,16 +88,96 @@ void _vec(put)(struct _vec(t)* vec, vec_size_t pos, vec_elem_t elem);
 
 #ifdef VEC_SOURCE
 
+// Returns true iff the elements are in the vector's buffer
+static inline bool _vec(is_inline)(const struct _vec(t)* vec)
+{
+#ifdef vec_inline_size
+    return vec->data == vec->buffer;
+#else
+    (void)vec;
+    return false;
+#endif
+}
+
+// Sets empty storage of the new vector
+static void _vec(init)(struct _vec(t)* vec, struct arena* arena)
+{
+    *vec = (struct _vec(t)){.data = NULL, .size = 0, .capacity = 0, .arena = arena};
+#ifdef vec_inline_size
+    vec->data = vec->buffer;
+    vec->capacity = vec_inline_size;
+#endif
+}
+
+// Moves elements to the storage of the passed capacity that is not less 
+// than size. Returns VEC_SUCCESS on success, otherwise returns VEC_FAIL.
+static int _vec(realloc)(struct _vec(t)* vec, vec_size_t capacity)
+{
+    vec_elem_t* new_addr = NULL;
+#ifdef vec_inline_size
+    if (capacity <= vec_inline_size) {
+        if (!_vec(is_inline)(vec)) {
+            memcpy(vec->buffer, vec->data, vec->size * sizeof(vec_elem_t));
+            if (!vec->arena)
+                free(vec->data);
+        }
+        vec->data = vec->buffer;
+        vec->capacity = vec_inline_size;
+        return VEC_SUCCESS;
+    }
+#endif
+    if (_vec(is_inline)(vec)) {
+        new_addr = vec->arena 
+            ? (vec_elem_t*)arena_alloc(vec->arena, capacity * sizeof(vec_elem_t))
+            : (vec_elem_t*)malloc(capacity * sizeof(vec_elem_t));
+        if (new_addr)
+            memcpy(new_addr, vec->data, vec->size * sizeof(vec_elem_t));
+    }
+    else if (vec->arena) {
+        new_addr = (vec_elem_t*)arena_realloc(vec->arena, vec->data, 
+                                              vec->capacity * sizeof(vec_elem_t),
+                                              capacity * sizeof(vec_elem_t));
+    }
+    else if (capacity) {
+        new_addr = (vec_elem_t*)realloc(vec->data, capacity * sizeof(vec_elem_t));
+    }
+    else {
+        free(vec->data);
+    }
+    if (new_addr == NULL && capacity)
+        return VEC_FAIL;
+
+    vec->data = new_addr;
+    vec->capacity = capacity;
+    return VEC_SUCCESS;
+}
+
 // Creates new vector
 struct _vec(t)* _vec(new)()
 {
-    return (struct _vec(t)*)calloc(sizeof(struct _vec(t)), 1);
+    struct _vec(t)* vec = (struct _vec(t)*)malloc(sizeof(struct _vec(t)));
+    if (vec)
+        _vec(init)(vec, NULL);
+    return vec;
+}
+
+struct _vec(t)* _vec(new_in)(struct arena* arena)
+{
+    if (!arena)
+        return _vec(new)();
+
+    struct _vec(t)* vec = (struct _vec(t)*)arena_alloc(arena, sizeof(struct _vec(t)));
+    if (vec)
+        _vec(init)(vec, arena);
+    return vec;
 }
 
 // Frees all memory of the vector
 void _vec(delete)(struct _vec(t)* vec)
 {
-    if (vec != NULL)
+    if (vec != NULL && vec->arena)
+        return;
+    if (vec != NULL && !_vec(is_inline)(vec))
         free(vec->data);
     free(vec);
 }
@@ -123,8 +224,20 @@ int _vec(push_back_by_ptr)(struct _vec(t)* vec, vec_elem_t* elem)
     return VEC_SUCCESS;
 }
 
+vec_elem_t* _vec(emplace_back)(struct _vec(t)* vec)
+{
+    if (!vec)
+        return NULL;
+
+    if (vec->size < vec->capacity)
+        return &vec->data[vec->size++];
+    if (_vec(resize)(vec, vec->size + 1) == VEC_FAIL)
+        return NULL;
+    return &vec->data[vec->size - 1];
+}
+
 // Tries to resize vector. Does nothing if the current capacity is bigger.
-// Size will be changed to capacity on success.
+// Capacity is at least doubled, so pushing is amortized O(1).
 // Returns VEC_SUCCESS on success, otherwise returns VEC_FAIL.
 int _vec(resize)(struct _vec(t)* vec, vec_size_t size)
 {
@@ -137,30 +250,41 @@ int _vec(resize)(struct _vec(t)* vec, vec_size_t size)
         return VEC_SUCCESS;
     }
 
-    vec_size_t smart_capacity = size << 1;
-    while (smart_capacity & (smart_capacity - 1))
-        smart_capacity = smart_capacity & (smart_capacity - 1);
+    vec_size_t smart_capacity = vec->capacity * 2;
+    if (smart_capacity < size)
+        smart_capacity = size;
+    if (smart_capacity < VEC_MIN_CAPACITY)
+        smart_capacity = VEC_MIN_CAPACITY;
 
     assert(smart_capacity >= size); // check overflow
 
-    vec_elem_t* new_addr = (vec_elem_t*)realloc(vec->data, smart_capacity * sizeof(vec_elem_t));
-    if (new_addr == NULL) {
+    if (_vec(realloc)(vec, smart_capacity) == VEC_FAIL) {
         // Last try
-        new_addr = (vec_elem_t*)realloc(vec->data, size * sizeof(vec_elem_t));
-        if (new_addr == NULL)
+        if (_vec(realloc)(vec, size) == VEC_FAIL)
             return VEC_FAIL;
-
-        smart_capacity = size;
     }
 
-    // Finally, if everything is OK, updates values in the structure
-    vec->data = new_addr;
     vec->size = size;
-    vec->capacity = smart_capacity;
-
     return VEC_SUCCESS;
 }
 
+int _vec(reserve)(struct _vec(t)* vec, vec_size_t capacity)
+{
+    if (!vec)
+        return VEC_FAIL;
+    if (vec->capacity >= capacity)
+        return VEC_SUCCESS;
+    return _vec(realloc)(vec, capacity);
+}
+
+void _vec(shrink_to_fit)(struct _vec(t)* vec)
+{
+    if (!vec || vec->arena || vec->capacity == vec->size || _vec(is_inline)(vec))
+        return;
+    // The capacity is kept if realloc(3) fails
+    _vec(realloc)(vec, vec->size);
+}
+
 // Removes last element or does nothing, if there is no such element.
 void _vec(pop_back)(struct _vec(t)* vec)
 {
@@ -208,6 +332,7 @@ void _vec(put)(struct _vec(t)* vec, vec_size_t pos, vec_elem_t elem)
 #   undef VEC_HEADER
 #   undef vec_name
 #   undef vec_elem_t
+#   undef vec_inline_size
 #endif // VEC_UNDEF
 
 #undef vec_cat
@@ -215,3 +340,4 @@ void _vec(put)(struct _vec(t)* vec, vec_size_t pos, vec_elem_t elem)
 #undef _vec
 #undef VEC_FAIL
 #undef VEC_SUCCESS
+#undef VEC_MIN_CAPACITY